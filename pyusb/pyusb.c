@@ -21,17 +21,21 @@
 #define Py_RETURN_NONE return Py_INCREF(Py_None), Py_None
 #endif
 
-#if (PY_VERSION_HEX < 0x02050000)
-typedef int Py_ssize_t;
-#endif
-
 // PYUSB_STATIC char cvsid[] = "$Id: pyusb.c,v 1.29 2009/04/06 18:03:10 wander Exp $";
 
 /*
- * USBError
+ * USBError, and its subclasses for the errors worth telling apart
  */
 PYUSB_STATIC PyObject *PyExc_USBError;
+PYUSB_STATIC PyObject *PyExc_USBTimeoutError;
+PYUSB_STATIC PyObject *PyExc_USBPipeError;
+PYUSB_STATIC PyObject *PyExc_USBNoDeviceError;
+PYUSB_STATIC PyObject *PyExc_USBOverflowError;
 
+/*
+ * usb_strerror is shared by all the threads, only used when
+ * the failed call gives no error code
+ */
 void static PyUSB_Error(void)
 {
     char *error_message = usb_strerror();
@@ -42,6 +46,48 @@ void static PyUSB_Error(void)
     PyErr_SetString(PyExc_USBError, error_message);
 }
 
+/*
+ * USBError subclass for an errno value
+ */
+PYUSB_STATIC PyObject *errnoClass(
+	int error
+	)
+{
+	switch (error) {
+	case ETIMEDOUT:
+		return PyExc_USBTimeoutError;
+	case EPIPE:
+		return PyExc_USBPipeError;
+	case ENODEV:
+#ifdef ESHUTDOWN
+	case ESHUTDOWN:
+#endif /* ESHUTDOWN */
+		return PyExc_USBNoDeviceError;
+#ifdef EOVERFLOW
+	case EOVERFLOW:
+		return PyExc_USBOverflowError;
+#endif /* EOVERFLOW */
+	default:
+		return PyExc_USBError;
+	}
+}
+
+/*
+ * Raises USBError(errno, message) for the negative errno returned
+ * by a libusb call or a transfer. The code is kept by the calling
+ * thread, unlike the message of usb_strerror.
+ */
+void static PyUSB_ErrnoError(int error)
+{
+	PyObject *args;
+
+	args = Py_BuildValue("(is)", -error, strerror(-error));
+	if (!args) return;
+
+	PyErr_SetObject(errnoClass(-error), args);
+	Py_DECREF(args);
+}
+
 #define SUPPORT_NUMBER_PROTOCOL(_Arg) \
 	(PyNumber_Check(_Arg) || PyString_Check(_Arg) || PyUnicode_Check(_Arg))
 
@@ -131,89 +177,556 @@ PYUSB_STATIC u_int8_t getByte(
 	return byte;
 }
 
+/*
+ * Build a numeric tuple from the buffer values
+ */
+PYUSB_STATIC PyObject *buildTuple(
+	char *buffer,
+	int size
+	)
+{
+	PyObject *ret;
+	int i;
+
+	ret = PyTuple_New(size);
+
+	if (ret) {
+		for (i = 0; i < size; ++i) {
+			PyTuple_SET_ITEM(ret, i, PyInt_FromLong((u_int8_t) buffer[i]));
+		}
+	}
+
+	return ret;
+}
+
+/*
+ * Transfer buffer pool
+ *
+ * Each DeviceHandle keeps freed scratch buffers in free lists by
+ * power of two size classes, so steady state transfers do not touch
+ * the allocator. A free block stores the free list link in its first
+ * bytes. The pool is only used with the GIL held.
+ */
+
+PYUSB_STATIC void *poolAllocBlock(
+	size_t size,
+	int pageAligned
+	)
+{
+#if defined _WIN32 && !defined unix
+	return _aligned_malloc(size, pageAligned ? PYUSB_PAGE_SIZE : sizeof(double));
+#else
+	void *p;
+
+	if (!pageAligned) return malloc(size);
+	if (posix_memalign(&p, PYUSB_PAGE_SIZE, size)) return NULL;
+	return p;
+#endif /* _WIN32 */
+}
+
+PYUSB_STATIC void poolFreeBlock(
+	void *p
+	)
+{
+#if defined _WIN32 && !defined unix
+	_aligned_free(p);
+#else
+	free(p);
+#endif /* _WIN32 */
+}
+
+/*
+ * Returns the size class for size bytes, or -1 if the
+ * block is too big to be pooled
+ */
+PYUSB_STATIC int poolClass(
+	size_t size
+	)
+{
+	int sizeClass = 0;
+
+	while (PYUSB_POOL_CLASS_SIZE(sizeClass) < size)
+		if (++sizeClass == PYUSB_POOL_CLASSES) return -1;
+
+	return sizeClass;
+}
+
+PYUSB_STATIC void poolInit(
+	PyUSB_Pool *pool
+	)
+{
+	memset(pool, 0, sizeof(*pool));
+	pool->highWater = PYUSB_POOL_HIGH_WATER;
+}
+
+/*
+ * Frees the blocks in the free lists until no more
+ * than highWater bytes are held
+ */
+PYUSB_STATIC void poolTrim(
+	PyUSB_Pool *pool,
+	unsigned long highWater
+	)
+{
+	int i;
+
+	for (i = PYUSB_POOL_CLASSES - 1; i >= 0 && pool->held > highWater; --i) {
+		while (pool->freeList[i] && pool->held > highWater) {
+			void *p = pool->freeList[i];
+			pool->freeList[i] = *(void **) p;
+			pool->held -= PYUSB_POOL_CLASS_SIZE(i);
+			poolFreeBlock(p);
+		}
+	}
+}
+
+PYUSB_STATIC void *poolAlloc(
+	PyUSB_Pool *pool,
+	size_t size
+	)
+{
+	int sizeClass = poolClass(size);
+	void *p;
+
+	if (sizeClass >= 0 && pool->freeList[sizeClass]) {
+		p = pool->freeList[sizeClass];
+		pool->freeList[sizeClass] = *(void **) p;
+		pool->held -= PYUSB_POOL_CLASS_SIZE(sizeClass);
+		++pool->hits;
+		return p;
+	}
+
+	++pool->misses;
+	p = poolAllocBlock(sizeClass >= 0 ? PYUSB_POOL_CLASS_SIZE(sizeClass) : size,
+					   pool->pageAligned);
+	if (!p) PyErr_NoMemory();
+	return p;
+}
+
+/*
+ * Gives back a block of size bytes allocated with poolAlloc
+ */
+PYUSB_STATIC void poolFree(
+	PyUSB_Pool *pool,
+	void *p,
+	size_t size
+	)
+{
+	int sizeClass = poolClass(size);
+
+	/* borrowed before the pool switched to page aligned blocks */
+	if (pool->pageAligned && ((size_t) p & (PYUSB_PAGE_SIZE - 1)))
+		sizeClass = -1;
+
+	if (sizeClass < 0 ||
+		pool->held + PYUSB_POOL_CLASS_SIZE(sizeClass) > pool->highWater) {
+		poolFreeBlock(p);
+	} else {
+		*(void **) p = pool->freeList[sizeClass];
+		pool->freeList[sizeClass] = p;
+		pool->held += PYUSB_POOL_CLASS_SIZE(sizeClass);
+	}
+}
+
+/*
+ * Default format of the data returned by the read methods
+ * of new DeviceHandle objects
+ */
+PYUSB_STATIC int resultFormat = PYUSB_FORMAT_TUPLE;
+
+/*
+ * array('B', [0]) and array('i', [0]), repeated to create arrays
+ */
+PYUSB_STATIC PyObject *arrayTemplate = NULL;
+PYUSB_STATIC PyObject *intArrayTemplate = NULL;
+
+/*
+ * Creates an array of count zeros repeating *template, which is
+ * created with typecode on first use. data is set to the items.
+ */
+PYUSB_STATIC PyObject *newArray(
+	PyObject **template,
+	const char *typecode,
+	Py_ssize_t count,
+	void **data
+	)
+{
+	PyObject *result;
+	Py_ssize_t len;
+
+	if (!*template) {
+		PyObject *array = PyImport_ImportModule("array");
+		if (!array) return NULL;
+		*template = PyObject_CallMethod(array, "array", "s[i]", typecode, 0);
+		Py_DECREF(array);
+		if (!*template) return NULL;
+	}
+
+	result = PySequence_Repeat(*template, count);
+
+	if (result && PyObject_AsWriteBuffer(result, data, &len) < 0)
+		Py_CLEAR(result);
+
+	return result;
+}
+
+PYUSB_STATIC int checkResultFormat(
+	int format
+	)
+{
+	switch (format) {
+	case PYUSB_FORMAT_TUPLE:
+	case PYUSB_FORMAT_BYTES:
+#if PYUSB_HAS_NEW_BUFFER
+	case PYUSB_FORMAT_BYTEARRAY:
+#endif /* PYUSB_HAS_NEW_BUFFER */
+	case PYUSB_FORMAT_ARRAY:
+		return 0;
+	default:
+		PyErr_SetString(PyExc_ValueError, "Invalid result format");
+		return -1;
+	}
+}
+
+/*
+ * Releases a buffer obtained with getBuffer, getWritableBuffer
+ * or newReadBuffer
+ */
+PYUSB_STATIC void releaseBuffer(
+	PyUSB_Buffer *buffer
+	)
+{
+#if PYUSB_HAS_NEW_BUFFER
+	if (buffer->hasView) {
+		PyBuffer_Release(&buffer->view);
+		buffer->hasView = 0;
+	}
+#endif /* PYUSB_HAS_NEW_BUFFER */
+
+	if (buffer->allocated) {
+		poolFree(buffer->pool, buffer->data, buffer->allocated);
+		buffer->allocated = 0;
+	}
+
+	Py_XDECREF(buffer->obj);
+	buffer->obj = NULL;
+	buffer->data = NULL;
+	buffer->size = 0;
+}
+
+/*
+ * Gets a scratch buffer of size bytes from the pool
+ */
+PYUSB_STATIC int newScratchBuffer(
+	PyUSB_Pool *pool,
+	Py_ssize_t size,
+	PyUSB_Buffer *buffer
+	)
+{
+	memset(buffer, 0, sizeof(*buffer));
+
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "Negative buffer size");
+		return -1;
+	}
+
+	buffer->data = (char *) poolAlloc(pool, size ? size : 1);
+	if (!buffer->data) return -1;
+
+	buffer->pool = pool;
+	buffer->allocated = size ? size : 1;
+	buffer->size = size;
+	return 0;
+}
+
+/*
+ * Allocates the buffer for a read of size bytes.
+ * Except for tuples, the result object itself is allocated
+ * and kept in buffer->obj, and buffer->data points to its
+ * contents, so the data is read in place and never copied.
+ * For tuples, a scratch buffer is taken from the pool.
+ * Returns 0 on success or -1 with an exception set.
+ */
+PYUSB_STATIC int newReadBuffer(
+	PyUSB_Pool *pool,
+	int format,
+	Py_ssize_t size,
+	PyUSB_Buffer *buffer
+	)
+{
+	PyObject *result = NULL;
+
+	memset(buffer, 0, sizeof(*buffer));
+
+	if (size < 0) {
+		PyErr_SetString(PyExc_ValueError, "Negative buffer size");
+		return -1;
+	}
+
+	if (format == PYUSB_FORMAT_TUPLE)
+		return newScratchBuffer(pool, size, buffer);
+
+	switch (format) {
+	case PYUSB_FORMAT_BYTES:
+		result = PyString_FromStringAndSize(NULL, size);
+		if (result) buffer->data = PyString_AS_STRING(result);
+		break;
+
+#if PYUSB_HAS_NEW_BUFFER
+	case PYUSB_FORMAT_BYTEARRAY:
+		result = PyByteArray_FromStringAndSize(NULL, size);
+		if (result) buffer->data = PyByteArray_AS_STRING(result);
+		break;
+#endif /* PYUSB_HAS_NEW_BUFFER */
+
+	case PYUSB_FORMAT_ARRAY: {
+		void *data;
+
+		result = newArray(&arrayTemplate, "B", size, &data);
+		if (result) buffer->data = (char *) data;
+		break;
+	}
+	}
+
+	if (!result) return -1;
+
+	buffer->obj = result;
+	buffer->size = size;
+	return 0;
+}
+
+/*
+ * Returns the read result with the size bytes actually read.
+ * The buffer allocated by newReadBuffer is released.
+ */
+PYUSB_STATIC PyObject *buildResult(
+	int format,
+	PyUSB_Buffer *buffer,
+	int size
+	)
+{
+	PyObject *result = buffer->obj;
+
+	if (!result) {
+		result = buildTuple(buffer->data, size);
+		releaseBuffer(buffer);
+		return result;
+	}
+
+	buffer->obj = NULL;
+	releaseBuffer(buffer);
+
+	switch (format) {
+	case PYUSB_FORMAT_BYTES:
+		if (PyString_GET_SIZE(result) != size)
+			_PyString_Resize(&result, size);
+		break;
+
+#if PYUSB_HAS_NEW_BUFFER
+	case PYUSB_FORMAT_BYTEARRAY:
+		if (PyByteArray_GET_SIZE(result) != size &&
+			PyByteArray_Resize(result, size) < 0) {
+			Py_CLEAR(result);
+		}
+		break;
+#endif /* PYUSB_HAS_NEW_BUFFER */
+
+	case PYUSB_FORMAT_ARRAY:
+		if (PySequence_Size(result) != size &&
+			PySequence_DelSlice(result, size, PY_SSIZE_T_MAX) < 0) {
+			Py_CLEAR(result);
+		}
+		break;
+	}
+
+	return result;
+}
+
+/*
+ * Gets the writable memory of an object supporting the buffer
+ * protocol (bytearray, array, mmap, memoryview...), starting at offset.
+ * No data is copied, the transfer is done straight to the object memory.
+ * Returns 0 on success or -1 with an exception set.
+ */
+PYUSB_STATIC int getWritableBuffer(
+	PyObject *obj,
+	Py_ssize_t offset,
+	PyUSB_Buffer *buffer
+	)
+{
+	memset(buffer, 0, sizeof(*buffer));
+
+#if PYUSB_HAS_NEW_BUFFER
+	if (PyObject_CheckBuffer(obj)) {
+		if (PyObject_GetBuffer(obj, &buffer->view, PyBUF_WRITABLE) < 0)
+			return -1;
+
+		buffer->hasView = 1;
+		buffer->data = (char *) buffer->view.buf;
+		buffer->size = buffer->view.len;
+	} else
+#endif /* PYUSB_HAS_NEW_BUFFER */
+	{
+		void *p;
+		Py_ssize_t size;
+
+		if (PyObject_AsWriteBuffer(obj, &p, &size) < 0)
+			return -1;
+
+		Py_INCREF(obj);
+		buffer->obj = obj;
+		buffer->data = (char *) p;
+		buffer->size = size;
+	}
+
+	if (offset < 0 || offset > buffer->size) {
+		releaseBuffer(buffer);
+		PyErr_SetString(PyExc_ValueError, "offset out of buffer range");
+		return -1;
+	}
+
+	buffer->data += offset;
+	buffer->size -= offset;
+
+	/* libusb takes the transfer size as int */
+	if (buffer->size > INT_MAX) buffer->size = INT_MAX;
+
+	return 0;
+}
+
+/*
+ * Gets the contiguous memory of an object supporting the buffer
+ * protocol. Only objects whose items are bytes are accepted, so
+ * array('H') and friends keep the element by element conversion.
+ * Returns 1 on success, 0 if the object does not qualify or -1 with
+ * an exception set.
+ */
+PYUSB_STATIC int getReadableBuffer(
+	PyObject *obj,
+	PyUSB_Buffer *buffer
+	)
+{
+	const void *p;
+	Py_ssize_t size;
+
+#if PYUSB_HAS_NEW_BUFFER
+	if (PyObject_CheckBuffer(obj)) {
+		if (PyObject_GetBuffer(obj, &buffer->view, PyBUF_SIMPLE) < 0) {
+			/* non contiguous, let the sequence protocol handle it */
+			if (!PyErr_ExceptionMatches(PyExc_BufferError)) return -1;
+			PyErr_Clear();
+			return 0;
+		}
+
+		if (buffer->view.itemsize != 1) {
+			PyBuffer_Release(&buffer->view);
+			return 0;
+		}
+
+		buffer->hasView = 1;
+		buffer->data = (char *) buffer->view.buf;
+		buffer->size = buffer->view.len;
+		return 1;
+	}
+#endif /* PYUSB_HAS_NEW_BUFFER */
+
+	if (!PyObject_CheckReadBuffer(obj)) return 0;
+	if (PyObject_AsReadBuffer(obj, &p, &size) < 0) return -1;
+
+	/* the old interface does not tell the item size */
+	if (PySequence_Check(obj) && PySequence_Size(obj) != size) {
+		PyErr_Clear();
+		return 0;
+	}
+
+	Py_INCREF(obj);
+	buffer->obj = obj;
+	buffer->data = (char *) p;
+	buffer->size = size;
+	return 1;
+}
+
 /*
  * Gets a unsigned byte * representation of the obj
+ * If the obj supports the buffer protocol (str, bytearray, array('B'),
+ * mmap...), its memory is used directly, without any copy.
  * If the obj is a sequence, returns the elements as a c byte array representation
  * If it is a mapping, returns the c byte array representations of the obj.values()
+ * Returns 0 on success or -1 with an exception set. The buffer must be
+ * released with releaseBuffer after the transfer.
  */
-PYUSB_STATIC char *getBuffer(
+PYUSB_STATIC int getBuffer(
+	PyUSB_Pool *pool,
 	PyObject *obj,
-	Py_ssize_t *size
+	PyUSB_Buffer *buffer
 	)
 {
-	char *p = NULL;
+	int ret;
 
-	/*
-	 * When the obj is a sequence type, we take the first byte from
-	 * the each element of the sequence
-	 */
+	memset(buffer, 0, sizeof(*buffer));
 
 	/* ok, string is a sequence too, but let us optimize it */
-	if (PyString_Check(obj) || PyUnicode_Check(obj)) { 
+	if (PyString_Check(obj) || PyUnicode_Check(obj)) {
 		char *tmp;
 
-		if (-1 != PyString_AsStringAndSize(obj, &tmp, size)) {
-			p = (char *) PyMem_Malloc(*size);
-			if (p) memcpy(p, tmp, *size);
-		}
-	} else if (PySequence_Check(obj)) {
-		u_int32_t i, sz;
+		if (-1 == PyString_AsStringAndSize(obj, &tmp, &buffer->size))
+			return -1;
+
+		Py_INCREF(obj);
+		buffer->obj = obj;
+		buffer->data = tmp;
+		return 0;
+	}
+
+	ret = getReadableBuffer(obj, buffer);
+	if (ret) return ret < 0 ? -1 : 0;
+
+	/*
+	 * When the obj is a sequence type, we take the first byte from
+	 * the each element of the sequence
+	 */
+	if (PySequence_Check(obj)) {
+		Py_ssize_t i, sz;
 		PyObject *el;
+		char *p;
 
 		sz = PySequence_Size(obj);
-		p = (char *) PyMem_Malloc(sz);
+		if (sz < 0) return -1;
+		if (newScratchBuffer(pool, sz, buffer) < 0) return -1;
+		p = buffer->data;
 
 		for (i = 0; i < sz; ++i) {
 			el = PySequence_GetItem(obj, i);
+			if (!el) {
+				releaseBuffer(buffer);
+				return -1;
+			}
+
 			p[i] = getByte(el);
 			Py_DECREF(el);
 
 			if (!p[i] && PyErr_Occurred()) {
-				PyMem_Free(p);
-				return NULL;
+				releaseBuffer(buffer);
+				return -1;
 			}
 		}
-
-		*size = sz;
 	} else if (PyMapping_Check(obj)) {
 		PyObject *values;
 
 		values = PyMapping_Values(obj);
-		if (!values) return NULL;
+		if (!values) return -1;
 
-		p = getBuffer(values, size);
+		ret = getBuffer(pool, values, buffer);
 		Py_DECREF(values);
+		return ret;
 	} else if (obj == Py_None) {
-		*size = 0;
-		return NULL;
+		return 0;
 	} else {
 		PyErr_BadArgument();
-		return NULL;
-	}
-
-	return p;
-}
-
-/*
- * Build a numeric tuple from the buffer values
- */
-PYUSB_STATIC PyObject *buildTuple(
-	char *buffer,
-	int size
-	)
-{
-	PyObject *ret;
-	int i;
-
-	ret = PyTuple_New(size);
-
-	if (ret) {
-		for (i = 0; i < size; ++i) {
-			PyTuple_SET_ITEM(ret, i, PyInt_FromLong((u_int8_t) buffer[i]));
-		}
+		return -1;
 	}
 
-	return ret;
+	return 0;
 }
 
 /*
@@ -302,12 +815,130 @@ PYUSB_STATIC void installModuleConstants(
 	addConstant(dict, "ENDPOINT_IN", USB_ENDPOINT_IN);
 	addConstant(dict, "ENDPOINT_OUT", USB_ENDPOINT_OUT);
 	addConstant(dict, "ERROR_BEGIN", USB_ERROR_BEGIN);
+	addConstant(dict, "FORMAT_TUPLE", PYUSB_FORMAT_TUPLE);
+	addConstant(dict, "FORMAT_BYTES", PYUSB_FORMAT_BYTES);
+#if PYUSB_HAS_NEW_BUFFER
+	addConstant(dict, "FORMAT_BYTEARRAY", PYUSB_FORMAT_BYTEARRAY);
+#endif /* PYUSB_HAS_NEW_BUFFER */
+	addConstant(dict, "FORMAT_ARRAY", PYUSB_FORMAT_ARRAY);
 }
 
 /*
- * Earlier versions of the PyUSB separate direction bit and
- * endpoint address with direction and address fields...
- * Windows version of the libusb does need direction
+ * Raw configuration descriptors. libusb does not keep them, they
+ * are rebuilt from the parsed descriptors and the extra descriptors.
+ */
+PYUSB_STATIC size_t rawPut(
+	unsigned char *out,
+	size_t pos,
+	const unsigned char *data,
+	int size,
+	const unsigned char *find,
+	size_t *found
+	)
+{
+	if (size <= 0) return pos;
+	if (find && data == find) *found = pos;
+	if (out) memcpy(out + pos, data, size);
+	return pos + size;
+}
+
+/*
+ * Writes the raw descriptor of a configuration to out, which may be
+ * NULL to get its size. If find is the extra descriptors of the
+ * configuration, of one of its interfaces or of one of its endpoints,
+ * their offset is stored in found.
+ */
+PYUSB_STATIC size_t rawConfig(
+	struct usb_config_descriptor *config,
+	unsigned char *out,
+	const unsigned char *find,
+	size_t *found
+	)
+{
+	struct usb_interface_descriptor *alt;
+	struct usb_endpoint_descriptor *ep;
+	unsigned char d[9];
+	size_t pos = 9;		/* the header is written once the length is known */
+	int i, a, e;
+
+	pos = rawPut(out, pos, config->extra, config->extralen, find, found);
+
+	for (i = 0; i < config->bNumInterfaces; ++i) {
+		for (a = 0; a < config->interface[i].num_altsetting; ++a) {
+			alt = config->interface[i].altsetting + a;
+
+			d[0] = 9;
+			d[1] = USB_DT_INTERFACE;
+			d[2] = alt->bInterfaceNumber;
+			d[3] = alt->bAlternateSetting;
+			d[4] = alt->bNumEndpoints;
+			d[5] = alt->bInterfaceClass;
+			d[6] = alt->bInterfaceSubClass;
+			d[7] = alt->bInterfaceProtocol;
+			d[8] = alt->iInterface;
+
+			pos = rawPut(out, pos, d, 9, NULL, NULL);
+			pos = rawPut(out, pos, alt->extra, alt->extralen, find, found);
+
+			for (e = 0; e < alt->bNumEndpoints; ++e) {
+				ep = alt->endpoint + e;
+
+				/* audio endpoints have two more fields */
+				d[0] = ep->bLength >= 9 ? 9 : 7;
+				d[1] = USB_DT_ENDPOINT;
+				d[2] = ep->bEndpointAddress;
+				d[3] = ep->bmAttributes;
+				PYUSB_PUT_LE16(d + 4, ep->wMaxPacketSize);
+				d[6] = ep->bInterval;
+				d[7] = ep->bRefresh;
+				d[8] = ep->bSynchAddress;
+
+				pos = rawPut(out, pos, d, d[0], NULL, NULL);
+				pos = rawPut(out, pos, ep->extra, ep->extralen, find, found);
+			}
+		}
+	}
+
+	if (out) {
+		d[0] = 9;
+		d[1] = USB_DT_CONFIG;
+		PYUSB_PUT_LE16(d + 2, pos);
+		d[4] = config->bNumInterfaces;
+		d[5] = config->bConfigurationValue;
+		d[6] = config->iConfiguration;
+		d[7] = config->bmAttributes;
+		d[8] = config->MaxPower;
+		memcpy(out, d, 9);
+	}
+
+	return pos;
+}
+
+/*
+ * Read-only view of extra descriptors in the raw descriptor of their
+ * configuration, which the view keeps alive
+ */
+PYUSB_STATIC PyObject *extraView(
+	PyObject *raw,
+	struct usb_config_descriptor *config,
+	const unsigned char *extra,
+	int extralen
+	)
+{
+	size_t offset = 0;
+
+	if (extralen > 0)
+		rawConfig(config, NULL, extra, &offset);
+	else
+		extralen = 0;
+
+	return PyBuffer_FromObject(raw, (Py_ssize_t) offset, extralen);
+}
+
+/*
+ * Earlier versions of the PyUSB separate direction bit and
+ * endpoint address with direction and address fields...
+ * Windows version of the libusb does need direction
  * bit in endpoint address to works fine.
  * Thanks to Ray Schumacher.
  */
@@ -344,6 +975,13 @@ PYUSB_STATIC PyMemberDef Py_usb_Endpoint_Members[] = {
 	 "the interval for polling isochronous endpoints, or the maximum NAK\n"
 	 "rate for high-speed bulk OUT or control endpoints."},
 
+	{"extra",
+	 T_OBJECT,
+	 offsetof(Py_usb_Endpoint, extra),
+	 READONLY,
+	 "Read-only buffer with the class-specific descriptors that\n"
+	 "follow the endpoint descriptor, like the audio ones."},
+
 	{NULL}
 };
 
@@ -351,13 +989,21 @@ PYUSB_STATIC PyMethodDef Py_usb_Endpoint_Methods[] = {
 	{NULL, NULL}
 };
 
+PYUSB_STATIC void Py_usb_Endpoint_del(
+	PyObject *self
+	)
+{
+	Py_XDECREF(((Py_usb_Endpoint *) self)->extra);
+	PyObject_Del(self);
+}
+
 PYUSB_STATIC PyTypeObject Py_usb_Endpoint_Type = {
     PyObject_HEAD_INIT(NULL)
     0,                         /*ob_size*/
     "usb.Endpoint",  /*tp_name*/
     sizeof(Py_usb_Endpoint), /*tp_basicsize*/
     0,                         /*tp_itemsize*/
-    0,                         /*tp_dealloc*/
+    Py_usb_Endpoint_del,       /*tp_dealloc*/
     0,                         /*tp_print*/
     0,                         /*tp_getattr*/
     0,                         /*tp_setattr*/
@@ -403,7 +1049,8 @@ PYUSB_STATIC PyTypeObject Py_usb_Endpoint_Type = {
 
 PYUSB_STATIC void set_Endpoint_fields(
 	Py_usb_Endpoint *endpoint,
-	struct usb_endpoint_descriptor *ep
+	struct usb_endpoint_descriptor *ep,
+	PyObject *extra
 	)
 {
 	endpoint->address = ep->bEndpointAddress;
@@ -412,19 +1059,30 @@ PYUSB_STATIC void set_Endpoint_fields(
 	endpoint->interval = ep->bInterval;
 	endpoint->refresh = ep->bRefresh;
 	// endpoint->synchAddress - ep->bSynchAddress;
+	endpoint->extra = extra;
 }
 
+/*
+ * Steals the reference to extra
+ */
 PYUSB_STATIC Py_usb_Endpoint *new_Endpoint(
-	struct usb_endpoint_descriptor *ep
+	struct usb_endpoint_descriptor *ep,
+	PyObject *extra
 	)
 {
 	Py_usb_Endpoint *endpoint;
 
+	if (!extra) return NULL;
+
 	endpoint = PyObject_New(Py_usb_Endpoint,
 							&Py_usb_Endpoint_Type);
 
-	if (endpoint && ep)
-		set_Endpoint_fields(endpoint, ep);
+	if (!endpoint) {
+		Py_DECREF(extra);
+		return NULL;
+	}
+
+	set_Endpoint_fields(endpoint, ep, extra);
 
 	return endpoint;
 }
@@ -470,21 +1128,115 @@ PYUSB_STATIC PyMemberDef Py_usb_Interface_Members[] = {
  	 "Similar to iInterface in the device\n"
  	 "descriptor, but for devices whose class is defined by the interface."},
 
-	{"endpoints",
+	{"extra",
 	 T_OBJECT,
-	 offsetof(Py_usb_Interface, endpoints),
+	 offsetof(Py_usb_Interface, extra),
 	 READONLY,
-	 "Tuple with interface endpoints."},
-	
+	 "Read-only buffer with the class-specific descriptors that\n"
+	 "follow the interface descriptor, like the HID, audio or CDC\n"
+	 "functional ones."},
+
+	{NULL}
+};
+
+/*
+ * Configurations, interfaces and endpoints are built on first
+ * access from the descriptors parsed by libusb, which are freed
+ * when the device is removed.
+ */
+PYUSB_STATIC int deviceAlive(
+	PyObject *device
+	)
+{
+	if (device && ((Py_usb_Device *) device)->dev) return 1;
+
+	PyErr_SetString(PyExc_USBError, "device has been removed");
+	return 0;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Interface_getEndpoints(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_Interface *_self = (Py_usb_Interface *) self;
+	struct usb_interface_descriptor *i = _self->descriptor;
+	PyObject *endpoints;
+	u_int8_t index;
+
+	if (!_self->endpoints) {
+		enumLock();
+
+		if (!deviceAlive(_self->device) ||
+			!(endpoints = PyTuple_New(i->bNumEndpoints))) {
+			enumUnlock();
+			return NULL;
+		}
+
+		for (index = 0; index < i->bNumEndpoints; ++index) {
+			struct usb_endpoint_descriptor *ep = i->endpoint + index;
+			PyObject *endpoint = (PyObject *) new_Endpoint(ep,
+					extraView(_self->raw, _self->config, ep->extra, ep->extralen));
+
+			if (!endpoint) {
+				enumUnlock();
+				Py_DECREF(endpoints);
+				return NULL;
+			}
+
+			PyTuple_SET_ITEM(endpoints, index, endpoint);
+		}
+
+		enumUnlock();
+
+		_self->endpoints = endpoints;
+	}
+
+	Py_INCREF(_self->endpoints);
+	return _self->endpoints;
+}
+
+PYUSB_STATIC PyGetSetDef Py_usb_Interface_GetSet[] = {
+	{"endpoints",
+	 Py_usb_Interface_getEndpoints,
+	 NULL,
+	 "Tuple with interface endpoints.",
+	 NULL},
+
 	{NULL}
 };
 
+PYUSB_STATIC int Py_usb_Interface_traverse(
+	PyObject *self,
+	visitproc visit,
+	void *arg
+	)
+{
+	Py_VISIT(((Py_usb_Interface *) self)->endpoints);
+	Py_VISIT(((Py_usb_Interface *) self)->device);
+	Py_VISIT(((Py_usb_Interface *) self)->raw);
+	Py_VISIT(((Py_usb_Interface *) self)->extra);
+	return 0;
+}
+
+PYUSB_STATIC int Py_usb_Interface_clear(
+	PyObject *self
+	)
+{
+	Py_CLEAR(((Py_usb_Interface *) self)->endpoints);
+	Py_CLEAR(((Py_usb_Interface *) self)->device);
+	Py_CLEAR(((Py_usb_Interface *) self)->raw);
+	Py_CLEAR(((Py_usb_Interface *) self)->extra);
+	return 0;
+}
+
 PYUSB_STATIC void Py_usb_Interface_del(
 	PyObject *self
 	)
 {
-	Py_XDECREF((PyObject *) ((Py_usb_Interface *) self)->endpoints);
-	PyObject_Del(self);
+	PyObject_GC_UnTrack(self);
+	Py_usb_Interface_clear(self);
+	PyObject_GC_Del(self);
 }
 
 PYUSB_STATIC PyMethodDef Py_usb_Interface_Methods[] = {
@@ -512,17 +1264,17 @@ PYUSB_STATIC PyTypeObject Py_usb_Interface_Type = {
     0,                         /*tp_getattro*/
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,        /*tp_flags*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
     "Interface descriptor object", 	   /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
+    Py_usb_Interface_traverse, /* tp_traverse */
+    Py_usb_Interface_clear,    /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
     Py_usb_Interface_Methods,  /* tp_methods */
     Py_usb_Interface_Members,  /* tp_members */
-    0,                         /* tp_getset */
+    Py_usb_Interface_GetSet,   /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
@@ -543,44 +1295,49 @@ PYUSB_STATIC PyTypeObject Py_usb_Interface_Type = {
 
 PYUSB_STATIC void set_Interface_fields(
 	Py_usb_Interface *interface,
-	struct usb_interface_descriptor *i
+	PyObject *device,
+	PyObject *raw,
+	struct usb_config_descriptor *config,
+	struct usb_interface_descriptor *i,
+	PyObject *extra
 	)
 {
-	u_int8_t index;
-
 	interface->interfaceNumber = i->bInterfaceNumber;
 	interface->alternateSetting = i->bAlternateSetting;
 	interface->interfaceClass = i->bInterfaceClass;
 	interface->interfaceSubClass = i->bInterfaceSubClass;
 	interface->interfaceProtocol = i->bInterfaceProtocol;
 	interface->iInterface = i->iInterface;
-
-	interface->endpoints = PyTuple_New(i->bNumEndpoints);
-
-	if (!interface->endpoints) {
-		return;
-	}
-
-	for (index = 0; index < i->bNumEndpoints; ++index)
-		PyTuple_SET_ITEM(interface->endpoints, index,
-						(PyObject *) new_Endpoint(i->endpoint+index));
+	interface->descriptor = i;
+	interface->config = config;
+	interface->endpoints = NULL;
+	Py_INCREF(device);
+	interface->device = device;
+	Py_INCREF(raw);
+	interface->raw = raw;
+	interface->extra = extra;
 }
 
 PYUSB_STATIC Py_usb_Interface *new_Interface(
+	PyObject *device,
+	PyObject *raw,
+	struct usb_config_descriptor *config,
 	struct usb_interface_descriptor *i
 	)
 {
 	Py_usb_Interface *interface;
+	PyObject *extra;
 
-	interface = PyObject_NEW(Py_usb_Interface, &Py_usb_Interface_Type);
+	extra = extraView(raw, config, i->extra, i->extralen);
+	if (!extra) return NULL;
 
-	if (interface) {
-		set_Interface_fields(interface, i);
+	interface = PyObject_GC_New(Py_usb_Interface, &Py_usb_Interface_Type);
 
-		if (PyErr_Occurred()) {
-			Py_XDECREF((PyObject *) interface);
-			return NULL;
-		}
+	if (interface) {
+		set_Interface_fields(interface, device, raw, config, i, extra);
+		PyObject_GC_Track((PyObject *) interface);
+	} else {
+		Py_DECREF(extra);
 	}
 
 	return interface;
@@ -620,14 +1377,6 @@ PYUSB_STATIC PyMemberDef Py_usb_Configuration_Members[] = {
 	 "Specifies the device current. This is the absolute value,\n"
 	 "already multiplied by 2"},
 
-	{"interfaces",
-	 T_OBJECT,
-	 offsetof(Py_usb_Configuration, interfaces),
-	 READONLY,
-	 "Tuple with a tuple of the configuration interfaces.\n"
-	 "Each element represents a sequence of the\n"
-	 "alternate settings for each interface."},
-
 	{"iConfiguration",
 	 T_UBYTE,
 	 offsetof(Py_usb_Configuration, iConfiguration),
@@ -642,12 +1391,187 @@ PYUSB_STATIC PyMethodDef Py_usb_Configuration_Methods[] = {
 	{NULL, NULL}
 };
 
+/*
+ * Returns a borrowed reference to the raw descriptor of a
+ * configuration, built on first access
+ */
+PYUSB_STATIC PyObject *configurationRaw(
+	Py_usb_Configuration *configuration
+	)
+{
+	struct usb_config_descriptor *config = configuration->descriptor;
+	PyObject *raw;
+
+	if (!configuration->raw) {
+		enumLock();
+
+		if (!deviceAlive(configuration->device) ||
+			!(raw = PyString_FromStringAndSize(NULL, rawConfig(config, NULL, NULL, NULL)))) {
+			enumUnlock();
+			return NULL;
+		}
+
+		rawConfig(config, (unsigned char *) PyString_AS_STRING(raw), NULL, NULL);
+		configuration->raw = raw;
+
+		enumUnlock();
+	}
+
+	return configuration->raw;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Configuration_getRaw(
+	PyObject *self,
+	void *closure
+	)
+{
+	PyObject *raw = configurationRaw((Py_usb_Configuration *) self);
+
+	Py_XINCREF(raw);
+	return raw;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Configuration_getExtra(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_Configuration *_self = (Py_usb_Configuration *) self;
+	struct usb_config_descriptor *config = _self->descriptor;
+	PyObject *raw;
+
+	if (!_self->extra) {
+		enumLock();
+
+		raw = configurationRaw(_self);
+
+		if (raw && deviceAlive(_self->device))
+			_self->extra = extraView(raw, config, config->extra, config->extralen);
+
+		enumUnlock();
+
+		if (!_self->extra) return NULL;
+	}
+
+	Py_INCREF(_self->extra);
+	return _self->extra;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Configuration_getInterfaces(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_Configuration *_self = (Py_usb_Configuration *) self;
+	struct usb_config_descriptor *config = _self->descriptor;
+	PyObject *interfaces;
+	PyObject *t1;
+	PyObject *interface;
+	PyObject *raw;
+	u_int8_t i, j, k;
+
+	if (!_self->interfaces) {
+		enumLock();
+
+		raw = configurationRaw(_self);
+
+		if (!raw || !deviceAlive(_self->device) ||
+			!(interfaces = PyTuple_New(config->bNumInterfaces))) {
+			enumUnlock();
+			return NULL;
+		}
+
+		for (i = 0; i < config->bNumInterfaces; ++i) {
+			k = config->interface[i].num_altsetting;
+			t1 = PyTuple_New(k);
+
+			if (!t1) goto error;
+
+			PyTuple_SET_ITEM(interfaces, i, t1);
+
+			for (j = 0; j < k; ++j) {
+				interface = (PyObject *) new_Interface(_self->device, raw,
+						config, config->interface[i].altsetting+j);
+				if (!interface) goto error;
+
+				PyTuple_SET_ITEM(t1, j, interface);
+			}
+		}
+
+		enumUnlock();
+
+		_self->interfaces = interfaces;
+	}
+
+	Py_INCREF(_self->interfaces);
+	return _self->interfaces;
+
+error:
+	enumUnlock();
+	Py_DECREF(interfaces);
+	return NULL;
+}
+
+PYUSB_STATIC PyGetSetDef Py_usb_Configuration_GetSet[] = {
+	{"interfaces",
+	 Py_usb_Configuration_getInterfaces,
+	 NULL,
+	 "Tuple with a tuple of the configuration interfaces.\n"
+	 "Each element represents a sequence of the\n"
+	 "alternate settings for each interface.",
+	 NULL},
+
+	{"raw",
+	 Py_usb_Configuration_getRaw,
+	 NULL,
+	 "String with the whole configuration descriptor, interface,\n"
+	 "endpoint and class-specific descriptors included, as returned\n"
+	 "by the device. Rebuilt on first access from the descriptors\n"
+	 "read during the enumeration, without talking to the device.",
+	 NULL},
+
+	{"extra",
+	 Py_usb_Configuration_getExtra,
+	 NULL,
+	 "Read-only buffer with the class-specific descriptors that\n"
+	 "follow the configuration descriptor. Like the extra buffers\n"
+	 "of the interfaces and endpoints, it is a view of raw.",
+	 NULL},
+
+	{NULL}
+};
+
+PYUSB_STATIC int Py_usb_Configuration_traverse(
+	PyObject *self,
+	visitproc visit,
+	void *arg
+	)
+{
+	Py_VISIT(((Py_usb_Configuration *) self)->interfaces);
+	Py_VISIT(((Py_usb_Configuration *) self)->device);
+	Py_VISIT(((Py_usb_Configuration *) self)->raw);
+	Py_VISIT(((Py_usb_Configuration *) self)->extra);
+	return 0;
+}
+
+PYUSB_STATIC int Py_usb_Configuration_clear(
+	PyObject *self
+	)
+{
+	Py_CLEAR(((Py_usb_Configuration *) self)->interfaces);
+	Py_CLEAR(((Py_usb_Configuration *) self)->device);
+	Py_CLEAR(((Py_usb_Configuration *) self)->raw);
+	Py_CLEAR(((Py_usb_Configuration *) self)->extra);
+	return 0;
+}
+
 PYUSB_STATIC void Py_usb_Configuration_del(
 	PyObject *self
 	)
 {
-	Py_XDECREF((PyObject *) ((Py_usb_Configuration *) self)->interfaces);
-	PyObject_Del(self);;
+	PyObject_GC_UnTrack(self);
+	Py_usb_Configuration_clear(self);
+	PyObject_GC_Del(self);
 }
 
 PYUSB_STATIC PyTypeObject Py_usb_Configuration_Type = {
@@ -671,17 +1595,17 @@ PYUSB_STATIC PyTypeObject Py_usb_Configuration_Type = {
     0,                         /*tp_getattro*/
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,        /*tp_flags*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
     "Configuration descriptor object",    /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
+    Py_usb_Configuration_traverse, /* tp_traverse */
+    Py_usb_Configuration_clear, /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
     Py_usb_Configuration_Methods,  /* tp_methods */
     Py_usb_Configuration_Members,  /* tp_members */
-    0,                         /* tp_getset */
+    Py_usb_Configuration_GetSet, /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
@@ -702,52 +1626,36 @@ PYUSB_STATIC PyTypeObject Py_usb_Configuration_Type = {
 
 PYUSB_STATIC void set_Configuration_fields(
 	Py_usb_Configuration *configuration,
+	PyObject *device,
 	struct usb_config_descriptor *config
 	)
 {
-	u_int8_t i, j, k;
-	PyObject *t1;
-
 	configuration->totalLength = config->wTotalLength;
 	configuration->value = config->bConfigurationValue;
 	configuration->iConfiguration = config->iConfiguration;
 	configuration->selfPowered = (config->bmAttributes >> 6) & 1;
 	configuration->remoteWakeup = (config->bmAttributes >> 5) & 1;
 	configuration->maxPower = config->MaxPower << 2;
-
-	configuration->interfaces = PyTuple_New(config->bNumInterfaces);
-
-	if (!configuration->interfaces) return;
-
-	for (i = 0; i < config->bNumInterfaces; ++i) {
-		k = config->interface[i].num_altsetting;
-		t1 = PyTuple_New(k);
-
-		if (!t1) return;
-
-		for (j = 0; j < k; ++j)
-			PyTuple_SET_ITEM(t1, j,
-					(PyObject *) new_Interface(config->interface[i].altsetting+j));
-
-		PyTuple_SET_ITEM(configuration->interfaces, i, t1);
-	}
+	configuration->descriptor = config;
+	configuration->interfaces = NULL;
+	configuration->raw = NULL;
+	configuration->extra = NULL;
+	Py_INCREF(device);
+	configuration->device = device;
 }
 
 PYUSB_STATIC Py_usb_Configuration *new_Configuration(
+	PyObject *device,
 	struct usb_config_descriptor *conf
 	)
 {
 	Py_usb_Configuration *configuration;
 
-	configuration = PyObject_NEW(Py_usb_Configuration, &Py_usb_Configuration_Type);
+	configuration = PyObject_GC_New(Py_usb_Configuration, &Py_usb_Configuration_Type);
 
 	if (configuration) {
-		set_Configuration_fields(configuration, conf);
-
-		if (PyErr_Occurred()) {
-			Py_DECREF((PyObject *) configuration);
-			return NULL;
-		}
+		set_Configuration_fields(configuration, device, conf);
+		PyObject_GC_Track((PyObject *) configuration);
 	}
 
 	return configuration;
@@ -813,12 +1721,6 @@ PYUSB_STATIC PyMemberDef Py_usb_Device_Members[] = {
 	 READONLY,
 	 ""},
 	
-	{"configurations",
-	 T_OBJECT,
-	 offsetof(Py_usb_Device, configurations),
-	 READONLY,
-	 "Tuple with the device configurations."},
-
 	{"iManufacturer",
 	 T_UBYTE,
 	 offsetof(Py_usb_Device, iManufacturer),
@@ -845,38 +1747,279 @@ PYUSB_STATIC PyMemberDef Py_usb_Device_Members[] = {
  	 RO,
  	 "devnum of the device.\n"},
 
+	{"cacheHits",
+	 T_ULONG,
+	 offsetof(Py_usb_Device, cacheHits),
+	 RO,
+	 "Number of reads served by the descriptor cache."},
+
+	{"cacheMisses",
+	 T_ULONG,
+	 offsetof(Py_usb_Device, cacheMisses),
+	 RO,
+	 "Number of cacheable reads that went to the device."},
+
 	{NULL}
 };
 
-PYUSB_STATIC PyObject *Py_usb_Device_open(
-	PyObject *self,
-	PyObject *args
+/*
+ * Descriptor cache of a device, shared by its handles. The standard
+ * descriptors and the strings do not change until the device is
+ * reset or reconfigured, each entry keeps the data read and the
+ * length asked, and serves the requests of at most that length.
+ */
+PYUSB_STATIC PyObject *cacheLookup(
+	Py_usb_Device *device,
+	PyObject *key,
+	long len
 	)
 {
-	return (PyObject *) new_DeviceHandle((Py_usb_Device *) self);
+	PyObject *entry;
+	PyObject *data;
+	long asked;
+
+	if (!key) return NULL;
+
+	entry = PyDict_GetItem(device->cache, key);
+
+	if (entry) {
+		asked = PyInt_AS_LONG(PyTuple_GET_ITEM(entry, 0));
+		data = PyTuple_GET_ITEM(entry, 1);
+
+		/* a shorter answer than asked is the whole descriptor */
+		if (len <= asked || PyString_GET_SIZE(data) < asked) {
+			++device->cacheHits;
+			return data;
+		}
+	}
+
+	++device->cacheMisses;
+	return NULL;
 }
 
-PYUSB_STATIC PyMethodDef Py_usb_Device_Methods[] = {
-	{"open",
-	 Py_usb_Device_open,
-	 METH_NOARGS,
-	 "open() -> DeviceHandle\n\n"
-	 "Open the device for use.\n"
-	 "Returns a DeviceHandle object."},
+PYUSB_STATIC void cacheStore(
+	Py_usb_Device *device,
+	PyObject *key,
+	long len,
+	const char *data,
+	int size
+	)
+{
+	PyObject *entry;
 
-	{NULL, NULL}
-};
+	if (!key) return;
 
-PYUSB_STATIC void Py_usb_Device_del(
-	PyObject *self
+	entry = Py_BuildValue("(ls#)", len, data, size);
+
+	/* caching is best effort */
+	if (!entry || PyDict_SetItem(device->cache, key, entry) < 0)
+		PyErr_Clear();
+
+	Py_XDECREF(entry);
+}
+
+/*
+ * Tells whether a descriptor type is standard and static
+ */
+PYUSB_STATIC int cacheableDescriptor(
+	int type
 	)
 {
-	Py_XDECREF(((Py_usb_Device *) self)->configurations);
-	PyObject_Del(self);;
+	switch (type) {
+	case USB_DT_DEVICE:
+	case USB_DT_CONFIG:
+	case USB_DT_STRING:
+	case PYUSB_DT_DEVICE_QUALIFIER:
+	case PYUSB_DT_OTHER_SPEED_CONFIG:
+	case PYUSB_DT_BOS:
+		return 1;
+	default:
+		return 0;
+	}
 }
 
-PYUSB_STATIC PyTypeObject Py_usb_Device_Type = {
-    PyObject_HEAD_INIT(NULL)
+PYUSB_STATIC void cacheClear(
+	Py_usb_Device *device
+	)
+{
+	if (device->cache) PyDict_Clear(device->cache);
+}
+
+PYUSB_STATIC PyObject *Py_usb_Device_clearCache(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	cacheClear((Py_usb_Device *) self);
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Device_open(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_DeviceHandle *handle = NULL;
+
+	enumLock();
+
+	if (deviceAlive(self))
+		handle = new_DeviceHandle((Py_usb_Device *) self);
+
+	enumUnlock();
+
+	return (PyObject *) handle;
+}
+
+PYUSB_STATIC PyMethodDef Py_usb_Device_Methods[] = {
+	{"open",
+	 Py_usb_Device_open,
+	 METH_NOARGS,
+	 "open() -> DeviceHandle\n\n"
+	 "Open the device for use.\n"
+	 "Returns a DeviceHandle object."},
+
+	{"clearCache",
+	 Py_usb_Device_clearCache,
+	 METH_NOARGS,
+	 "clearCache() -> None\n\n"
+	 "Drops the descriptors and strings cached, see cacheDescriptors.\n"
+	 "Done by DeviceHandle.reset and DeviceHandle.setConfiguration."},
+
+	{NULL, NULL}
+};
+
+PYUSB_STATIC PyObject *Py_usb_Device_getConfigurations(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_Device *_self = (Py_usb_Device *) self;
+	PyObject *configurations;
+	PyObject *configuration;
+	u_int8_t i, n;
+
+	if (!_self->configurations) {
+		enumLock();
+
+		if (!deviceAlive(self)) {
+			enumUnlock();
+			return NULL;
+		}
+
+		n = _self->dev->config ? _self->dev->descriptor.bNumConfigurations : 0;
+
+		configurations = PyTuple_New(n);
+
+		for (i = 0; configurations && i < n; ++i) {
+			configuration = (PyObject *) new_Configuration(self, _self->dev->config+i);
+
+			if (!configuration) {
+				Py_CLEAR(configurations);
+				break;
+			}
+
+			PyTuple_SET_ITEM(configurations, i, configuration);
+		}
+
+		enumUnlock();
+
+		if (!configurations) return NULL;
+
+		_self->configurations = configurations;
+	}
+
+	Py_INCREF(_self->configurations);
+	return _self->configurations;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Device_getCacheDescriptors(
+	PyObject *self,
+	void *closure
+	)
+{
+	return PyBool_FromLong(((Py_usb_Device *) self)->cache != NULL);
+}
+
+PYUSB_STATIC int Py_usb_Device_setCacheDescriptors(
+	PyObject *self,
+	PyObject *value,
+	void *closure
+	)
+{
+	Py_usb_Device *_self = (Py_usb_Device *) self;
+	int enable;
+
+	if (!value) {
+		PyErr_SetString(PyExc_TypeError, "cannot delete cacheDescriptors");
+		return -1;
+	}
+
+	enable = PyObject_IsTrue(value);
+	if (enable < 0) return -1;
+
+	if (!enable) {
+		Py_CLEAR(_self->cache);
+	} else if (!_self->cache) {
+		_self->cache = PyDict_New();
+		if (!_self->cache) return -1;
+	}
+
+	return 0;
+}
+
+PYUSB_STATIC PyGetSetDef Py_usb_Device_GetSet[] = {
+	{"configurations",
+	 Py_usb_Device_getConfigurations,
+	 NULL,
+	 "Tuple with the device configurations, built on first access.",
+	 NULL},
+
+	{"cacheDescriptors",
+	 Py_usb_Device_getCacheDescriptors,
+	 Py_usb_Device_setCacheDescriptors,
+	 "Whether the handles of the device cache the strings read by\n"
+	 "getString and the standard descriptors read by getDescriptor\n"
+	 "(device, configuration, string, device qualifier, other speed\n"
+	 "configuration and BOS). Repeated reads are then served without\n"
+	 "bus traffic, until the device is reset or reconfigured through\n"
+	 "one of its handles or clearCache is called. (default: False)",
+	 NULL},
+
+	{NULL}
+};
+
+PYUSB_STATIC int Py_usb_Device_traverse(
+	PyObject *self,
+	visitproc visit,
+	void *arg
+	)
+{
+	Py_VISIT(((Py_usb_Device *) self)->configurations);
+	Py_VISIT(((Py_usb_Device *) self)->cache);
+	return 0;
+}
+
+PYUSB_STATIC int Py_usb_Device_clear(
+	PyObject *self
+	)
+{
+	Py_CLEAR(((Py_usb_Device *) self)->configurations);
+	Py_CLEAR(((Py_usb_Device *) self)->cache);
+	return 0;
+}
+
+PYUSB_STATIC void Py_usb_Device_del(
+	PyObject *self
+	)
+{
+	PyObject_GC_UnTrack(self);
+	Py_usb_Device_clear(self);
+	PyObject_GC_Del(self);
+}
+
+PYUSB_STATIC PyTypeObject Py_usb_Device_Type = {
+    PyObject_HEAD_INIT(NULL)
     0,                         /*ob_size*/
     "usb.Device",   	   	   /*tp_name*/
     sizeof(Py_usb_Device),     /*tp_basicsize*/
@@ -896,17 +2039,17 @@ PYUSB_STATIC PyTypeObject Py_usb_Device_Type = {
     0,                         /*tp_getattro*/
     0,                         /*tp_setattro*/
     0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,        /*tp_flags*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
     "Device descriptor object",    	   /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
+    Py_usb_Device_traverse,    /* tp_traverse */
+    Py_usb_Device_clear,       /* tp_clear */
     0,                         /* tp_richcompare */
     0,                         /* tp_weaklistoffset */
     0,                         /* tp_iter */
     0,                         /* tp_iternext */
     Py_usb_Device_Methods,     /* tp_methods */
     Py_usb_Device_Members,	   /* tp_members */
-    0,                         /* tp_getset */
+    Py_usb_Device_GetSet,      /* tp_getset */
     0,                         /* tp_base */
     0,                         /* tp_dict */
     0,                         /* tp_descr_get */
@@ -931,7 +2074,6 @@ PYUSB_STATIC void set_Device_fields(
 	)
 {
 	struct usb_device_descriptor *desc = &dev->descriptor;
-	u_int8_t i;
 
 	device->usbVersion[0] = ((desc->bcdUSB >> 12) & 0xf) + '0';
 	device->usbVersion[1] = ((desc->bcdUSB >> 8) & 0xf) + '0';
@@ -959,18 +2101,10 @@ PYUSB_STATIC void set_Device_fields(
 	strcpy(device->filename, dev->filename);
 	device->dev = dev;
  	device->devnum = dev->devnum;
-
-	if (!dev->config) {
-		device->configurations = PyTuple_New(0);
-		return;
-	}
-
-	device->configurations = PyTuple_New(desc->bNumConfigurations);
-
-	if (!device->configurations) return;
-
-	for (i = 0; i < desc->bNumConfigurations; ++i)
-		PyTuple_SET_ITEM(device->configurations, i, (PyObject *) new_Configuration(dev->config+i));
+	device->configurations = NULL;
+	device->cache = NULL;
+	device->cacheHits = 0;
+	device->cacheMisses = 0;
 }
 
 PYUSB_STATIC Py_usb_Device *new_Device(
@@ -979,15 +2113,11 @@ PYUSB_STATIC Py_usb_Device *new_Device(
 {
 	Py_usb_Device *device;
 
-	device = PyObject_NEW(Py_usb_Device, &Py_usb_Device_Type);
+	device = PyObject_GC_New(Py_usb_Device, &Py_usb_Device_Type);
 
 	if (device) {
 		set_Device_fields(device, dev);
-
-		if (PyErr_Occurred()) {
-			Py_DECREF((PyObject *) device);
-			return NULL;
-		}
+		PyObject_GC_Track((PyObject *) device);
 	}
 
 	return device;
@@ -1077,1050 +2207,8254 @@ PYUSB_STATIC PyTypeObject Py_usb_Bus_Type = {
 	0							/* destructor */
 };
 
-PYUSB_STATIC Py_usb_Bus *new_Bus(
-	struct usb_bus *b
+#if PYUSB_SYSFS
+
+/*
+ * Devices built from their raw descriptors, for the enumeration
+ * from sysfs and from snapshots. The structures look like those of
+ * libusb, which only needs the bus dirname and the device filename
+ * to open them.
+ */
+
+/*
+ * Appends the descriptors at data to *extra until the next
+ * descriptor of one of the types stop, up to end. Returns the
+ * position of that descriptor.
+ */
+PYUSB_STATIC unsigned char *rawExtra(
+	unsigned char *data,
+	unsigned char *end,
+	int stop,
+	unsigned char **extra,
+	int *extralen
 	)
 {
-	Py_usb_Bus *bus;
-	u_int32_t i;
-	struct usb_device *dev;
+	unsigned char *start = data;
 
-	bus = PyObject_NEW(Py_usb_Bus, &Py_usb_Bus_Type);
+	while (data + 2 <= end && data[0] >= 2 && data + data[0] <= end) {
+		if (data[1] == USB_DT_CONFIG || data[1] == USB_DT_INTERFACE ||
+			(stop == USB_DT_ENDPOINT && data[1] == USB_DT_ENDPOINT))
+			break;
 
-	if (bus) {
-		bus->location = b->location;
-		strcpy(bus->dirname, b->dirname);
-		for(dev = b->devices, i = 0; dev; dev = dev->next) ++i;
-		bus->devices = PyTuple_New(i);
+		data += data[0];
+	}
 
-		if(!bus->devices) {
-			Py_DECREF((PyObject *) bus);
-			return NULL;
-		}
+	if (data > start) {
+		*extra = start;
+		*extralen = (int) (data - start);
+	}
 
-		for(dev = b->devices, i=0; dev; dev = dev->next, ++i)
-			PyTuple_SET_ITEM(bus->devices, i, (PyObject *) new_Device(dev));
+	return data;
+}
 
-		if (PyErr_Occurred()) {
-			Py_DECREF((PyObject *) bus);
-			bus = NULL;
+PYUSB_STATIC void rawFreeConfigs(
+	struct usb_device *dev
+	)
+{
+	int c, i, a;
+
+	if (!dev->config) return;
+
+	for (c = 0; c < dev->descriptor.bNumConfigurations; ++c) {
+		struct usb_config_descriptor *config = dev->config + c;
+
+		if (!config->interface) continue;
+
+		for (i = 0; i < config->bNumInterfaces; ++i) {
+			for (a = 0; a < config->interface[i].num_altsetting; ++a)
+				free(config->interface[i].altsetting[a].endpoint);
+			free(config->interface[i].altsetting);
 		}
+
+		free(config->interface);
 	}
 
-	return bus;
+	free(dev->config);
+	dev->config = NULL;
 }
 
-PYUSB_STATIC PyMemberDef Py_usb_DeviceHandle_Members[] = {
-	{NULL}
-};
-
 /*
- * def controlMsg(requestType, request, buffer, value = 0, index = 0, timeout = 100)
+ * Parses a configuration descriptor and its interfaces and
+ * endpoints. The extra descriptors point into data.
+ * Returns -1 if out of memory.
  */
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_controlMsg(
-	PyObject *self,
-	PyObject *args,
-	PyObject *kwds
+PYUSB_STATIC int rawParseConfig(
+	struct usb_config_descriptor *config,
+	unsigned char *data,
+	unsigned char *end
 	)
 {
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
-	int requestType;
-	int request;
-	int value = 0;
-	int index = 0;
-	char *bytes;
-	PyObject *data;
-	Py_ssize_t size;
-	int timeout = DEFAULT_TIMEOUT;
-	int ret;
-	int as_read = 0;
+	struct usb_interface_descriptor *alt;
+	struct usb_endpoint_descriptor *ep;
+	struct usb_interface *intf;
+	int numInterfaces = 0;
+	int i;
 
-	static char *kwlist[] = {
-		"requestType",
-		"request",
-		"buffer",
-		"value",
-		"index",
-		"timeout",
-		NULL
-	};
+	config->bLength = data[0];
+	config->bDescriptorType = data[1];
+	config->wTotalLength = PYUSB_LE16(data + 2);
+	config->bNumInterfaces = data[4];
+	config->bConfigurationValue = data[5];
+	config->iConfiguration = data[6];
+	config->bmAttributes = data[7];
+	config->MaxPower = data[8];
+
+	config->interface = (struct usb_interface *)
+		calloc(config->bNumInterfaces ? config->bNumInterfaces : 1, sizeof(*intf));
+	if (!config->interface) return -1;
+
+	data = rawExtra(data + data[0], end, USB_DT_INTERFACE,
+					  &config->extra, &config->extralen);
+
+	while (data + 2 <= end && data[0] >= 2 && data + data[0] <= end) {
+		if (data[1] != USB_DT_INTERFACE || data[0] < 9) {
+			data += data[0];
+			continue;
+		}
 
-	if (!PyArg_ParseTupleAndKeywords(args,
-									 kwds,
-									 "iiO|iii",
-									 kwlist,
-									 &requestType,
-									 &request,
-									 &data,
-									 &value,
-									 &index,
-									 &timeout)) {
-		return NULL;
-	}
+		/* the alternate settings of an interface follow each other */
+		for (i = 0; i < numInterfaces; ++i)
+			if (config->interface[i].altsetting[0].bInterfaceNumber == data[2])
+				break;
 
-	/*
-	 * If is a number, should be a read operation...
-	 */
-	if (PyNumber_Check(data)) {
-		size = py_NumberAsInt(data);
-		if (PyErr_Occurred()) return NULL;
-		bytes = (char *) PyMem_Malloc(size);
-		if (!bytes) return NULL;
-		as_read = 1;
-	} else {
-		bytes = (char *) getBuffer(data, &size);
-		if (PyErr_Occurred()) return NULL;
-	}
+		if (i == numInterfaces) {
+			if (numInterfaces == config->bNumInterfaces) break;
+			++numInterfaces;
+		}
 
+		intf = config->interface + i;
+		alt = (struct usb_interface_descriptor *) realloc(intf->altsetting,
+				(intf->num_altsetting + 1) * sizeof(*alt));
+		if (!alt) return -1;
+
+		intf->altsetting = alt;
+		alt += intf->num_altsetting++;
+		memset(alt, 0, sizeof(*alt));
+
+		alt->bLength = data[0];
+		alt->bDescriptorType = data[1];
+		alt->bInterfaceNumber = data[2];
+		alt->bAlternateSetting = data[3];
+		alt->bNumEndpoints = data[4];
+		alt->bInterfaceClass = data[5];
+		alt->bInterfaceSubClass = data[6];
+		alt->bInterfaceProtocol = data[7];
+		alt->iInterface = data[8];
+
+		data = rawExtra(data + data[0], end, USB_DT_ENDPOINT,
+						  &alt->extra, &alt->extralen);
+
+		if (alt->bNumEndpoints) {
+			alt->endpoint = (struct usb_endpoint_descriptor *)
+				calloc(alt->bNumEndpoints, sizeof(*ep));
+			if (!alt->endpoint) return -1;
+		}
 
-#if DUMP_PARAMS
+		for (i = 0; i < alt->bNumEndpoints; ++i) {
+			if (data + 7 > end || data[0] < 7 || data + data[0] > end ||
+				data[1] != USB_DT_ENDPOINT)
+				break;
+
+			ep = alt->endpoint + i;
+			ep->bLength = data[0];
+			ep->bDescriptorType = data[1];
+			ep->bEndpointAddress = data[2];
+			ep->bmAttributes = data[3];
+			ep->wMaxPacketSize = PYUSB_LE16(data + 4);
+			ep->bInterval = data[6];
+
+			if (data[0] >= 9) {
+				ep->bRefresh = data[7];
+				ep->bSynchAddress = data[8];
+			}
 
-	fprintf(stderr, "controlMsg params:\n"
-		   "\trequestType: %d\n"
-		   "\trequest: %d\n"
-		   "\tvalue: %d\n"
-		   "\tindex: %d\n"
-		   "\ttimeout: %d\n",
-		   requestType,
-		   request,
-		   value,
-		   index,
-		   timeout);
+			data = rawExtra(data + data[0], end, USB_DT_ENDPOINT,
+							  &ep->extra, &ep->extralen);
+		}
 
-	if (as_read) {
-		fprintf(stderr, "\tbuffer: %d\n", size);
-	} else {
-		fprintf(stderr, "controlMsg buffer param:\n");
-		printBuffer(bytes, size);
+		alt->bNumEndpoints = i;
 	}
 
-#endif /* DUMP_PARAMS */
-
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_control_msg(_self->deviceHandle,
-						  requestType,
-						  request,
-						  value,
-						  index,
-						  bytes,
-						  size,
-						  timeout);
-	Py_END_ALLOW_THREADS
+	config->bNumInterfaces = numInterfaces;
 
-	if (ret < 0) {
-		PyMem_Free(bytes);
-		PyUSB_Error();
-		return NULL;
-	} else if (as_read) {
-		PyObject *retObj = buildTuple(bytes, ret);
-		PyMem_Free(bytes);
-		return retObj;
-	} else {
-		PyMem_Free(bytes);
-		return PyInt_FromLong(ret);
-	}
+	return 0;
 }
 
 /*
- * def setConfiguration(configuration)
+ * Builds a device from its raw descriptors: the device descriptor
+ * followed by the configuration descriptors, like the descriptors
+ * attribute of sysfs. raw is not copied nor owned by the device.
+ * Returns NULL if the descriptors are invalid or out of memory.
  */
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_setConfiguration(
-	PyObject *self,
-	PyObject *args
+PYUSB_STATIC PyUSB_RawDevice *rawNewDevice(
+	unsigned char *raw,
+	size_t size
 	)
 {
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
-	int configuration;
-	int ret;
-
-	if (SUPPORT_NUMBER_PROTOCOL(args)) {
-		configuration = (int) PyInt_AS_LONG(args);
-	} else if (PyObject_TypeCheck(args, &Py_usb_Configuration_Type)) {
-		configuration = ((Py_usb_Configuration *) args)->value;
-	} else {
-		PyErr_BadArgument();
+	PyUSB_RawDevice *node;
+	struct usb_device_descriptor *desc;
+	unsigned char *data = raw, *end = raw + size;
+	unsigned int total;
+	int c = 0;
+
+	if (size < USB_DT_DEVICE_SIZE || raw[0] < USB_DT_DEVICE_SIZE ||
+		raw[1] != USB_DT_DEVICE)
 		return NULL;
+
+	node = (PyUSB_RawDevice *) calloc(1, sizeof(*node));
+	if (!node) return NULL;
+
+	node->raw = raw;
+	node->rawSize = size;
+
+	desc = &node->dev.descriptor;
+	desc->bLength = data[0];
+	desc->bDescriptorType = data[1];
+	desc->bcdUSB = PYUSB_LE16(data + 2);
+	desc->bDeviceClass = data[4];
+	desc->bDeviceSubClass = data[5];
+	desc->bDeviceProtocol = data[6];
+	desc->bMaxPacketSize0 = data[7];
+	desc->idVendor = PYUSB_LE16(data + 8);
+	desc->idProduct = PYUSB_LE16(data + 10);
+	desc->bcdDevice = PYUSB_LE16(data + 12);
+	desc->iManufacturer = data[14];
+	desc->iProduct = data[15];
+	desc->iSerialNumber = data[16];
+	desc->bNumConfigurations = data[17];
+
+	data += data[0];
+
+	if (desc->bNumConfigurations) {
+		node->dev.config = (struct usb_config_descriptor *)
+			calloc(desc->bNumConfigurations, sizeof(struct usb_config_descriptor));
+		if (!node->dev.config) goto error;
 	}
 
-#if DUMP_PARAMS
-	
-	fprintf(stderr,
-			"setConfiguration params:\n\tconfiguration: %d\n",
-			configuration);
+	for (; c < desc->bNumConfigurations; ++c) {
+		if (data + 9 > end || data[0] < 9 || data[1] != USB_DT_CONFIG) break;
 
-#endif /* DUMP_PARAMS */
+		total = PYUSB_LE16(data + 2);
+		if (total < data[0] || data + total > end) total = (unsigned int) (end - data);
 
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_set_configuration(_self->deviceHandle, configuration);
-	Py_END_ALLOW_THREADS
+		desc->bNumConfigurations = c + 1;
+		if (rawParseConfig(node->dev.config + c, data, data + total) < 0)
+			goto error;
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		Py_RETURN_NONE;
+		data += total;
+	}
+
+	/* only the configurations found in the attribute */
+	desc->bNumConfigurations = c;
+
+	if (!c) {
+		free(node->dev.config);
+		node->dev.config = NULL;
 	}
+
+	return node;
+
+error:
+	rawFreeConfigs(&node->dev);
+	free(node);
+	return NULL;
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_claimInterface(
-	PyObject *self,
-	PyObject *args
+PYUSB_STATIC void rawFreeDevice(
+	struct usb_device *dev
 	)
 {
-	int interfaceNumber;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyUSB_RawDevice *node = (PyUSB_RawDevice *) dev;
 
-	if (SUPPORT_NUMBER_PROTOCOL(args)) {
-		interfaceNumber = py_NumberAsInt(args);
-		if (PyErr_Occurred()) return NULL;
-	} else if (PyObject_TypeCheck(args, &Py_usb_Interface_Type)) {
-		interfaceNumber = ((Py_usb_Interface *) args)->interfaceNumber;
-	} else {
-		PyErr_BadArgument();
-		return NULL;
-	}
+	rawFreeConfigs(dev);
+	if (node->owned) free(node->raw);
+	free(node);
+}
 
-#if DUMP_PARAMS
+/*
+ * Frees the devices of a list of busses, and the busses
+ */
+PYUSB_STATIC void rawFreeBusses(
+	struct usb_bus *bus
+	)
+{
+	struct usb_bus *nextBus;
+	struct usb_device *dev, *next;
 
-	fprintf(stderr,
-			"claimInterface params:\n\tinterfaceNumber: %d\n",
-			interfaceNumber);
+	for (; bus; bus = nextBus) {
+		nextBus = bus->next;
 
-#endif /* DUMP_PARAMS */
+		for (dev = bus->devices; dev; dev = next) {
+			next = dev->next;
+			rawFreeDevice(dev);
+		}
 
-	if (usb_claim_interface(_self->deviceHandle, interfaceNumber)) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		_self->interfaceClaimed = interfaceNumber;
+		free(bus);
 	}
-
-	Py_RETURN_NONE;
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_detachKernelDriver(
-	PyObject *self,
-	PyObject *args
+/*
+ * Removes the bus at location from a list
+ */
+PYUSB_STATIC struct usb_bus *rawTakeBus(
+	struct usb_bus **list,
+	u_int32_t location
 	)
 {
-	int interfaceNumber;
-#ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
-	int ret;
-#endif
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
-
-	if (SUPPORT_NUMBER_PROTOCOL(args)) {
-		interfaceNumber = py_NumberAsInt(args);
-		if (PyErr_Occurred()) return NULL;
-	} else if (PyObject_TypeCheck(args, &Py_usb_Interface_Type)) {
-		interfaceNumber = ((Py_usb_Interface *) args)->interfaceNumber;
-	} else {
-		PyErr_BadArgument();
-		return NULL;
+	struct usb_bus *bus;
+
+	for (; *list; list = &(*list)->next) {
+		if ((*list)->location == location) {
+			bus = *list;
+			*list = bus->next;
+			bus->next = bus->prev = NULL;
+			return bus;
+		}
 	}
 
-#if DUMP_PARAMS
-
-	fprintf(stderr,
-			"detachKernelDriver params:\n\tinterfaceNumber: %d\n",
-			interfaceNumber);
+	return NULL;
+}
 
-#endif /* DUMP_PARAMS */
-	
-#ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_detach_kernel_driver_np(_self->deviceHandle, interfaceNumber);
-	Py_END_ALLOW_THREADS
+/*
+ * Inserts a device in the list of a bus, by devnum
+ */
+PYUSB_STATIC void rawAddDevice(
+	struct usb_bus *bus,
+	struct usb_device *dev
+	)
+{
+	struct usb_device **p = &bus->devices, *prev = NULL;
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} 
-#endif
+	while (*p && (*p)->devnum < dev->devnum) {
+		prev = *p;
+		p = &(*p)->next;
+	}
 
-	Py_RETURN_NONE;
+	dev->next = *p;
+	dev->prev = prev;
+	if (*p) (*p)->prev = dev;
+	*p = dev;
+	dev->bus = bus;
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_releaseInterface(
-	PyObject *self,
-	PyObject *args
+/*
+ * Sysfs enumeration. The device descriptors and the raw configuration
+ * descriptors are read from the "descriptors" attribute that the kernel
+ * caches, so enumerating neither opens the device nodes nor resumes
+ * suspended devices.
+ */
+PYUSB_STATIC PyObject *sysfsRoot = NULL;		/* directory of the devices, or NULL */
+PYUSB_STATIC struct usb_bus *sysfsBusses = NULL;
+
+/*
+ * Reads a whole sysfs attribute into a NUL terminated buffer
+ * allocated with malloc. Returns NULL and sets errno on error.
+ */
+PYUSB_STATIC unsigned char *sysfsRead(
+	const char *root,
+	const char *name,
+	const char *attr,
+	size_t *size
 	)
 {
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	char path[PATH_MAX];
+	unsigned char *data, *p;
+	size_t allocated = 4096;
+	ssize_t n;
+	int fd, err;
+
+	if (snprintf(path, sizeof(path), "%s/%s/%s", root, name, attr) >= (int) sizeof(path)) {
+		errno = ENAMETOOLONG;
+		return NULL;
+	}
 
-	if (-1 != _self->interfaceClaimed) {
-		int ret;
-		Py_BEGIN_ALLOW_THREADS
-		ret = usb_release_interface(_self->deviceHandle, _self->interfaceClaimed);
-		Py_END_ALLOW_THREADS
+	fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
 
-		if (ret < 0) {
-			PyUSB_Error();
+	data = (unsigned char *) malloc(allocated);
+	*size = 0;
+
+	while (data) {
+		n = read(fd, data + *size, allocated - *size - 1);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			err = errno;
+			free(data);
+			close(fd);
+			errno = err;
 			return NULL;
-		} else {
-			_self->interfaceClaimed = -1;
 		}
-	} else {
-		PyErr_SetString(PyExc_ValueError, "No interface claimed");
-		return NULL;
-	}
 
-	Py_RETURN_NONE;
-}
+		if (!n) break;
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_setAltInterface(
-	PyObject *self,
-	PyObject *args
-	)
-{
-	int altInterface, ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+		*size += n;
 
-	if (SUPPORT_NUMBER_PROTOCOL(args)) {
-		altInterface = (int) py_NumberAsInt(args);
-		if (PyErr_Occurred()) return NULL;
-	} else if (PyObject_TypeCheck(args, &Py_usb_Interface_Type)) {
-		altInterface = ((Py_usb_Interface *) args)->alternateSetting;
-	} else {
-		PyErr_BadArgument();
+		if (*size + 1 == allocated) {
+			allocated *= 2;
+			p = (unsigned char *) realloc(data, allocated);
+			if (!p) free(data);
+			data = p;
+		}
+	}
+
+	close(fd);
+
+	if (!data) {
+		errno = ENOMEM;
 		return NULL;
 	}
 
-#if DUMP_PARAMS
+	data[*size] = '\0';
+	return data;
+}
 
-	fprintf(stderr,
-			"setAltInterface params:\n\taltInterface: %d\n",
-			altInterface);
+PYUSB_STATIC int sysfsReadInt(
+	const char *root,
+	const char *name,
+	const char *attr
+	)
+{
+	unsigned char *data;
+	size_t size;
+	int value;
 
-#endif /* DUMP_PARAMS */
+	data = sysfsRead(root, name, attr, &size);
+	if (!data) return -1;
 
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_set_altinterface(_self->deviceHandle, altInterface);
-	Py_END_ALLOW_THREADS
+	value = atoi((char *) data);
+	free(data);
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		Py_RETURN_NONE;
-	}
+	return value;
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkWrite(
-	PyObject *self,
-	PyObject *args
+/*
+ * Rebuilds sysfsBusses from the sysfs tree. Devices whose
+ * descriptors did not change keep their structure, like libusb
+ * does, the others are freed.
+ * Returns -1 and sets errno on error.
+ */
+PYUSB_STATIC int sysfsRescan(
+	const char *root
 	)
 {
-	int endpoint;
-	int timeout = DEFAULT_TIMEOUT;
-	char *data;
-	Py_ssize_t size;
-	PyObject *bytes;
-	int ret;
-	PyObject *retObj;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	struct usb_bus *old = sysfsBusses, *busses = NULL, *bus, **p;
+	struct usb_device *dev, *next;
+	PyUSB_RawDevice *node;
+	struct dirent *entry;
+	unsigned char *raw;
+	size_t size;
+	char filename[16];
+	int busnum, devnum;
+	DIR *dir;
+
+	dir = opendir(root);
+	if (!dir) return -1;
+
+	while ((entry = readdir(dir))) {
+		/* interfaces are named like 1-1:1.0 */
+		if (entry->d_name[0] == '.' || strchr(entry->d_name, ':')) continue;
+
+		busnum = sysfsReadInt(root, entry->d_name, "busnum");
+		devnum = sysfsReadInt(root, entry->d_name, "devnum");
+		if (busnum < 0 || devnum < 0) continue;
+
+		snprintf(filename, sizeof(filename), "%03d", devnum);
+
+		for (bus = busses; bus && bus->location != (u_int32_t) busnum; bus = bus->next);
+
+		if (!bus) {
+			bus = rawTakeBus(&old, busnum);
+
+			if (!bus) {
+				bus = (struct usb_bus *) calloc(1, sizeof(*bus));
+				if (!bus) goto nomem;
+				snprintf(bus->dirname, sizeof(bus->dirname), "%03d", busnum);
+				bus->location = busnum;
+			}
 
-	if (!PyArg_ParseTuple(args,
-						  "iO|i",
-						  &endpoint,
-						  &bytes,
-						  &timeout)) {
-		return NULL;
-	}
+			for (p = &busses; *p && (*p)->location < bus->location; p = &(*p)->next);
+			bus->next = *p;
+			*p = bus;
 
-	data = getBuffer(bytes, &size);
-	if (PyErr_Occurred()) return NULL;
+			/* during the scan, root_dev lists the devices not seen again yet */
+			bus->root_dev = bus->devices;
+			bus->devices = NULL;
+		}
 
-#if DUMP_PARAMS
+		raw = sysfsRead(root, entry->d_name, "descriptors", &size);
+		if (!raw) continue;
 
-	fprintf(stderr,
-			"bulkWrite params:\n"
-			"\tendpoint: %d\n"
-			"\ttimeout: %d\n",
-			endpoint,
-			timeout);
+		/* unchanged since the last scan, keep the structure */
+		for (dev = bus->root_dev; dev; dev = dev->next) {
+			node = (PyUSB_RawDevice *) dev;
 
-	fprintf(stderr, "bulkWrite buffer param:\n");
-	printBuffer(data, size);
+			if (!strcmp(dev->filename, filename) && node->rawSize == size &&
+				!memcmp(node->raw, raw, size))
+				break;
+		}
 
-#endif /* DUMP_PARAMS */
+		if (dev) {
+			free(raw);
 
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_bulk_write(_self->deviceHandle, endpoint, data, size, timeout);
-	Py_END_ALLOW_THREADS
+			if (dev->prev) dev->prev->next = dev->next;
+			else bus->root_dev = dev->next;
+			if (dev->next) dev->next->prev = dev->prev;
+		} else {
+			node = rawNewDevice(raw, size);
 
-	PyMem_Free(data);
+			if (!node) {
+				free(raw);
+				continue;
+			}
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		retObj = PyInt_FromLong(ret);
+			node->owned = 1;
+			dev = &node->dev;
+			strcpy(dev->filename, filename);
+			dev->devnum = devnum;
+		}
+
+		rawAddDevice(bus, dev);
 	}
 
-	return retObj;
-}
+	closedir(dir);
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkRead(
-	PyObject *self,
-	PyObject *args
-	)
-{
-	int endpoint;
-	int timeout = DEFAULT_TIMEOUT;
-	char *buffer;
-	int size;
-	PyObject *ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	/* the devices not seen again are gone */
+	for (bus = busses; bus; bus = bus->next) {
+		for (dev = bus->root_dev; dev; dev = next) {
+			next = dev->next;
+			rawFreeDevice(dev);
+		}
 
-	if (!PyArg_ParseTuple(args,
-						 "ii|i",
-						 &endpoint,
-						 &size,
-						 &timeout)) {
-		return NULL;
+		bus->root_dev = NULL;
 	}
 
-#if DUMP_PARAMS
-
-	fprintf(stderr,
-			"bulkRead params:\n"
-			"\tendpoint: %d\n"
-			"\tsize: %d\n"
-			"\ttimeout: %d\n",
-			endpoint,
-			size,
-			timeout);
+	rawFreeBusses(old);
+	sysfsBusses = busses;
 
-#endif /* DUMP_PARAMS */
+	return 0;
 
-	buffer = (char *) PyMem_Malloc(size);
-	if (!buffer) return NULL;
+nomem:
+	closedir(dir);
 
-	Py_BEGIN_ALLOW_THREADS
-	size = usb_bulk_read(_self->deviceHandle, endpoint, buffer, size, timeout);
-	Py_END_ALLOW_THREADS
+	/* put the list back together, nothing is lost */
+	for (bus = busses; bus; bus = bus->next) {
+		for (dev = bus->root_dev; dev; dev = next) {
+			next = dev->next;
+			rawAddDevice(bus, dev);
+		}
 
-	if (size < 0) {
-		PyMem_Free(buffer);
-		PyUSB_Error();
-		return NULL;
-	} else {
-		ret = buildTuple(buffer, size);
-		PyMem_Free(buffer);
+		bus->root_dev = NULL;
 	}
 
-	return ret;
+	for (p = &busses; *p; p = &(*p)->next);
+	*p = old;
+	sysfsBusses = busses;
+
+	errno = ENOMEM;
+	return -1;
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptWrite(
-	PyObject *self,
-	PyObject *args
+/*
+ * Snapshots of the enumeration, saved to a file and mapped back
+ * in memory, to spare short-lived processes a full enumeration.
+ */
+PYUSB_STATIC unsigned char *snapshotMap = NULL;	/* mapped snapshot, or NULL */
+PYUSB_STATIC size_t snapshotSize = 0;
+PYUSB_STATIC struct usb_bus *snapshotBusses = NULL;
+PYUSB_STATIC char snapshotNodes[PATH_MAX];		/* directory of the device nodes */
+
+/*
+ * Writes the raw descriptors of a device to out, which may be NULL
+ * to get their size
+ */
+PYUSB_STATIC size_t snapshotDescriptors(
+	struct usb_device *dev,
+	unsigned char *out
 	)
 {
-	int endpoint;
-	int timeout = DEFAULT_TIMEOUT;
-	char *data;
-	Py_ssize_t size;
-	PyObject *bytes;
-	int ret;
-	PyObject *retObj;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
-
-	if (!PyArg_ParseTuple(args,
-						  "iO|i",
-						  &endpoint,
-						  &bytes,
-						  &timeout)) {
-		return NULL;
+	struct usb_device_descriptor *desc = &dev->descriptor;
+	unsigned char d[USB_DT_DEVICE_SIZE];
+	int numConfigs = dev->config ? desc->bNumConfigurations : 0;
+	size_t pos = USB_DT_DEVICE_SIZE;
+	int c;
+
+	if (out) {
+		d[0] = USB_DT_DEVICE_SIZE;
+		d[1] = USB_DT_DEVICE;
+		PYUSB_PUT_LE16(d + 2, desc->bcdUSB);
+		d[4] = desc->bDeviceClass;
+		d[5] = desc->bDeviceSubClass;
+		d[6] = desc->bDeviceProtocol;
+		d[7] = desc->bMaxPacketSize0;
+		PYUSB_PUT_LE16(d + 8, desc->idVendor);
+		PYUSB_PUT_LE16(d + 10, desc->idProduct);
+		PYUSB_PUT_LE16(d + 12, desc->bcdDevice);
+		d[14] = desc->iManufacturer;
+		d[15] = desc->iProduct;
+		d[16] = desc->iSerialNumber;
+		d[17] = numConfigs;
+		memcpy(out, d, USB_DT_DEVICE_SIZE);
 	}
 
-	data = getBuffer(bytes, &size);
-	if (PyErr_Occurred()) return NULL;
+	for (c = 0; c < numConfigs; ++c)
+		pos += rawConfig(dev->config + c, out ? out + pos : NULL, NULL, NULL);
 
-#if DUMP_PARAMS
+	return pos;
+}
 
-	fprintf(stderr,
-			"interruptWrite params:\n"
-			"\tendpoint: %d\n"
-			"\ttimeout: %d\n",
-			endpoint,
-			timeout);
+/*
+ * Finds the directory of the device nodes, like libusb does
+ */
+PYUSB_STATIC void snapshotFindNodes(
+	void
+	)
+{
+	const char *dirs[3];
+	struct stat st;
+	int i;
 
-	fprintf(stderr, "interruptWrite buffer param:\n");
-	printBuffer(data, size);
+	dirs[0] = getenv("USB_DEVFS_PATH");
+	dirs[1] = "/dev/bus/usb";
+	dirs[2] = "/proc/bus/usb";
 
-#endif /* DUMP_PARAMS */
+	snapshotNodes[0] = '\0';
 
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_interrupt_write(_self->deviceHandle, endpoint, data, size, timeout);
-	Py_END_ALLOW_THREADS
+	for (i = 0; i < 3; ++i) {
+		if (dirs[i] && !stat(dirs[i], &st) && S_ISDIR(st.st_mode)) {
+			snprintf(snapshotNodes, sizeof(snapshotNodes), "%s", dirs[i]);
+			return;
+		}
+	}
+}
 
-	PyMem_Free(data);
+/*
+ * Drops the devices of the snapshot whose device node is gone.
+ * Only the bus and device numbers are checked, which the kernel
+ * does not reuse until it wraps around.
+ */
+PYUSB_STATIC void snapshotValidate(
+	void
+	)
+{
+	char path[PATH_MAX];
+	struct stat st;
+	struct usb_bus *bus;
+	struct usb_device *dev, *next;
+
+	/* nothing to check against */
+	if (!snapshotNodes[0]) return;
+
+	for (bus = snapshotBusses; bus; bus = bus->next) {
+		for (dev = bus->devices; dev; dev = next) {
+			next = dev->next;
+
+			/* a node whose path does not fit can not be opened either */
+			if (snprintf(path, sizeof(path), "%s/%s/%s", snapshotNodes,
+						 bus->dirname, dev->filename) < (int) sizeof(path) &&
+				!stat(path, &st)) {
+				continue;
+			}
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		retObj = PyInt_FromLong(ret);
-	}
+			if (dev->prev) dev->prev->next = next;
+			else bus->devices = next;
+			if (next) next->prev = dev->prev;
 
-	return retObj;
+			rawFreeDevice(dev);
+		}
+	}
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptRead(
-	PyObject *self,
-	PyObject *args
+/*
+ * Builds the busses of a mapped snapshot, the raw descriptors
+ * stay in the mapping.
+ * Returns -1 if the snapshot is not valid.
+ */
+PYUSB_STATIC int snapshotParse(
+	unsigned char *map,
+	size_t size,
+	struct usb_bus **busses
 	)
 {
-	int endpoint;
-	int timeout = DEFAULT_TIMEOUT;
-	char *buffer;
-	int size;
-	PyObject *ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyUSB_SnapshotHeader *header = (PyUSB_SnapshotHeader *) map;
+	PyUSB_SnapshotRecord *record;
+	PyUSB_RawDevice *node;
+	struct usb_bus *bus, **p;
+	unsigned char *pos, *end = map + size;
+	char *dirname;
+	u_int32_t i;
 
-	if (!PyArg_ParseTuple(args,
-						 "ii|i",
-						 &endpoint,
-						 &size,
-						 &timeout)) {
-		return NULL;
-	}
-	
-#if DUMP_PARAMS
+	*busses = NULL;
 
-	fprintf(stderr,
-			"interruptRead params:\n"
-			"\tendpoint: %d\n"
-			"\tsize: %d\n"
-			"\ttimeout: %d\n",
-			endpoint,
-			size,
-			timeout);
+	if (size < sizeof(*header) ||
+		memcmp(header->magic, PYUSB_SNAPSHOT_MAGIC, sizeof(header->magic)) ||
+		header->version != PYUSB_SNAPSHOT_VERSION)
+		return -1;
 
-#endif /* DUMP_PARAMS */
+	pos = map + sizeof(*header);
 
-	buffer = (char *) PyMem_Malloc(size);
-	if (!buffer) return NULL;
+	for (i = 0; i < header->count; ++i) {
+		record = (PyUSB_SnapshotRecord *) pos;
 
-	Py_BEGIN_ALLOW_THREADS
-	size = usb_interrupt_read(_self->deviceHandle, endpoint, buffer, size, timeout);
-	Py_END_ALLOW_THREADS
+		if ((size_t) (end - pos) < sizeof(*record) ||
+			record->size > (size_t) (end - pos) ||
+			sizeof(*record) + record->dirnameSize + record->filenameSize +
+				(size_t) record->rawSize > record->size ||
+			record->dirnameSize >= sizeof(bus->dirname) ||
+			record->filenameSize >= sizeof(node->dev.filename))
+			return -1;
 
-	if (size < 0) {
-		PyMem_Free(buffer);
-		PyUSB_Error();
-		return NULL;
-	} else {
-		ret = buildTuple(buffer, size);
-		PyMem_Free(buffer);
-	}
+		dirname = (char *) (record + 1);
 
-	return ret;
-}
+		node = rawNewDevice((unsigned char *) dirname + record->dirnameSize +
+							record->filenameSize, record->rawSize);
+		if (!node) return -1;
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_resetEndpoint(
-	PyObject *self,
-	PyObject *args
-	)
-{
-	int endpoint, ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+		memcpy(node->dev.filename, dirname + record->dirnameSize, record->filenameSize);
+		node->dev.filename[record->filenameSize] = '\0';
+		node->dev.devnum = record->devnum;
 
-	endpoint = py_NumberAsInt(args);
-	if (PyErr_Occurred()) return NULL;
+		for (p = busses; *p && (*p)->location < record->location; p = &(*p)->next);
 
-#if DUMP_PARAMS
+		if (*p && (*p)->location == record->location) {
+			bus = *p;
+		} else {
+			bus = (struct usb_bus *) calloc(1, sizeof(*bus));
 
-	fprintf(stderr,
-			"resetEndpoint params:\n"
-			"\tendpoint: %d\n",
-			endpoint);
+			if (!bus) {
+				rawFreeDevice(&node->dev);
+				return -1;
+			}
 
-#endif /* DUMP_PARAMS */
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_resetep(_self->deviceHandle, endpoint);
-	Py_END_ALLOW_THREADS
+			memcpy(bus->dirname, dirname, record->dirnameSize);
+			bus->location = record->location;
+			bus->next = *p;
+			*p = bus;
+		}
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		Py_RETURN_NONE;
+		rawAddDevice(bus, &node->dev);
+		pos += record->size;
 	}
+
+	return 0;
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_reset(
-	PyObject *self,
-	PyObject *args
+PYUSB_STATIC void snapshotClose(
+	void
 	)
 {
-	int ret;
+	rawFreeBusses(snapshotBusses);
+	snapshotBusses = NULL;
 
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_reset(((Py_usb_DeviceHandle *) self)->deviceHandle);
-	Py_END_ALLOW_THREADS
+	if (snapshotMap) munmap(snapshotMap, snapshotSize);
+	snapshotMap = NULL;
+	snapshotSize = 0;
+}
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		Py_RETURN_NONE;
-	}
+#endif /* PYUSB_SYSFS */
+
+PYUSB_STATIC int usingLibusb(
+	void
+	)
+{
+#if PYUSB_SYSFS
+	return !snapshotMap && !sysfsRoot;
+#else
+	return 1;
+#endif /* PYUSB_SYSFS */
 }
 
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_clearHalt(
-	PyObject *self,
-	PyObject *args
+/*
+ * Busses of the current enumeration backend
+ */
+PYUSB_STATIC struct usb_bus *enumBusses(
+	void
 	)
 {
-	int endpoint, ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+#if PYUSB_SYSFS
+	if (snapshotMap) return snapshotBusses;
+	if (sysfsRoot) return sysfsBusses;
+#endif /* PYUSB_SYSFS */
 
-	endpoint = py_NumberAsInt(args);
-	if (PyErr_Occurred()) return NULL;
+	return usb_get_busses();
+}
 
-#if DUMP_PARAMS
+/*
+ * libusb and the sysfs and snapshot backends rebuild their device
+ * lists in place, and free the removed devices. Walking the lists,
+ * using their devices and rescanning is done with the enumeration
+ * lock held. The scans and usb_open run without the GIL.
+ */
+#if PYUSB_THREADS
+PYUSB_STATIC pthread_mutex_t enumMutex;	/* recursive */
+#endif /* PYUSB_THREADS */
 
-	fprintf(stderr,
-			"clearHalt params:\n"
-			"\tendpoint: %d\n",
-			endpoint);
+PYUSB_STATIC void enumLock(
+	void
+	)
+{
+#if PYUSB_THREADS
+	/* never wait holding the GIL, the owner may be waiting for it */
+	if (pthread_mutex_trylock(&enumMutex)) {
+		Py_BEGIN_ALLOW_THREADS
+		pthread_mutex_lock(&enumMutex);
+		Py_END_ALLOW_THREADS
+	}
+#endif /* PYUSB_THREADS */
+}
 
-#endif /* DUMP_PARAMS */
+PYUSB_STATIC void enumUnlock(
+	void
+	)
+{
+#if PYUSB_THREADS
+	pthread_mutex_unlock(&enumMutex);
+#endif /* PYUSB_THREADS */
+}
 
-	Py_BEGIN_ALLOW_THREADS
-	ret = usb_clear_halt(_self->deviceHandle, endpoint);
-	Py_END_ALLOW_THREADS
+/*
+ * Enumeration cache, shared by busses, refresh, find and the monitors
+ */
+PYUSB_STATIC PyObject *knownDevices = NULL;	/* Device objects built, by "dirname/filename" */
+PYUSB_STATIC PyObject *knownBusses = NULL;	/* Bus objects by dirname */
+PYUSB_STATIC PyObject *refreshed = NULL;	/* knownDevices as of the last refresh */
 
-	if (ret < 0) {
-		PyUSB_Error();
-		return NULL;
-	} else {
-		Py_RETURN_NONE;
-	}
+PYUSB_STATIC PyObject *deviceKey(
+	struct usb_bus *bus,
+	struct usb_device *dev
+	)
+{
+	return PyString_FromFormat("%s/%s", bus->dirname, dev->filename);
 }
 
 /*
- * def getString(index, len, langid = -1)
+ * Tells whether libusb still lists a device structure
  */
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_getString(
-	PyObject *self,
-	PyObject *args
+PYUSB_STATIC int deviceListed(
+	Py_usb_Device *device
 	)
 {
-	int langid=-1, index;
-	unsigned long len;
-	PyObject *retStr;
-	char *buffer;
-	int ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	struct usb_bus *bus;
+	struct usb_device *dev;
 
-	if (!PyArg_ParseTuple(args,
-						 "ik|i",
-						 &index,
-						 &len,
-						 &langid)) {
-		return NULL;
-	}
+	for (bus = enumBusses(); bus; bus = bus->next)
+		for (dev = bus->devices; dev; dev = dev->next)
+			if (dev == device->dev)
+				return !strcmp(dev->filename, device->filename);
 
-#if DUMP_PARAMS
+	return 0;
+}
 
-	fprintf(stderr,
-			"getString params:\n"
-			"\tindex: %d\n"
-			"\tlen: %lu\n"
-			"\tlangid: %d\n",
-			index,
-			len,
-			langid);
+/*
+ * Rescans the busses and drops the removed devices from knownDevices.
+ * libusb keeps the structures of the unchanged devices and frees the
+ * others, so the Device objects of the removed devices can no longer
+ * be opened. Objects are not built for the new devices.
+ * Called with the enumeration lock held.
+ * Returns -1 and sets an exception on error.
+ */
+PYUSB_STATIC int rescanDevices(
+	void
+	)
+{
+	PyObject *gone;
+	PyObject *key;
+	PyObject *value;
+	Py_ssize_t pos = 0;
+	Py_ssize_t i;
+	int ret = -1;
+	int err = 0;
+#if PYUSB_SYSFS
+	const char *root = sysfsRoot ? PyString_AS_STRING(sysfsRoot) : NULL;
+#endif /* PYUSB_SYSFS */
+
+	PYUSB_ENUM_BEGIN_ALLOW_THREADS
+
+#if PYUSB_SYSFS
+	if (snapshotMap) {
+		snapshotValidate();
+	} else if (root) {
+		if (sysfsRescan(root) < 0) err = errno;
+	} else
+#endif /* PYUSB_SYSFS */
+	/* the number of changes, or a negative errno */
+	if ((err = usb_find_busses()) >= 0 && (err = usb_find_devices()) >= 0)
+		err = 0;
+
+	PYUSB_ENUM_END_ALLOW_THREADS
+
+#if PYUSB_SYSFS
+	if (err > 0) {
+		errno = err;
+		PyErr_SetFromErrnoWithFilename(PyExc_OSError, (char *) root);
+		return -1;
+	}
+#endif /* PYUSB_SYSFS */
 
-#endif /* DUMP_PARAMS */
+	if (err < 0) {
+		PyUSB_ErrnoError(err);
+		return -1;
+	}
 
-	++len;	/* for NULL termination */
-	buffer = (char *) PyMem_Malloc(len);
-	if (!buffer) return NULL;
+	gone = PyList_New(0);
+	if (!gone) return -1;
 
-	Py_BEGIN_ALLOW_THREADS
+	while (PyDict_Next(knownDevices, &pos, &key, &value)) {
+		if (deviceListed((Py_usb_Device *) value)) continue;
 
-	if (-1 == langid) {
-		ret = usb_get_string_simple(_self->deviceHandle, index, buffer, len);
-	} else {
-		ret = usb_get_string(_self->deviceHandle, index, langid, buffer, len);
+		((Py_usb_Device *) value)->dev = NULL;
+		if (PyList_Append(gone, key) < 0) goto done;
 	}
 
-	Py_END_ALLOW_THREADS
+	for (i = 0; i < PyList_GET_SIZE(gone); ++i)
+		if (PyDict_DelItem(knownDevices, PyList_GET_ITEM(gone, i)) < 0)
+			goto done;
 
-	if (ret < 0) {
-		PyMem_Free(buffer);
-		PyUSB_Error();
-		return NULL;
-	}
+	ret = 0;
 
-	retStr = PyString_FromStringAndSize(buffer, ret);
-	PyMem_Free(buffer);
-	return retStr;
+done:
+	Py_DECREF(gone);
+	return ret;
 }
 
 /*
- * def getDescriptor(type, index, len, endpoint = -1)
+ * Returns a new reference to the Device object of a device,
+ * built and added to knownDevices if not there yet
  */
-PYUSB_STATIC PyObject *Py_usb_DeviceHandle_getDescriptor(
-	PyObject *self,
-	PyObject *args
+PYUSB_STATIC PyObject *cachedDevice(
+	struct usb_bus *bus,
+	struct usb_device *dev
 	)
 {
-	int endpoint=-1, type, index;
-	int len;
-	PyObject *retSeq;
-	char *buffer;
-	int ret;
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyObject *key;
+	PyObject *device;
 
-	if (!PyArg_ParseTuple(args,
-						 "iii|i",
-						 &type,
-						 &index,
-						 &len,
-						 &endpoint)) {
-		return NULL;
-	}
+	key = deviceKey(bus, dev);
+	if (!key) return NULL;
 
-#if DUMP_PARAMS
+	device = PyDict_GetItem(knownDevices, key);
 
-	fprintf(stderr,
-			"getDescriptor params:\n"
-			"ttype: %d\n"
-			"\tindex: %d\n"
-			"\tlen: %d\n"
-			"\tendpoint: %d\n",
-			type,
-			index,
-			len,
-			endpoint);
+	if (device) {
+		Py_INCREF(device);
+	} else {
+		device = (PyObject *) new_Device(dev);
 
-#endif /* DUMP_PARAMS */
+		if (device && PyDict_SetItem(knownDevices, key, device) < 0)
+			Py_CLEAR(device);
+	}
 
-	buffer = (char *) PyMem_Malloc(len);
-	if (!buffer) return NULL;
+	Py_DECREF(key);
+	return device;
+}
 
-	Py_BEGIN_ALLOW_THREADS
+/*
+ * Rescans the busses and builds the Device objects of all
+ * the new devices in knownDevices
+ */
+PYUSB_STATIC int scanDevices(
+	void
+	)
+{
+	PyObject *device;
+	struct usb_bus *bus;
+	struct usb_device *dev;
 
-	if (-1 == endpoint) {
-		ret = usb_get_descriptor(_self->deviceHandle, type, index, buffer, len);
-	} else {
-		ret = usb_get_descriptor_by_endpoint(_self->deviceHandle, endpoint, type, index, buffer, len);
+	if (rescanDevices() < 0) return -1;
+
+	for (bus = enumBusses(); bus; bus = bus->next) {
+		for (dev = bus->devices; dev; dev = dev->next) {
+			device = cachedDevice(bus, dev);
+			if (!device) return -1;
+			Py_DECREF(device);
+		}
 	}
 
-	Py_END_ALLOW_THREADS
+	return 0;
+}
 
-	if (ret < 0) {
-		PyMem_Free(buffer);
-		PyUSB_Error();
-		return NULL;
-	}
+/*
+ * Appends the devices of a that are not in b to diff
+ */
+PYUSB_STATIC int diffDevices(
+	PyObject *a,
+	PyObject *b,
+	PyObject *diff
+	)
+{
+	PyObject *key;
+	PyObject *value;
+	Py_ssize_t pos = 0;
+
+	while (PyDict_Next(a, &pos, &key, &value))
+		if (PyDict_GetItem(b, key) != value && PyList_Append(diff, value) < 0)
+			return -1;
 
-	retSeq = buildTuple(buffer, ret);
-	PyMem_Free(buffer);
-	return retSeq;
+	return 0;
 }
 
+/*
+ * Rescans the busses and brings snapshot, a copy of knownDevices,
+ * up to date. The devices that appeared and disappeared since the
+ * snapshot was taken are appended to added and removed.
+ */
+PYUSB_STATIC int syncDevices(
+	PyObject *snapshot,
+	PyObject *added,
+	PyObject *removed
+	)
+{
+	if (scanDevices() < 0 ||
+		diffDevices(knownDevices, snapshot, added) < 0 ||
+		diffDevices(snapshot, knownDevices, removed) < 0)
+		return -1;
+
+	PyDict_Clear(snapshot);
+
+	return PyDict_Update(snapshot, knownDevices);
+}
+
+/*
+ * Tells whether the devices of a Bus object are those of the bus
+ */
+PYUSB_STATIC int busUnchanged(
+	Py_usb_Bus *bus,
+	struct usb_bus *b
+	)
+{
+	struct usb_device *dev;
+	Py_ssize_t i = 0;
+
+	if (bus->location != b->location) return 0;
+
+	for (dev = b->devices; dev; dev = dev->next, ++i)
+		if (i >= PyTuple_GET_SIZE(bus->devices) ||
+			((Py_usb_Device *) PyTuple_GET_ITEM(bus->devices, i))->dev != dev)
+			return 0;
+
+	return i == PyTuple_GET_SIZE(bus->devices);
+}
+
+/*
+ * Builds a Bus object with the devices of knownDevices
+ */
+PYUSB_STATIC Py_usb_Bus *new_Bus(
+	struct usb_bus *b
+	)
+{
+	Py_usb_Bus *bus;
+	PyObject *device;
+	u_int32_t i;
+	struct usb_device *dev;
+
+	bus = PyObject_NEW(Py_usb_Bus, &Py_usb_Bus_Type);
+
+	if (bus) {
+		bus->location = b->location;
+		strcpy(bus->dirname, b->dirname);
+		for(dev = b->devices, i = 0; dev; dev = dev->next) ++i;
+		bus->devices = PyTuple_New(i);
+
+		if(!bus->devices) {
+			Py_DECREF((PyObject *) bus);
+			return NULL;
+		}
+
+		for(dev = b->devices, i=0; dev; dev = dev->next, ++i) {
+			device = cachedDevice(b, dev);
+			if (!device) break;
+
+			PyTuple_SET_ITEM(bus->devices, i, device);
+		}
+
+		if (PyErr_Occurred()) {
+			Py_DECREF((PyObject *) bus);
+			bus = NULL;
+		}
+	}
+
+	return bus;
+}
+
+#if PYUSB_THREADS
+
+/*
+ * Sets deadline to timeout miliseconds from now, for
+ * pthread_cond_timedwait
+ */
+PYUSB_STATIC void setDeadline(
+	struct timespec *deadline,
+	int timeout
+	)
+{
+#if PYUSB_USBFS
+	clock_gettime(CLOCK_REALTIME, deadline);
+#else
+	struct timeval now;
+
+	gettimeofday(&now, NULL);
+	deadline->tv_sec = now.tv_sec;
+	deadline->tv_nsec = now.tv_usec * 1000;
+#endif /* PYUSB_USBFS */
+
+	deadline->tv_sec += timeout / 1000;
+	deadline->tv_nsec += (timeout % 1000) * 1000000;
+
+	if (deadline->tv_nsec >= 1000000000) {
+		++deadline->tv_sec;
+		deadline->tv_nsec -= 1000000000;
+	}
+}
+
+/*
+ * Miliseconds left until deadline
+ */
+PYUSB_STATIC int msLeft(
+	const struct timespec *deadline
+	)
+{
+	struct timespec now;
+	long ms;
+
+	setDeadline(&now, 0);
+	ms = (deadline->tv_sec - now.tv_sec) * 1000 +
+		 (deadline->tv_nsec - now.tv_nsec) / 1000000;
+
+	return ms < 0 ? 0 : (int) ms;
+}
+
+#endif /* PYUSB_THREADS */
+
+#if PYUSB_USBFS
+
+#define requestUrb(_Request, _Index) \
+	((struct usbdevfs_urb *) ((char *) (_Request)->urbs + \
+							  (size_t) (_Index) * (_Request)->urbStride))
+
+/*
+ * Asynchronous engine
+ *
+ * URBs are submitted directly to the usbfs file descriptor libusb
+ * opened for the handle. Completions are reaped by whichever thread
+ * is waiting: one of them polls the descriptor and dispatches every
+ * completed URB to its request, the others sleep on the engine
+ * condition. No Python object is touched without the GIL; requests
+ * owned by a Python object are released later by engineSweep.
+ */
+
+/*
+ * Lists the descriptors opened for the device node of dev.
+ * Returns the number of descriptors stored in fds.
+ */
+PYUSB_STATIC int usbfsListFds(
+	struct usb_device *dev,
+	int *fds,
+	int max
+	)
+{
+	char suffix[2 * PATH_MAX + 16];
+	char path[PATH_MAX];
+	char link[PATH_MAX + 1];
+	size_t suffixLen;
+	struct dirent *entry;
+	DIR *dir;
+	int n = 0;
+
+	if (!dev->bus) return 0;
+
+	snprintf(suffix, sizeof(suffix), "/bus/usb/%s/%s",
+			 dev->bus->dirname, dev->filename);
+	suffixLen = strlen(suffix);
+
+	dir = opendir("/proc/self/fd");
+	if (!dir) return 0;
+
+	while (n < max && (entry = readdir(dir))) {
+		ssize_t len;
+
+		if (entry->d_name[0] == '.') continue;
+
+		snprintf(path, sizeof(path), "/proc/self/fd/%s", entry->d_name);
+		len = readlink(path, link, sizeof(link) - 1);
+		if (len < (ssize_t) suffixLen) continue;
+		link[len] = '\0';
+
+		if (!strcmp(link + len - suffixLen, suffix))
+			fds[n++] = atoi(entry->d_name);
+	}
+
+	closedir(dir);
+	return n;
+}
+
+/*
+ * libusb does not export the descriptor of a handle. It is
+ * the descriptor of the device node that appeared after usb_open,
+ * given the list of descriptors from before the call.
+ */
+PYUSB_STATIC int usbfsFindFd(
+	struct usb_device *dev,
+	const int *before,
+	int numBefore
+	)
+{
+	int after[PYUSB_MAX_FDS];
+	int numAfter, i, j;
+
+	numAfter = usbfsListFds(dev, after, PYUSB_MAX_FDS);
+
+	for (i = 0; i < numAfter; ++i) {
+		for (j = 0; j < numBefore && before[j] != after[i]; ++j);
+		if (j == numBefore) return after[i];
+	}
+
+	return -1;
+}
+
+PYUSB_STATIC void engineInit(
+	PyUSB_Engine *engine
+	)
+{
+	engine->fd = -1;
+	engine->reaping = 0;
+	engine->pending = NULL;
+	engine->finished = NULL;
+	pthread_mutex_init(&engine->lock, NULL);
+	pthread_cond_init(&engine->cond, NULL);
+}
+
+PYUSB_STATIC void engineDestroy(
+	PyUSB_Engine *engine
+	)
+{
+	pthread_cond_destroy(&engine->cond);
+	pthread_mutex_destroy(&engine->lock);
+}
+
+/*
+ * Builds the URBs of a transfer made of numSegments consecutive
+ * pieces of memory. Bulk segments bigger than PYUSB_URB_SIZE are
+ * split; for reads, a short packet makes the kernel cancel the
+ * remaining URBs of the request.
+ * Returns 0 or a negative errno.
+ */
+PYUSB_STATIC int requestSetupSegments(
+	PyUSB_Request *request,
+	int type,
+	int endpoint,
+	const PyUSB_Segment *segments,
+	int numSegments
+	)
+{
+	struct usbdevfs_urb *urb;
+	int i, j, k, n = 0;
+
+	for (i = 0; i < numSegments; ++i) {
+		if (type == PYUSB_TRANSFER_BULK && segments[i].size > PYUSB_URB_SIZE)
+			n += (segments[i].size + PYUSB_URB_SIZE - 1) / PYUSB_URB_SIZE;
+		else
+			++n;
+	}
+
+	if (n == 1) {
+		request->urbs = &request->urb;
+	} else {
+		request->urbs = (struct usbdevfs_urb *) calloc(n, sizeof(struct usbdevfs_urb));
+		if (!request->urbs) return -ENOMEM;
+	}
+
+	request->numUrbs = n;
+	request->urbStride = sizeof(struct usbdevfs_urb);
+
+	for (i = 0, k = 0; i < numSegments; ++i) {
+		for (j = 0; !j || j < segments[i].size; j += PYUSB_URB_SIZE, ++k) {
+			urb = requestUrb(request, k);
+			memset(urb, 0, sizeof(*urb));
+			urb->type = type;
+			urb->endpoint = endpoint;
+			urb->buffer = segments[i].data + j;
+			urb->buffer_length = segments[i].size - j;
+
+			if (type == PYUSB_TRANSFER_BULK && urb->buffer_length > PYUSB_URB_SIZE)
+				urb->buffer_length = PYUSB_URB_SIZE;
+
+			if (endpoint & USB_ENDPOINT_IN) {
+#ifdef USBDEVFS_URB_BULK_CONTINUATION
+				if (k > 0) urb->flags |= USBDEVFS_URB_BULK_CONTINUATION;
+				if (k < n - 1) urb->flags |= USBDEVFS_URB_SHORT_NOT_OK;
+#endif /* USBDEVFS_URB_BULK_CONTINUATION */
+			}
+
+			if (type != PYUSB_TRANSFER_BULK) {
+				++k;
+				break;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/*
+ * Builds the URBs of a transfer of size bytes at data
+ */
+PYUSB_STATIC int requestSetup(
+	PyUSB_Request *request,
+	int type,
+	int endpoint,
+	char *data,
+	int size
+	)
+{
+	PyUSB_Segment segment;
+
+	segment.data = data;
+	segment.size = size;
+
+	return requestSetupSegments(request, type, endpoint, &segment, 1);
+}
+
+/*
+ * Builds the URBs of an isochronous transfer of size bytes, in
+ * packets of packetSize bytes. Each URB carries the descriptors
+ * of up to PYUSB_ISO_PACKETS packets after it.
+ * Returns 0 or a negative errno.
+ */
+PYUSB_STATIC int requestSetupIso(
+	PyUSB_Request *request,
+	int endpoint,
+	char *data,
+	int size,
+	int packetSize
+	)
+{
+	struct usbdevfs_urb *urb;
+	size_t stride;
+	int numPackets, packets, offset, length;
+	int i, j, n;
+
+	numPackets = (size + packetSize - 1) / packetSize;
+	n = (numPackets + PYUSB_ISO_PACKETS - 1) / PYUSB_ISO_PACKETS;
+	packets = numPackets < PYUSB_ISO_PACKETS ? numPackets : PYUSB_ISO_PACKETS;
+
+	/* keep every URB aligned as the first one */
+	stride = sizeof(struct usbdevfs_urb) +
+			 packets * sizeof(struct usbdevfs_iso_packet_desc);
+	stride = (stride + sizeof(struct usbdevfs_urb) - 1) /
+			 sizeof(struct usbdevfs_urb) * sizeof(struct usbdevfs_urb);
+
+	request->urbs = (struct usbdevfs_urb *) calloc(n, stride);
+	if (!request->urbs) return -ENOMEM;
+
+	request->numUrbs = n;
+	request->urbStride = stride;
+
+	for (i = 0, offset = 0; i < n; ++i) {
+		urb = requestUrb(request, i);
+		urb->type = USBDEVFS_URB_TYPE_ISO;
+		urb->endpoint = endpoint;
+		urb->flags = USBDEVFS_URB_ISO_ASAP;
+		urb->buffer = data + offset;
+
+		for (j = 0; j < PYUSB_ISO_PACKETS && offset < size; ++j) {
+			length = size - offset < packetSize ? size - offset : packetSize;
+			urb->iso_frame_desc[j].length = length;
+			urb->buffer_length += length;
+			offset += length;
+		}
+
+		urb->number_of_packets = j;
+	}
+
+	return 0;
+}
+
+PYUSB_STATIC void requestClear(
+	PyUSB_Request *request
+	)
+{
+	if (request->urbs && request->urbs != &request->urb)
+		free(request->urbs);
+
+	request->urbs = NULL;
+	request->numUrbs = 0;
+}
+
+/*
+ * Discards the URBs of request still in flight.
+ * Called with the engine lock.
+ */
+PYUSB_STATIC void engineDiscard(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request
+	)
+{
+	int i;
+
+	/* EINVAL just means the URB has already completed */
+	for (i = 0; i < request->numUrbs; ++i)
+		ioctl(engine->fd, USBDEVFS_DISCARDURB, requestUrb(request, i));
+}
+
+/*
+ * Removes request from the pending list.
+ * Called with the engine lock.
+ */
+PYUSB_STATIC void engineUnlink(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request
+	)
+{
+	if (request->prev) {
+		request->prev->next = request->next;
+	} else {
+		engine->pending = request->next;
+	}
+
+	if (request->next) request->next->prev = request->prev;
+
+	request->next = request->prev = NULL;
+}
+
+/*
+ * Marks request as done. Called with the engine lock; the lock is
+ * released while the completion callback runs.
+ */
+PYUSB_STATIC void engineFinish(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request
+	)
+{
+	engineUnlink(engine, request);
+
+	if (request->complete) {
+		pthread_mutex_unlock(&engine->lock);
+		request->complete(request);
+		pthread_mutex_lock(&engine->lock);
+	}
+
+	request->done = 1;
+
+	if (request->owner) {
+		request->next = engine->finished;
+		engine->finished = request;
+	}
+
+	pthread_cond_broadcast(&engine->cond);
+}
+
+/*
+ * Accounts a reaped URB to its request
+ */
+PYUSB_STATIC void engineDispatch(
+	PyUSB_Engine *engine,
+	struct usbdevfs_urb *urb
+	)
+{
+	PyUSB_Request *request = (PyUSB_Request *) urb->usercontext;
+	int status = urb->status;
+
+	pthread_mutex_lock(&engine->lock);
+
+	request->actualLength += urb->actual_length;
+
+	if (status == -EXDEV && urb->type == USBDEVFS_URB_TYPE_ISO) {
+		/* some packets failed, their status tells which */
+		status = 0;
+	} else if (status == -EREMOTEIO) {
+		/* short packet on a URB flagged with SHORT_NOT_OK */
+		request->shortPacket = 1;
+		status = 0;
+	} else if (request->shortPacket && (status == -ENOENT || status == -ECONNRESET)) {
+		/* cancelled by the kernel after the short packet */
+		status = 0;
+	}
+
+	if (status && !request->status) {
+		request->status = status;
+		if (request->urbsPending > 1) engineDiscard(engine, request);
+	}
+
+	if (!--request->urbsPending) engineFinish(engine, request);
+
+	pthread_mutex_unlock(&engine->lock);
+}
+
+/*
+ * Fails every pending request, after the device is gone
+ */
+PYUSB_STATIC void engineFailAll(
+	PyUSB_Engine *engine,
+	int status
+	)
+{
+	pthread_mutex_lock(&engine->lock);
+
+	while (engine->pending) {
+		PyUSB_Request *request = engine->pending;
+		if (!request->status) request->status = status;
+		request->urbsPending = 0;
+		engineFinish(engine, request);
+	}
+
+	pthread_mutex_unlock(&engine->lock);
+}
+
+/*
+ * Waits up to timeout miliseconds (-1 forever) for completions
+ * and dispatches all the completed URBs. Called by the reaping
+ * thread, without the engine lock.
+ * Returns the number of URBs reaped or a negative errno.
+ */
+PYUSB_STATIC int engineReap(
+	PyUSB_Engine *engine,
+	int timeout
+	)
+{
+	struct pollfd pfd;
+	void *context;
+	int n = 0;
+
+	if (timeout) {
+		pfd.fd = engine->fd;
+		pfd.events = POLLOUT;
+		pfd.revents = 0;
+
+		if (poll(&pfd, 1, timeout) < 0 && errno != EINTR)
+			return -errno;
+	}
+
+	for (;;) {
+		if (ioctl(engine->fd, USBDEVFS_REAPURBNDELAY, &context) < 0) {
+			if (errno == EINTR) continue;
+			if (errno == EAGAIN) break;
+
+			/* the device is gone, the URBs will never be given back */
+			engineFailAll(engine, -errno);
+			return n ? n : -errno;
+		}
+
+		engineDispatch(engine, (struct usbdevfs_urb *) context);
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Discards the URBs of the requests whose deadline has passed,
+ * they finish with -ETIMEDOUT. Called with the engine lock.
+ * Returns the miliseconds left until the next deadline, -1 if none.
+ */
+PYUSB_STATIC int engineExpire(
+	PyUSB_Engine *engine
+	)
+{
+	PyUSB_Request *request;
+	int next = -1;
+	int left;
+
+	for (request = engine->pending; request; request = request->next) {
+		if (request->timeout <= 0 || request->expired) continue;
+
+		left = msLeft(&request->deadline);
+
+		if (!left) {
+			request->expired = 1;
+			if (!request->status) request->status = -ETIMEDOUT;
+			engineDiscard(engine, request);
+		} else if (next < 0 || left < next) {
+			next = left;
+		}
+	}
+
+	return next;
+}
+
+/*
+ * Waits up to timeout miliseconds (-1 forever) for request to be
+ * done, reaping completions meanwhile. If request is NULL, reaps
+ * what is available within timeout and returns.
+ * Must be called without the GIL.
+ * Returns 1 if the request is done, 0 otherwise.
+ */
+PYUSB_STATIC int engineWait(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request,
+	int timeout
+	)
+{
+	struct timespec deadline;
+	int first = 1;
+	int remaining = -1;
+	int wait, next;
+	int done;
+
+	if (timeout >= 0) setDeadline(&deadline, timeout);
+
+	pthread_mutex_lock(&engine->lock);
+
+	while (!request || !request->done) {
+		if (timeout >= 0) remaining = msLeft(&deadline);
+		if (!first && (!request || !remaining)) break;
+		first = 0;
+
+		if (!engine->reaping) {
+			/* wake up for the next deadline of a request */
+			next = engineExpire(engine);
+			wait = next >= 0 && (remaining < 0 || next < remaining) ? next : remaining;
+
+			engine->reaping = 1;
+			pthread_mutex_unlock(&engine->lock);
+
+			engineReap(engine, wait);
+
+			pthread_mutex_lock(&engine->lock);
+			engine->reaping = 0;
+			engineExpire(engine);
+			pthread_cond_broadcast(&engine->cond);
+		} else if (remaining < 0) {
+			pthread_cond_wait(&engine->cond, &engine->lock);
+		} else if (remaining > 0) {
+			pthread_cond_timedwait(&engine->cond, &engine->lock, &deadline);
+		}
+	}
+
+	done = request ? request->done : 1;
+	pthread_mutex_unlock(&engine->lock);
+
+	return done;
+}
+
+/*
+ * Submits the URBs of request, which must have been set up
+ * by requestSetup. Returns 0 or a negative errno.
+ */
+PYUSB_STATIC int engineSubmit(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request
+	)
+{
+	int i, ret = 0;
+
+	request->done = 0;
+	request->status = 0;
+	request->actualLength = 0;
+	request->shortPacket = 0;
+	request->urbsPending = 0;
+	request->expired = 0;
+
+	if (request->timeout > 0) setDeadline(&request->deadline, request->timeout);
+
+	pthread_mutex_lock(&engine->lock);
+
+	request->prev = NULL;
+	request->next = engine->pending;
+	if (engine->pending) engine->pending->prev = request;
+	engine->pending = request;
+
+	for (i = 0; i < request->numUrbs; ++i) {
+		struct usbdevfs_urb *urb = requestUrb(request, i);
+
+		urb->usercontext = request;
+		urb->status = 0;
+		urb->actual_length = 0;
+
+		if (ioctl(engine->fd, USBDEVFS_SUBMITURB, urb) < 0) {
+			ret = -errno;
+			break;
+		}
+
+		++request->urbsPending;
+	}
+
+	if (ret) {
+		if (request->urbsPending) {
+			/* fail the request when the submitted URBs come back */
+			request->status = ret;
+			engineDiscard(engine, request);
+			ret = 0;
+		} else {
+			engineUnlink(engine, request);
+		}
+	}
+
+	pthread_mutex_unlock(&engine->lock);
+
+	return ret;
+}
+
+/*
+ * Cancels the URBs in flight of request
+ */
+PYUSB_STATIC void engineCancel(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request
+	)
+{
+	pthread_mutex_lock(&engine->lock);
+	if (!request->done) engineDiscard(engine, request);
+	pthread_mutex_unlock(&engine->lock);
+}
+
+/*
+ * engineExpire with the engine lock taken
+ */
+PYUSB_STATIC int engineDeadline(
+	PyUSB_Engine *engine
+	)
+{
+	int next;
+
+	pthread_mutex_lock(&engine->lock);
+	next = engineExpire(engine);
+	pthread_mutex_unlock(&engine->lock);
+
+	return next;
+}
+
+/*
+ * Runs the done callbacks of the finished requests and releases
+ * their owners. Called with the GIL.
+ * Returns the number of requests released.
+ */
+PYUSB_STATIC int engineSweep(
+	PyUSB_Engine *engine
+	)
+{
+	PyUSB_Request *request, *next;
+	int n = 0;
+
+	pthread_mutex_lock(&engine->lock);
+	request = engine->finished;
+	engine->finished = NULL;
+	pthread_mutex_unlock(&engine->lock);
+
+	for (; request; request = next, ++n) {
+		PyObject *owner = request->owner;
+
+		next = request->next;
+		request->next = NULL;
+		request->owner = NULL;
+
+		if (owner) {
+			Py_usb_Transfer_finished(owner);
+			Py_DECREF(owner);
+		}
+	}
+
+	return n;
+}
+
+/*
+ * Submits a request set up by requestSetup and waits for it, with
+ * the same semantics of the libusb calls. The request is cleared.
+ * Must be called without the GIL.
+ */
+PYUSB_STATIC int engineRun(
+	PyUSB_Engine *engine,
+	PyUSB_Request *request,
+	int timeout
+	)
+{
+	int ret;
+
+	ret = engineSubmit(engine, request);
+
+	if (!ret) {
+		if (!engineWait(engine, request, timeout ? timeout : -1)) {
+			engineCancel(engine, request);
+			engineWait(engine, request, -1);
+			if (!request->status) request->status = -ETIMEDOUT;
+			else if (request->status == -ENOENT || request->status == -ECONNRESET)
+				request->status = -ETIMEDOUT;
+		}
+
+		ret = request->status ? request->status : request->actualLength;
+	}
+
+	requestClear(request);
+	return ret;
+}
+
+/*
+ * Performs a synchronous transfer through the engine.
+ * Must be called without the GIL.
+ */
+PYUSB_STATIC int engineTransfer(
+	PyUSB_Engine *engine,
+	int type,
+	int endpoint,
+	char *data,
+	int size,
+	int timeout
+	)
+{
+	PyUSB_Request request;
+	int ret;
+
+	memset(&request, 0, sizeof(request));
+
+	ret = requestSetup(&request, type, endpoint, data, size);
+	if (ret) return ret;
+
+	return engineRun(engine, &request, timeout);
+}
+
+#endif /* PYUSB_USBFS */
+
+/*
+ * Claimed interfaces
+ */
+PYUSB_STATIC void claimsInit(
+	PyUSB_Claims *claims,
+	int configuration
+	)
+{
+	int i;
+
+	memset(claims->claimed, 0, sizeof(claims->claimed));
+	memset(claims->altSetting, 0, sizeof(claims->altSetting));
+	claims->count = 0;
+	claims->current = -1;
+	claims->configuration = configuration;
+	claims->mapped = 0;
+
+	for (i = 0; i < PYUSB_ENDPOINTS; ++i)
+		claims->owner[i] = -1;
+}
+
+/*
+ * Finds the endpoints of the alternate settings selected for the
+ * claimed interfaces, in the configuration set through the handle
+ * or the first one. Called when the claims change, so transfers
+ * need no descriptor walk.
+ */
+PYUSB_STATIC void claimsMap(
+	Py_usb_DeviceHandle *self
+	)
+{
+	PyUSB_Claims *claims = &self->claims;
+	struct usb_device *dev = usb_device(self->deviceHandle);
+	struct usb_config_descriptor *config;
+	struct usb_interface_descriptor *alt;
+	struct usb_endpoint_descriptor *ep;
+	int c, i, a, e, k, w;
+
+	for (k = 0; k < PYUSB_ENDPOINTS; ++k)
+		claims->owner[k] = -1;
+
+	claims->mapped = 0;
+
+	if (!claims->count || !dev || !dev->config) return;
+
+	config = dev->config;
+
+	for (c = 0; c < dev->descriptor.bNumConfigurations; ++c) {
+		if (dev->config[c].bConfigurationValue == claims->configuration)
+			config = dev->config + c;
+	}
+
+	for (i = 0; i < config->bNumInterfaces; ++i) {
+		for (a = 0; a < config->interface[i].num_altsetting; ++a) {
+			alt = config->interface[i].altsetting + a;
+
+			if (!PYUSB_CLAIMED(claims, alt->bInterfaceNumber) ||
+				alt->bAlternateSetting != claims->altSetting[alt->bInterfaceNumber])
+				continue;
+
+			for (e = 0; e < alt->bNumEndpoints; ++e) {
+				ep = alt->endpoint + e;
+				k = PYUSB_ENDPOINT_INDEX(ep->bEndpointAddress);
+				if (!k) continue;
+
+				w = ep->wMaxPacketSize;
+				claims->owner[k] = alt->bInterfaceNumber;
+				claims->packetSize[k] = (w & 0x7ff) * (1 + ((w >> 11) & 3));
+				++claims->mapped;
+			}
+		}
+	}
+}
+
+PYUSB_STATIC void claimsAdd(
+	PyUSB_Claims *claims,
+	int interface,
+	int altSetting
+	)
+{
+	if (!PYUSB_CLAIMED(claims, interface)) {
+		claims->claimed[interface >> 5] |= 1U << (interface & 31);
+		claims->altSetting[interface] = altSetting;
+		++claims->count;
+	}
+
+	claims->current = interface;
+}
+
+/*
+ * Releases a claimed interface. Must be called without the GIL,
+ * with the lock of endpoint 0 held.
+ */
+PYUSB_STATIC int releaseClaim(
+	Py_usb_DeviceHandle *self,
+	int interface
+	)
+{
+	PyUSB_Claims *claims = &self->claims;
+	int ret;
+
+	ret = usb_release_interface(self->deviceHandle, interface);
+
+	if (ret >= 0) {
+		claims->claimed[interface >> 5] &= ~(1U << (interface & 31));
+		--claims->count;
+		if (claims->current == interface) claims->current = -1;
+	}
+
+	return ret;
+}
+
+/*
+ * Releases all the claimed interfaces, returns the first error
+ */
+PYUSB_STATIC int releaseClaims(
+	Py_usb_DeviceHandle *self
+	)
+{
+	int i, ret, status = 0;
+
+	for (i = 0; i < PYUSB_MAX_INTERFACES && self->claims.count; ++i) {
+		if (!PYUSB_CLAIMED(&self->claims, i)) continue;
+
+		ret = releaseClaim(self, i);
+		if (ret < 0 && !status) status = ret;
+	}
+
+	return status;
+}
+
+/*
+ * Once the endpoints of the claimed interfaces are known, transfers
+ * are only allowed on them and on the control pipe.
+ * Returns -1 and sets an exception otherwise.
+ */
+PYUSB_STATIC int checkEndpoint(
+	Py_usb_DeviceHandle *self,
+	int endpoint
+	)
+{
+	int k = PYUSB_ENDPOINT_INDEX(endpoint);
+
+	if (!k || !self->claims.mapped || self->claims.owner[k] >= 0) return 0;
+
+	PyErr_Format(PyExc_ValueError,
+				 "endpoint 0x%02x does not belong to a claimed interface",
+				 endpoint & 0xff);
+	return -1;
+}
+
+/*
+ * Endpoint locks. libusb keeps no state per handle that two
+ * transfers on different endpoints could corrupt, but two transfers
+ * on the same endpoint would interleave their data, and requests on
+ * the control pipe change the state of the handle. Without native
+ * threads the locks do nothing.
+ */
+PYUSB_STATIC void locksInit(
+	Py_usb_DeviceHandle *self
+	)
+{
+#if PYUSB_THREADS
+	int i;
+
+	for (i = 0; i < PYUSB_ENDPOINTS; ++i) {
+		pthread_mutex_init(&self->locks[i].mutex, NULL);
+		self->locks[i].acquired = 0;
+		self->locks[i].contended = 0;
+	}
+#endif /* PYUSB_THREADS */
+}
+
+PYUSB_STATIC void locksDestroy(
+	Py_usb_DeviceHandle *self
+	)
+{
+#if PYUSB_THREADS
+	int i;
+
+	for (i = 0; i < PYUSB_ENDPOINTS; ++i)
+		pthread_mutex_destroy(&self->locks[i].mutex);
+#endif /* PYUSB_THREADS */
+}
+
+/*
+ * Must be called without the GIL
+ */
+PYUSB_STATIC void endpointLock(
+	Py_usb_DeviceHandle *self,
+	int endpoint
+	)
+{
+#if PYUSB_THREADS
+	PyUSB_EndpointLock *lock = &self->locks[PYUSB_ENDPOINT_INDEX(endpoint)];
+	int contended = 0;
+
+	if (pthread_mutex_trylock(&lock->mutex)) {
+		contended = 1;
+		pthread_mutex_lock(&lock->mutex);
+	}
+
+	++lock->acquired;
+	lock->contended += contended;
+#endif /* PYUSB_THREADS */
+}
+
+PYUSB_STATIC void endpointUnlock(
+	Py_usb_DeviceHandle *self,
+	int endpoint
+	)
+{
+#if PYUSB_THREADS
+	pthread_mutex_unlock(&self->locks[PYUSB_ENDPOINT_INDEX(endpoint)].mutex);
+#endif /* PYUSB_THREADS */
+}
+
+/*
+ * usb_control_msg serialized with the other requests of the
+ * control pipe. Must be called without the GIL.
+ */
+PYUSB_STATIC int controlTransfer(
+	Py_usb_DeviceHandle *self,
+	int requestType,
+	int request,
+	int value,
+	int index,
+	char *data,
+	int size,
+	int timeout
+	)
+{
+	int ret;
+
+	endpointLock(self, 0);
+	ret = usb_control_msg(self->deviceHandle, requestType, request,
+						  value, index, data, size, timeout);
+	endpointUnlock(self, 0);
+
+	return ret;
+}
+
+/*
+ * syncTransfer with the endpoint lock held
+ */
+PYUSB_STATIC int lockedTransfer(
+	Py_usb_DeviceHandle *self,
+	int type,
+	int endpoint,
+	char *data,
+	int size,
+	int timeout
+	)
+{
+#if PYUSB_USBFS
+	if (self->engine.fd >= 0)
+		return engineTransfer(&self->engine, type, endpoint, data, size, timeout);
+#endif /* PYUSB_USBFS */
+
+	if (type == PYUSB_TRANSFER_BULK) {
+		if (endpoint & USB_ENDPOINT_IN)
+			return usb_bulk_read(self->deviceHandle, endpoint, data, size, timeout);
+		else
+			return usb_bulk_write(self->deviceHandle, endpoint, data, size, timeout);
+	} else {
+		if (endpoint & USB_ENDPOINT_IN)
+			return usb_interrupt_read(self->deviceHandle, endpoint, data, size, timeout);
+		else
+			return usb_interrupt_write(self->deviceHandle, endpoint, data, size, timeout);
+	}
+}
+
+/*
+ * Performs a synchronous bulk or interrupt transfer, the direction
+ * is given by the endpoint address. When the handle has a usbfs
+ * descriptor, the engine does all of them: libusb would reap and
+ * lose the URBs of the engine, submitted from any thread.
+ * Must be called without the GIL.
+ */
+PYUSB_STATIC int syncTransfer(
+	Py_usb_DeviceHandle *self,
+	int type,
+	int endpoint,
+	char *data,
+	int size,
+	int timeout
+	)
+{
+	int ret;
+
+	endpointLock(self, endpoint);
+	ret = lockedTransfer(self, type, endpoint, data, size, timeout);
+	endpointUnlock(self, endpoint);
+
+	return ret;
+}
+
+/*
+ * Transfer object
+ */
+
+PYUSB_STATIC void Py_usb_Transfer_sweep(
+	Py_usb_Transfer *self
+	)
+{
+#if PYUSB_USBFS
+	engineSweep(&self->handle->engine);
+#endif /* PYUSB_USBFS */
+}
+
+/*
+ * Waits up to timeout miliseconds (-1 forever) for the transfer.
+ * Returns true if it is done.
+ */
+PYUSB_STATIC int Py_usb_Transfer_waitDone(
+	Py_usb_Transfer *self,
+	int timeout
+	)
+{
+#if PYUSB_USBFS
+	if (!self->request.done) {
+		Py_BEGIN_ALLOW_THREADS
+		engineWait(&self->handle->engine, &self->request, timeout);
+		Py_END_ALLOW_THREADS
+	}
+
+	Py_usb_Transfer_sweep(self);
+#endif /* PYUSB_USBFS */
+
+	return self->request.done;
+}
+
+/*
+ * Runs the done callbacks of a transfer, once
+ */
+PYUSB_STATIC void Py_usb_Transfer_finished(
+	PyObject *self
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+	PyObject *callbacks = _self->callbacks;
+	PyObject *ret;
+	Py_ssize_t i;
+
+	if (!callbacks) return;
+
+	/* the callbacks may reference the transfer, break the cycle */
+	_self->callbacks = NULL;
+
+	for (i = 0; i < PyList_GET_SIZE(callbacks); ++i) {
+		PyObject *callback = PyList_GET_ITEM(callbacks, i);
+
+		ret = PyObject_CallFunctionObjArgs(callback, self, NULL);
+
+		if (ret) {
+			Py_DECREF(ret);
+		} else {
+			PyErr_WriteUnraisable(callback);
+		}
+	}
+
+	Py_DECREF(callbacks);
+}
+
+/*
+ * def addDoneCallback(callback)
+ */
+PYUSB_STATIC PyObject *Py_usb_Transfer_addDoneCallback(
+	PyObject *self,
+	PyObject *callback
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+
+	if (!PyCallable_Check(callback)) {
+		PyErr_SetString(PyExc_TypeError, "callback must be callable");
+		return NULL;
+	}
+
+	Py_usb_Transfer_sweep(_self);
+
+	if (!_self->callbacks) {
+		_self->callbacks = PyList_New(0);
+		if (!_self->callbacks) return NULL;
+	}
+
+	if (PyList_Append(_self->callbacks, callback) < 0) return NULL;
+
+	/* done and released by the engine, the callbacks have run */
+	if (_self->request.done && !_self->request.owner)
+		Py_usb_Transfer_finished(self);
+
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Transfer_done(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	return PyBool_FromLong(Py_usb_Transfer_waitDone((Py_usb_Transfer *) self, 0));
+}
+
+/*
+ * def wait(timeout = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_Transfer_wait(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int timeout = -1;
+
+	if (!PyArg_ParseTuple(args, "|i", &timeout)) return NULL;
+
+	return PyBool_FromLong(Py_usb_Transfer_waitDone((Py_usb_Transfer *) self, timeout));
+}
+
+PYUSB_STATIC PyObject *Py_usb_Transfer_cancel(
+	PyObject *self,
+	PyObject *args
+	)
+{
+#if PYUSB_USBFS
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+
+	if (!_self->request.done)
+		engineCancel(&_self->handle->engine, &_self->request);
+#endif /* PYUSB_USBFS */
+
+	Py_RETURN_NONE;
+}
+
+/*
+ * Builds the result of a completed transfer
+ */
+PYUSB_STATIC PyObject *Py_usb_Transfer_buildResult(
+	Py_usb_Transfer *self
+	)
+{
+	int size = self->request.actualLength;
+	PyObject *result;
+
+	if (!self->isRead || self->readInto) {
+		if (self->readInto && self->control.data) {
+			if (size > self->buffer.size) size = (int) self->buffer.size;
+			memcpy(self->buffer.data, self->control.data + PYUSB_SETUP_SIZE, size);
+		}
+
+		releaseBuffer(&self->buffer);
+		releaseBuffer(&self->control);
+		return PyInt_FromLong(size);
+	}
+
+	if (self->control.data)
+		memcpy(self->buffer.data, self->control.data + PYUSB_SETUP_SIZE, size);
+
+	/* isochronous packets keep their place in the buffer */
+	if (self->type == PYUSB_TRANSFER_ISOCHRONOUS)
+		size = (int) self->buffer.size;
+
+	result = buildResult(self->format, &self->buffer, size);
+	releaseBuffer(&self->control);
+	return result;
+}
+
+/*
+ * def result(timeout = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_Transfer_result(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+	int timeout = -1;
+
+	if (!PyArg_ParseTuple(args, "|i", &timeout)) return NULL;
+
+	if (!Py_usb_Transfer_waitDone(_self, timeout)) {
+		PyErr_SetString(PyExc_USBError, "Transfer not completed");
+		return NULL;
+	}
+
+	if (_self->request.status < 0) {
+		PyUSB_ErrnoError(_self->request.status);
+		return NULL;
+	}
+
+	if (!_self->result) {
+		_self->result = Py_usb_Transfer_buildResult(_self);
+		if (!_self->result) return NULL;
+	}
+
+	Py_INCREF(_self->result);
+	return _self->result;
+}
+
+/*
+ * def isoPackets()
+ */
+PYUSB_STATIC PyObject *Py_usb_Transfer_isoPackets(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+#if PYUSB_USBFS
+	PyObject *lengths, *status;
+	struct usbdevfs_urb *urb;
+	int *l, *st;
+	int i, j, n = 0;
+#endif /* PYUSB_USBFS */
+
+	if (_self->type != PYUSB_TRANSFER_ISOCHRONOUS) {
+		PyErr_SetString(PyExc_USBError, "Not an isochronous transfer");
+		return NULL;
+	}
+
+	if (!Py_usb_Transfer_waitDone(_self, 0)) {
+		PyErr_SetString(PyExc_USBError, "Transfer not completed");
+		return NULL;
+	}
+
+#if PYUSB_USBFS
+	for (i = 0; i < _self->request.numUrbs; ++i)
+		n += requestUrb(&_self->request, i)->number_of_packets;
+
+	lengths = newArray(&intArrayTemplate, "i", n, (void **) &l);
+	if (!lengths) return NULL;
+
+	status = newArray(&intArrayTemplate, "i", n, (void **) &st);
+
+	if (!status) {
+		Py_DECREF(lengths);
+		return NULL;
+	}
+
+	for (i = 0; i < _self->request.numUrbs; ++i) {
+		urb = requestUrb(&_self->request, i);
+
+		for (j = 0; j < urb->number_of_packets; ++j) {
+			*l++ = urb->iso_frame_desc[j].actual_length;
+			*st++ = urb->iso_frame_desc[j].status;
+		}
+	}
+
+	return Py_BuildValue("(NN)", lengths, status);
+#else
+	PyErr_SetString(PyExc_USBError, "Isochronous transfers are not supported");
+	return NULL;
+#endif /* PYUSB_USBFS */
+}
+
+PYUSB_STATIC PyObject *Py_usb_Transfer_fileno(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	return Py_usb_DeviceHandle_fileno((PyObject *) ((Py_usb_Transfer *) self)->handle, NULL);
+}
+
+PYUSB_STATIC PyObject *Py_usb_Transfer_getType(
+	PyObject *self,
+	void *closure
+	)
+{
+	switch (((Py_usb_Transfer *) self)->type) {
+	case PYUSB_TRANSFER_ISOCHRONOUS:
+		return PyInt_FromLong(USB_ENDPOINT_TYPE_ISOCHRONOUS);
+	case PYUSB_TRANSFER_INTERRUPT:
+		return PyInt_FromLong(USB_ENDPOINT_TYPE_INTERRUPT);
+	case PYUSB_TRANSFER_CONTROL:
+		return PyInt_FromLong(USB_ENDPOINT_TYPE_CONTROL);
+	default:
+		return PyInt_FromLong(USB_ENDPOINT_TYPE_BULK);
+	}
+}
+
+PYUSB_STATIC PyObject *Py_usb_Transfer_getActualLength(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+
+	return PyInt_FromLong(_self->request.done ? _self->request.actualLength : 0);
+}
+
+PYUSB_STATIC PyMemberDef Py_usb_Transfer_Members[] = {
+	{"endpoint",
+	 T_INT,
+	 offsetof(Py_usb_Transfer, endpoint),
+	 READONLY,
+	 "The endpoint address of the transfer."},
+
+	{"packetSize",
+	 T_INT,
+	 offsetof(Py_usb_Transfer, packetSize),
+	 READONLY,
+	 "Packet size of isochronous transfers, 0 for the others."},
+
+	{NULL}
+};
+
+PYUSB_STATIC PyGetSetDef Py_usb_Transfer_GetSet[] = {
+	{"type",
+	 Py_usb_Transfer_getType,
+	 NULL,
+	 "The transfer type, one of the ENDPOINT_TYPE_* constants."},
+
+	{"actualLength",
+	 Py_usb_Transfer_getActualLength,
+	 NULL,
+	 "Number of bytes transferred, once the transfer is done."},
+
+	{NULL}
+};
+
+PYUSB_STATIC PyMethodDef Py_usb_Transfer_Methods[] = {
+	{"done",
+	 Py_usb_Transfer_done,
+	 METH_NOARGS,
+	 "done() -> bool\n\n"
+	 "Returns True if the transfer has completed, failed or\n"
+	 "been cancelled. Never blocks."},
+
+	{"wait",
+	 Py_usb_Transfer_wait,
+	 METH_VARARGS,
+	 "wait(timeout=-1) -> bool\n\n"
+	 "Waits for the transfer to finish.\n"
+	 "Arguments:\n"
+	 "\ttimeout: maximum time to wait in miliseconds, -1 waits\n"
+	 "\t         forever. (default: -1)\n"
+	 "Returns True if the transfer is done."},
+
+	{"cancel",
+	 Py_usb_Transfer_cancel,
+	 METH_NOARGS,
+	 "cancel() -> None\n\n"
+	 "Requests the cancellation of the transfer. The transfer is\n"
+	 "done once the cancellation completes, and its result raises\n"
+	 "USBError."},
+
+	{"result",
+	 Py_usb_Transfer_result,
+	 METH_VARARGS,
+	 "result(timeout=-1) -> buffer|bytesTransferred\n\n"
+	 "Waits for the transfer and returns its result: the data read,\n"
+	 "in the format of the handle (see DeviceHandle.resultFormat),\n"
+	 "or the number of bytes transferred for writes and for reads\n"
+	 "into a caller buffer. Raises USBError if the transfer failed\n"
+	 "or did not complete within timeout.\n"
+	 "Arguments:\n"
+	 "\ttimeout: maximum time to wait in miliseconds, -1 waits\n"
+	 "\t         forever. (default: -1)\n"},
+
+	{"addDoneCallback",
+	 Py_usb_Transfer_addDoneCallback,
+	 METH_O,
+	 "addDoneCallback(callback) -> None\n\n"
+	 "Arranges for callback(transfer) to be called once the transfer\n"
+	 "is done, from the thread that reaps its completion with the\n"
+	 "GIL: usb.poll, DeviceHandle.reap or a method of a transfer of\n"
+	 "the same handle. If the transfer is already done, callback is\n"
+	 "called right away. Together with fileno, reap and cancel, this\n"
+	 "lets an event loop drive transfers without helper threads."},
+
+	{"fileno",
+	 Py_usb_Transfer_fileno,
+	 METH_NOARGS,
+	 "fileno() -> fd\n\n"
+	 "Returns the file descriptor of the handle of the transfer\n"
+	 "(see DeviceHandle.fileno)."},
+
+	{"isoPackets",
+	 Py_usb_Transfer_isoPackets,
+	 METH_NOARGS,
+	 "isoPackets() -> (lengths, status)\n\n"
+	 "Returns the outcome of each packet of a completed isochronous\n"
+	 "transfer, as two array('i'): the bytes actually transferred\n"
+	 "and the status (0 or a negative errno) of every packet. The\n"
+	 "data of packet i starts at offset i * packetSize of the result."},
+
+	{NULL, NULL}
+};
+
+/*
+ * A submitted transfer references itself until the engine releases
+ * it in engineSweep. That reference belongs to the engine and is not
+ * visited, so a transfer is never collected while it is in flight,
+ * nor before its done callbacks have run.
+ */
+PYUSB_STATIC int Py_usb_Transfer_traverse(
+	PyObject *self,
+	visitproc visit,
+	void *arg
+	)
+{
+	Py_VISIT(((Py_usb_Transfer *) self)->callbacks);
+	Py_VISIT(((Py_usb_Transfer *) self)->result);
+	return 0;
+}
+
+PYUSB_STATIC int Py_usb_Transfer_clear(
+	PyObject *self
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+
+	/* still owned by the engine, engineSweep runs the callbacks */
+	if (_self->request.owner) {
+		Py_CLEAR(_self->result);
+		return 0;
+	}
+
+	Py_CLEAR(_self->callbacks);
+	Py_CLEAR(_self->result);
+	return 0;
+}
+
+PYUSB_STATIC void Py_usb_Transfer_del(
+	PyObject *self
+	)
+{
+	Py_usb_Transfer *_self = (Py_usb_Transfer *) self;
+
+	PyObject_GC_UnTrack(self);
+	Py_usb_Transfer_clear(self);
+
+#if PYUSB_USBFS
+	requestClear(&_self->request);
+#endif /* PYUSB_USBFS */
+
+	releaseBuffer(&_self->buffer);
+	releaseBuffer(&_self->control);
+	Py_XDECREF((PyObject *) _self->handle);
+	PyObject_GC_Del(self);
+}
+
+PYUSB_STATIC PyTypeObject Py_usb_Transfer_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "usb.Transfer",   	       /*tp_name*/
+    sizeof(Py_usb_Transfer),   /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    Py_usb_Transfer_del,       /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+	0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_HAVE_GC, /*tp_flags*/
+    "Asynchronous transfer object, created by the\n"
+    "DeviceHandle.submit* methods.", /* tp_doc */
+    Py_usb_Transfer_traverse,  /* tp_traverse */
+    Py_usb_Transfer_clear,     /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Py_usb_Transfer_Methods,   /* tp_methods */
+    Py_usb_Transfer_Members,   /* tp_members */
+    Py_usb_Transfer_GetSet,    /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,					       /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0						/* destructor */
+};
+
+/*
+ * Creates a transfer object, without its data
+ */
+PYUSB_STATIC Py_usb_Transfer *newTransfer(
+	Py_usb_DeviceHandle *self,
+	int type,
+	int endpoint,
+	int isRead
+	)
+{
+	Py_usb_Transfer *t;
+
+	if (checkEndpoint(self, endpoint) < 0) return NULL;
+
+	t = PyObject_GC_New(Py_usb_Transfer, &Py_usb_Transfer_Type);
+	if (!t) return NULL;
+
+	memset((char *) t + sizeof(PyObject), 0, sizeof(Py_usb_Transfer) - sizeof(PyObject));
+	Py_INCREF((PyObject *) self);
+	t->handle = self;
+	t->type = type;
+	t->endpoint = endpoint;
+	t->isRead = isRead;
+	t->format = self->resultFormat;
+	PyObject_GC_Track((PyObject *) t);
+
+	return t;
+}
+
+/*
+ * Takes the data of a transfer. For reads, data is either the
+ * number of bytes to read or a writable buffer to read into.
+ * Returns 0 or -1 with an exception set.
+ */
+PYUSB_STATIC int transferData(
+	Py_usb_Transfer *t,
+	PyObject *data
+	)
+{
+	int size;
+
+	if (!t->isRead)
+		return getBuffer(&t->handle->pool, data, &t->buffer);
+
+	if (PyNumber_Check(data)) {
+		size = py_NumberAsInt(data);
+		if (PyErr_Occurred()) return -1;
+		return newReadBuffer(&t->handle->pool, t->format, size, &t->buffer);
+	}
+
+	if (getWritableBuffer(data, 0, &t->buffer) < 0) return -1;
+	t->readInto = 1;
+
+	return 0;
+}
+
+#if PYUSB_USBFS
+/*
+ * Submits a transfer whose request was set up, ret being the
+ * result of the setup. The transfer is kept alive until it is done.
+ * Returns 0 or -1 with an exception set.
+ */
+PYUSB_STATIC int transferSubmit(
+	Py_usb_Transfer *t,
+	int ret
+	)
+{
+	Py_usb_Transfer_sweep(t);
+
+	if (!ret) {
+		Py_INCREF((PyObject *) t);
+		t->request.owner = (PyObject *) t;
+		ret = engineSubmit(&t->handle->engine, &t->request);
+
+		if (ret) {
+			t->request.owner = NULL;
+			Py_DECREF((PyObject *) t);
+		}
+	}
+
+	if (ret) {
+		PyUSB_ErrnoError(ret);
+		return -1;
+	}
+
+	return 0;
+}
+#endif /* PYUSB_USBFS */
+
+/*
+ * Creates and submits a bulk, interrupt or control transfer.
+ * For control transfers, the direction comes from requestType.
+ */
+PYUSB_STATIC PyObject *submitTransfer(
+	Py_usb_DeviceHandle *self,
+	int type,
+	int endpoint,
+	PyObject *data,
+	int requestType,
+	int request,
+	int value,
+	int index,
+	int timeout
+	)
+{
+	Py_usb_Transfer *t;
+	char *p;
+	int size;
+	int ret;
+
+	if (type == PYUSB_TRANSFER_CONTROL) {
+		t = newTransfer(self, type, 0, (requestType & USB_ENDPOINT_IN) != 0);
+	} else {
+		t = newTransfer(self, type, endpoint, (endpoint & USB_ENDPOINT_IN) != 0);
+	}
+
+	if (!t) return NULL;
+	if (transferData(t, data) < 0) goto error;
+
+	p = t->buffer.data;
+	size = (int) t->buffer.size;
+
+	if (type == PYUSB_TRANSFER_CONTROL) {
+		if (size > 0xffff) {
+			PyErr_SetString(PyExc_ValueError, "Control transfer too big");
+			goto error;
+		}
+
+#if PYUSB_USBFS
+		if (self->engine.fd >= 0) {
+			/* usbfs wants the setup packet in front of the data */
+			if (newScratchBuffer(&self->pool, PYUSB_SETUP_SIZE + size, &t->control) < 0)
+				goto error;
+
+			p = t->control.data;
+			p[0] = (char) requestType;
+			p[1] = (char) request;
+			p[2] = (char) (value & 0xff);
+			p[3] = (char) ((value >> 8) & 0xff);
+			p[4] = (char) (index & 0xff);
+			p[5] = (char) ((index >> 8) & 0xff);
+			p[6] = (char) (size & 0xff);
+			p[7] = (char) ((size >> 8) & 0xff);
+
+			if (!t->isRead) memcpy(p + PYUSB_SETUP_SIZE, t->buffer.data, size);
+			size += PYUSB_SETUP_SIZE;
+		}
+#endif /* PYUSB_USBFS */
+	}
+
+#if PYUSB_USBFS
+	if (self->engine.fd >= 0) {
+		ret = requestSetup(&t->request, type, t->endpoint, p, size);
+		t->request.timeout = timeout;
+		if (transferSubmit(t, ret) < 0) goto error;
+		return (PyObject *) t;
+	}
+#endif /* PYUSB_USBFS */
+
+	/* no asynchronous support, the transfer is done right now */
+	Py_BEGIN_ALLOW_THREADS
+
+	if (type == PYUSB_TRANSFER_CONTROL) {
+		ret = controlTransfer(self, requestType, request,
+							  value, index, p, size, timeout);
+	} else {
+		ret = syncTransfer(self, type, t->endpoint, p, size, timeout);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	t->request.done = 1;
+
+	if (ret < 0) {
+		t->request.status = ret;
+	} else {
+		t->request.actualLength = ret;
+	}
+
+	return (PyObject *) t;
+
+error:
+	Py_DECREF((PyObject *) t);
+	return NULL;
+}
+
+/*
+ * Packet size of endpoint, from the descriptor of a claimed
+ * interface, or of any interface. High bandwidth endpoints move
+ * up to three packets per microframe. Returns 0 if not found.
+ */
+PYUSB_STATIC int endpointPacketSize(
+	Py_usb_DeviceHandle *self,
+	int endpoint
+	)
+{
+	struct usb_device *dev = usb_device(self->deviceHandle);
+	struct usb_interface_descriptor *alt;
+	struct usb_endpoint_descriptor *ep;
+	int c, i, a, e, w;
+	int k = PYUSB_ENDPOINT_INDEX(endpoint);
+
+	if (self->claims.owner[k] >= 0) return self->claims.packetSize[k];
+
+	if (!dev || !dev->config) return 0;
+
+	for (c = 0; c < dev->descriptor.bNumConfigurations; ++c) {
+		for (i = 0; i < dev->config[c].bNumInterfaces; ++i) {
+			for (a = 0; a < dev->config[c].interface[i].num_altsetting; ++a) {
+				alt = dev->config[c].interface[i].altsetting + a;
+
+				for (e = 0; e < alt->bNumEndpoints; ++e) {
+					ep = alt->endpoint + e;
+					if (ep->bEndpointAddress != endpoint) continue;
+
+					w = ep->wMaxPacketSize;
+					return (w & 0x7ff) * (1 + ((w >> 11) & 3));
+				}
+			}
+		}
+	}
+
+	return 0;
+}
+
+#if PYUSB_USBFS
+/*
+ * Chains the URBs of a chunk of a pipelined read to the ones of
+ * the chunks around it, so a short packet cancels the chunks
+ * queued after it instead of letting them read the data of the
+ * next transfer
+ */
+PYUSB_STATIC void requestChain(
+	PyUSB_Request *request,
+	int hasPrevious,
+	int hasNext
+	)
+{
+#ifdef USBDEVFS_URB_BULK_CONTINUATION
+	if (hasPrevious)
+		requestUrb(request, 0)->flags |= USBDEVFS_URB_BULK_CONTINUATION;
+
+	if (hasNext)
+		requestUrb(request, request->numUrbs - 1)->flags |= USBDEVFS_URB_SHORT_NOT_OK;
+#endif /* USBDEVFS_URB_BULK_CONTINUATION */
+}
+
+/*
+ * Performs a bulk transfer as chunks of chunkSize bytes, keeping
+ * depth of them queued. timeout applies to the whole transfer.
+ * Must be called without the GIL.
+ */
+PYUSB_STATIC int enginePipeline(
+	PyUSB_Engine *engine,
+	int endpoint,
+	char *data,
+	int size,
+	int chunkSize,
+	int depth,
+	int timeout
+	)
+{
+	PyUSB_Request *requests;
+	PyUSB_Request *request;
+	struct timespec deadline;
+	int isRead = (endpoint & USB_ENDPOINT_IN) != 0;
+	int head = 0, count = 0;
+	int submitted = 0, total = 0;
+	int remaining = -1;
+	int status = 0;
+	int len, i;
+
+	requests = (PyUSB_Request *) calloc(depth, sizeof(PyUSB_Request));
+	if (!requests) return -ENOMEM;
+
+	if (timeout) setDeadline(&deadline, timeout);
+
+	while (!status) {
+		while (count < depth && submitted < size) {
+			request = requests + (head + count) % depth;
+			len = size - submitted < chunkSize ? size - submitted : chunkSize;
+
+			status = requestSetup(request, PYUSB_TRANSFER_BULK, endpoint,
+								  data + submitted, len);
+
+			if (!status) {
+				if (isRead) requestChain(request, submitted > 0, submitted + len < size);
+				status = engineSubmit(engine, request);
+				if (status) requestClear(request);
+			}
+
+			if (status) break;
+
+			submitted += len;
+			++count;
+		}
+
+		if (status || !count) break;
+
+		/* the chunks complete in the order they were queued */
+		request = requests + head;
+		if (timeout) remaining = msLeft(&deadline);
+
+		if (!engineWait(engine, request, remaining)) {
+			status = -ETIMEDOUT;
+			break;
+		}
+
+		head = (head + 1) % depth;
+		--count;
+
+		if (request->status) {
+			status = request->status;
+			requestClear(request);
+			break;
+		}
+
+		total += request->actualLength;
+
+		for (i = 0, len = 0; i < request->numUrbs; ++i)
+			len += requestUrb(request, i)->buffer_length;
+
+		requestClear(request);
+
+		/* a short packet ends a read, the kernel cancels what follows */
+		if (request->actualLength < len) break;
+	}
+
+	while (count) {
+		request = requests + head;
+		engineCancel(engine, request);
+		engineWait(engine, request, -1);
+		requestClear(request);
+		head = (head + 1) % depth;
+		--count;
+	}
+
+	free(requests);
+
+	return status ? status : total;
+}
+#endif /* PYUSB_USBFS */
+
+/*
+ * chunkedTransfer with the endpoint lock held
+ */
+PYUSB_STATIC int lockedChunks(
+	Py_usb_DeviceHandle *self,
+	int endpoint,
+	char *data,
+	int size,
+	int chunkSize,
+	int depth,
+	int timeout
+	)
+{
+	int packetSize;
+	int done, len, ret;
+#if PYUSB_THREADS
+	struct timespec deadline;
+	int remaining;
+#endif /* PYUSB_THREADS */
+
+	if (chunkSize <= 0 || size <= chunkSize)
+		return lockedTransfer(self, PYUSB_TRANSFER_BULK, endpoint, data, size, timeout);
+
+	packetSize = endpointPacketSize(self, endpoint);
+	if (packetSize <= 0) packetSize = 512;
+
+	if (chunkSize > packetSize) {
+		chunkSize -= chunkSize % packetSize;
+	} else {
+		chunkSize = packetSize;
+	}
+
+#if PYUSB_USBFS
+	if (self->engine.fd >= 0)
+		return enginePipeline(&self->engine, endpoint, data, size,
+							  chunkSize, depth, timeout);
+#endif /* PYUSB_USBFS */
+
+#if PYUSB_THREADS
+	if (timeout) setDeadline(&deadline, timeout);
+#endif /* PYUSB_THREADS */
+
+	for (done = 0; done < size; done += ret) {
+		len = size - done < chunkSize ? size - done : chunkSize;
+
+#if PYUSB_THREADS
+		if (timeout) {
+			remaining = msLeft(&deadline);
+			if (!remaining) return -ETIMEDOUT;
+			timeout = remaining;
+		}
+#endif /* PYUSB_THREADS */
+
+		ret = lockedTransfer(self, PYUSB_TRANSFER_BULK, endpoint,
+							 data + done, len, timeout);
+
+		if (ret < 0) return ret;
+
+		if (ret < len) {
+			done += ret;
+			break;
+		}
+	}
+
+	return done;
+}
+
+/*
+ * Performs a bulk transfer, split in chunks of chunkSize bytes
+ * rounded down to whole packets if chunkSize is positive, with
+ * depth chunks queued when the usbfs engine is available and one
+ * at a time otherwise. timeout applies to the whole transfer, the
+ * endpoint is locked until the last chunk is done.
+ * Must be called without the GIL.
+ */
+PYUSB_STATIC int chunkedTransfer(
+	Py_usb_DeviceHandle *self,
+	int endpoint,
+	char *data,
+	int size,
+	int chunkSize,
+	int depth,
+	int timeout
+	)
+{
+	int ret;
+
+	endpointLock(self, endpoint);
+	ret = lockedChunks(self, endpoint, data, size, chunkSize, depth, timeout);
+	endpointUnlock(self, endpoint);
+
+	return ret;
+}
+
+/*
+ * Creates and submits an isochronous transfer of size bytes
+ * sent or received in packets of packetSize bytes. For reads,
+ * data is NULL.
+ */
+PYUSB_STATIC PyObject *submitIsoTransfer(
+	Py_usb_DeviceHandle *self,
+	int endpoint,
+	PyObject *data,
+	int size,
+	int packetSize
+	)
+{
+	Py_usb_Transfer *t;
+	int ret;
+
+	if (packetSize < 0) packetSize = endpointPacketSize(self, endpoint);
+
+	if (packetSize <= 0) {
+		PyErr_SetString(PyExc_ValueError, "Unknown packet size, packetSize is required");
+		return NULL;
+	}
+
+#if PYUSB_USBFS
+	if (self->engine.fd >= 0) {
+		t = newTransfer(self, PYUSB_TRANSFER_ISOCHRONOUS, endpoint, data == NULL);
+		if (!t) return NULL;
+
+		t->packetSize = packetSize;
+
+		if (data) {
+			if (getBuffer(&self->pool, data, &t->buffer) < 0) goto error;
+			size = (int) t->buffer.size;
+		} else {
+			if (newReadBuffer(&self->pool, t->format, size, &t->buffer) < 0) goto error;
+		}
+
+		if (size <= 0) {
+			PyErr_SetString(PyExc_ValueError, "Empty isochronous transfer");
+			goto error;
+		}
+
+		ret = requestSetupIso(&t->request, endpoint, t->buffer.data, size, packetSize);
+		if (transferSubmit(t, ret) < 0) goto error;
+
+		return (PyObject *) t;
+
+error:
+		Py_DECREF((PyObject *) t);
+		return NULL;
+	}
+#endif /* PYUSB_USBFS */
+
+	/* libusb 0.1 has no isochronous API */
+	PyErr_SetString(PyExc_USBError, "Isochronous transfers are not supported for this device");
+	return NULL;
+}
+
+#if PYUSB_THREADS
+
+/*
+ * StreamReader object
+ */
+
+PYUSB_STATIC int streamStopping(
+	Py_usb_StreamReader *self
+	)
+{
+	int stop;
+
+	pthread_mutex_lock(&self->lock);
+	stop = self->stop;
+	pthread_mutex_unlock(&self->lock);
+
+	return stop;
+}
+
+/*
+ * Appends the data of a completed transfer to the ring.
+ * What does not fit is lost and counted as an overrun.
+ */
+PYUSB_STATIC void streamStore(
+	Py_usb_StreamReader *self,
+	const char *data,
+	size_t size
+	)
+{
+	size_t space, pos, n;
+
+	pthread_mutex_lock(&self->lock);
+
+	space = self->ringSize - (self->head - self->tail);
+
+	if (size > space) {
+		++self->overruns;
+		self->bytesLost += (unsigned long) (size - space);
+		size = space;
+	}
+
+	pos = self->head & (self->ringSize - 1);
+	n = self->ringSize - pos;
+	if (n > size) n = size;
+
+	memcpy(self->ring + pos, data, n);
+	memcpy(self->ring, data + n, size - n);
+	self->head += size;
+
+	if (size) pthread_cond_broadcast(&self->cond);
+
+	pthread_mutex_unlock(&self->lock);
+}
+
+/*
+ * Removes up to size bytes from the ring. Other readers may have
+ * taken the data seen by streamWait. Returns the number of bytes
+ * copied.
+ */
+PYUSB_STATIC size_t streamFetch(
+	Py_usb_StreamReader *self,
+	char *data,
+	size_t size
+	)
+{
+	size_t pos, n;
+
+	pthread_mutex_lock(&self->lock);
+
+	if (size > self->head - self->tail) size = self->head - self->tail;
+
+	pos = self->tail & (self->ringSize - 1);
+	n = self->ringSize - pos;
+	if (n > size) n = size;
+
+	memcpy(data, self->ring + pos, n);
+	memcpy(data + n, self->ring, size - n);
+	self->tail += size;
+
+	pthread_mutex_unlock(&self->lock);
+
+	return size;
+}
+
+/*
+ * Waits up to timeout miliseconds (-1 forever) for data in the ring.
+ * status is set to the error that stopped the thread, if it exited.
+ * Must be called without the GIL.
+ * Returns the number of bytes available.
+ */
+PYUSB_STATIC size_t streamWait(
+	Py_usb_StreamReader *self,
+	int timeout,
+	int *status
+	)
+{
+	struct timespec deadline;
+	size_t available;
+
+	if (timeout > 0) setDeadline(&deadline, timeout);
+
+	pthread_mutex_lock(&self->lock);
+
+	while (self->head == self->tail && self->running && timeout) {
+		if (timeout < 0) {
+			pthread_cond_wait(&self->cond, &self->lock);
+		} else if (pthread_cond_timedwait(&self->cond, &self->lock, &deadline) == ETIMEDOUT) {
+			break;
+		}
+	}
+
+	available = self->head - self->tail;
+	*status = self->running ? 0 : self->status;
+	pthread_mutex_unlock(&self->lock);
+
+	return available;
+}
+
+#if PYUSB_USBFS
+/*
+ * Keeps depth URB requests queued on the endpoint, resubmitting
+ * each one as soon as its data is stored in the ring
+ */
+PYUSB_STATIC int streamEngine(
+	Py_usb_StreamReader *self
+	)
+{
+	PyUSB_Engine *engine = &self->handle->engine;
+	PyUSB_Request *request;
+	int submitted, next = 0, status = 0, i;
+
+	for (submitted = 0; submitted < self->depth; ++submitted) {
+		request = self->requests + submitted;
+
+		status = requestSetup(request,
+							  PYUSB_TRANSFER_BULK,
+							  self->endpoint,
+							  self->data + (size_t) submitted * self->transferSize,
+							  self->transferSize);
+
+		if (!status) status = engineSubmit(engine, request);
+		if (status) break;
+	}
+
+	/* the requests complete in the order they were submitted */
+	while (!status) {
+		request = self->requests + next;
+
+		if (!engineWait(engine, request, PYUSB_STREAM_POLL)) {
+			if (streamStopping(self)) break;
+			continue;
+		}
+
+		if (request->status) {
+			status = request->status;
+			break;
+		}
+
+		streamStore(self,
+					self->data + (size_t) next * self->transferSize,
+					request->actualLength);
+
+		if (streamStopping(self)) break;
+
+		status = engineSubmit(engine, request);
+
+		if (status) {
+			request->done = 1;
+			break;
+		}
+
+		next = (next + 1) % self->depth;
+	}
+
+	for (i = 0; i < self->depth; ++i) {
+		request = self->requests + i;
+
+		if (i < submitted) {
+			engineCancel(engine, request);
+			engineWait(engine, request, -1);
+		}
+
+		requestClear(request);
+	}
+
+	return status;
+}
+#endif /* PYUSB_USBFS */
+
+/*
+ * Reads from the endpoint one transfer at a time,
+ * without asynchronous support
+ */
+PYUSB_STATIC int streamSync(
+	Py_usb_StreamReader *self
+	)
+{
+	int ret;
+
+	while (!streamStopping(self)) {
+		ret = syncTransfer(self->handle,
+						   PYUSB_TRANSFER_BULK,
+						   self->endpoint,
+						   self->data,
+						   self->transferSize,
+						   PYUSB_STREAM_POLL);
+
+		if (ret == -ETIMEDOUT) continue;
+		if (ret < 0) return ret;
+
+		streamStore(self, self->data, ret);
+	}
+
+	return 0;
+}
+
+/*
+ * StreamReader thread. Never touches Python objects.
+ */
+PYUSB_STATIC void *streamThread(
+	void *arg
+	)
+{
+	Py_usb_StreamReader *self = (Py_usb_StreamReader *) arg;
+	int status;
+
+#if PYUSB_USBFS
+	if (self->handle->engine.fd >= 0) {
+		/* its requests stay queued until the reader stops */
+		endpointLock(self->handle, self->endpoint);
+		status = streamEngine(self);
+		endpointUnlock(self->handle, self->endpoint);
+	} else
+#endif /* PYUSB_USBFS */
+		status = streamSync(self);
+
+	pthread_mutex_lock(&self->lock);
+	self->status = status;
+	self->running = 0;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->lock);
+
+	return NULL;
+}
+
+/*
+ * Stops the thread and waits for it to exit
+ */
+PYUSB_STATIC void streamJoin(
+	Py_usb_StreamReader *self
+	)
+{
+	if (!self->started) return;
+
+	pthread_mutex_lock(&self->lock);
+	self->stop = 1;
+	pthread_mutex_unlock(&self->lock);
+
+	Py_BEGIN_ALLOW_THREADS
+	pthread_join(self->thread, NULL);
+	Py_END_ALLOW_THREADS
+
+	self->started = 0;
+}
+
+/*
+ * Waits for data to read. Returns the number of bytes available
+ * or -1 with an exception set if the thread failed and the
+ * ring is empty.
+ */
+PYUSB_STATIC Py_ssize_t Py_usb_StreamReader_wait(
+	Py_usb_StreamReader *self,
+	int timeout
+	)
+{
+	size_t available;
+	int status;
+
+	Py_BEGIN_ALLOW_THREADS
+	available = streamWait(self, timeout, &status);
+	Py_END_ALLOW_THREADS
+
+	if (!available && status < 0) {
+		PyUSB_ErrnoError(status);
+		return -1;
+	}
+
+	return available > PY_SSIZE_T_MAX ? PY_SSIZE_T_MAX : (Py_ssize_t) available;
+}
+
+/*
+ * def read(size = -1, timeout = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_StreamReader_read(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_StreamReader *_self = (Py_usb_StreamReader *) self;
+	int size = -1;
+	int timeout = 0;
+	int format = _self->handle->resultFormat;
+	Py_ssize_t available;
+	PyUSB_Buffer buffer;
+
+	if (!PyArg_ParseTuple(args, "|ii", &size, &timeout)) return NULL;
+
+	available = Py_usb_StreamReader_wait(_self, timeout);
+	if (available < 0) return NULL;
+
+	if (size < 0 || size > available)
+		size = available > INT_MAX ? INT_MAX : (int) available;
+
+	if (newReadBuffer(&_self->handle->pool, format, size, &buffer) < 0)
+		return NULL;
+
+	size = (int) streamFetch(_self, buffer.data, size);
+
+	return buildResult(format, &buffer, size);
+}
+
+/*
+ * def readinto(buffer, timeout = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_StreamReader_readinto(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_StreamReader *_self = (Py_usb_StreamReader *) self;
+	int timeout = 0;
+	Py_ssize_t available;
+	PyObject *obj;
+	PyUSB_Buffer buffer;
+
+	if (!PyArg_ParseTuple(args, "O|i", &obj, &timeout)) return NULL;
+
+	if (getWritableBuffer(obj, 0, &buffer) < 0) return NULL;
+
+	available = Py_usb_StreamReader_wait(_self, timeout);
+
+	if (available < 0) {
+		releaseBuffer(&buffer);
+		return NULL;
+	}
+
+	if (available > buffer.size) available = buffer.size;
+
+	available = (Py_ssize_t) streamFetch(_self, buffer.data, (size_t) available);
+	releaseBuffer(&buffer);
+
+	return PyInt_FromSsize_t(available);
+}
+
+PYUSB_STATIC PyObject *Py_usb_StreamReader_close(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	streamJoin((Py_usb_StreamReader *) self);
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_StreamReader_getAvailable(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_StreamReader *_self = (Py_usb_StreamReader *) self;
+	size_t available;
+
+	pthread_mutex_lock(&_self->lock);
+	available = _self->head - _self->tail;
+	pthread_mutex_unlock(&_self->lock);
+
+	return PyLong_FromUnsignedLong((unsigned long) available);
+}
+
+PYUSB_STATIC PyObject *Py_usb_StreamReader_getRunning(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_StreamReader *_self = (Py_usb_StreamReader *) self;
+	int running;
+
+	pthread_mutex_lock(&_self->lock);
+	running = _self->running && !_self->stop;
+	pthread_mutex_unlock(&_self->lock);
+
+	return PyBool_FromLong(running);
+}
+
+PYUSB_STATIC PyMemberDef Py_usb_StreamReader_Members[] = {
+	{"endpoint",
+	 T_INT,
+	 offsetof(Py_usb_StreamReader, endpoint),
+	 READONLY,
+	 "The endpoint address the data is read from."},
+
+	{"transferSize",
+	 T_INT,
+	 offsetof(Py_usb_StreamReader, transferSize),
+	 READONLY,
+	 "Size of each bulk read."},
+
+	{"depth",
+	 T_INT,
+	 offsetof(Py_usb_StreamReader, depth),
+	 READONLY,
+	 "Number of bulk reads kept in flight."},
+
+	{"overruns",
+	 T_ULONG,
+	 offsetof(Py_usb_StreamReader, overruns),
+	 READONLY,
+	 "Number of transfers whose data did not fit in the ring buffer."},
+
+	{"bytesLost",
+	 T_ULONG,
+	 offsetof(Py_usb_StreamReader, bytesLost),
+	 READONLY,
+	 "Number of bytes dropped because the ring buffer was full."},
+
+	{NULL}
+};
+
+PYUSB_STATIC PyGetSetDef Py_usb_StreamReader_GetSet[] = {
+	{"available",
+	 Py_usb_StreamReader_getAvailable,
+	 NULL,
+	 "Number of bytes waiting in the ring buffer."},
+
+	{"running",
+	 Py_usb_StreamReader_getRunning,
+	 NULL,
+	 "False once the reader was closed or stopped by an error."},
+
+	{NULL}
+};
+
+PYUSB_STATIC PyMethodDef Py_usb_StreamReader_Methods[] = {
+	{"read",
+	 Py_usb_StreamReader_read,
+	 METH_VARARGS,
+	 "read(size=-1, timeout=0) -> buffer\n\n"
+	 "Takes data from the ring buffer.\n"
+	 "Arguments:\n"
+	 "\tsize: maximum number of bytes to return, -1 returns all\n"
+	 "\t      the data available. (default: -1)\n"
+	 "\ttimeout: miliseconds to wait for data when the ring buffer\n"
+	 "\t         is empty, -1 waits forever. (default: 0)\n"
+	 "Returns the data, in the format of the handle (see\n"
+	 "DeviceHandle.resultFormat); it is empty if no data arrived\n"
+	 "in time. Raises USBError once the data is drained if the\n"
+	 "reader was stopped by an error."},
+
+	{"readinto",
+	 Py_usb_StreamReader_readinto,
+	 METH_VARARGS,
+	 "readinto(buffer, timeout=0) -> bytesRead\n\n"
+	 "Takes data from the ring buffer, storing it in buffer.\n"
+	 "Arguments:\n"
+	 "\tbuffer: a writable object supporting the buffer protocol.\n"
+	 "\ttimeout: miliseconds to wait for data when the ring buffer\n"
+	 "\t         is empty, -1 waits forever. (default: 0)\n"
+	 "Returns the number of bytes stored."},
+
+	{"close",
+	 Py_usb_StreamReader_close,
+	 METH_NOARGS,
+	 "close() -> None\n\n"
+	 "Stops the reader and cancels the transfers in flight. The\n"
+	 "data already in the ring buffer can still be read.\n"
+	 "Called automatically on __del__."},
+
+	{NULL, NULL}
+};
+
+PYUSB_STATIC void Py_usb_StreamReader_del(
+	PyObject *self
+	)
+{
+	Py_usb_StreamReader *_self = (Py_usb_StreamReader *) self;
+
+	streamJoin(_self);
+
+	pthread_cond_destroy(&_self->cond);
+	pthread_mutex_destroy(&_self->lock);
+
+#if PYUSB_USBFS
+	free(_self->requests);
+#endif /* PYUSB_USBFS */
+
+	free(_self->data);
+	free(_self->ring);
+	Py_DECREF((PyObject *) _self->handle);
+	PyObject_Del(self);
+}
+
+PYUSB_STATIC PyTypeObject Py_usb_StreamReader_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "usb.StreamReader",        /*tp_name*/
+    sizeof(Py_usb_StreamReader), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    Py_usb_StreamReader_del,   /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+	0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT,        /*tp_flags*/
+    "Continuous reader of a bulk endpoint, created by\n"
+    "DeviceHandle.streamReader.", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Py_usb_StreamReader_Methods, /* tp_methods */
+    Py_usb_StreamReader_Members, /* tp_members */
+    Py_usb_StreamReader_GetSet, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,					       /* tp_init */
+    0,                         /* tp_alloc */
+    0,                         /* tp_new */
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0						/* destructor */
+};
+
+PYUSB_STATIC Py_usb_StreamReader *new_StreamReader(
+	Py_usb_DeviceHandle *handle,
+	int endpoint,
+	int transferSize,
+	int depth,
+	size_t bufferSize
+	)
+{
+	Py_usb_StreamReader *sr;
+	size_t ringSize = 1;
+	int ret;
+
+	sr = PyObject_NEW(Py_usb_StreamReader, &Py_usb_StreamReader_Type);
+	if (!sr) return NULL;
+
+	memset((char *) sr + sizeof(PyObject), 0, sizeof(Py_usb_StreamReader) - sizeof(PyObject));
+	Py_INCREF((PyObject *) handle);
+	sr->handle = handle;
+	sr->endpoint = endpoint;
+	sr->transferSize = transferSize;
+	sr->depth = depth;
+	pthread_mutex_init(&sr->lock, NULL);
+	pthread_cond_init(&sr->cond, NULL);
+
+	/* a power of two, so the positions may wrap around */
+	while (ringSize < bufferSize) ringSize <<= 1;
+
+	sr->ringSize = ringSize;
+	sr->ring = (char *) malloc(ringSize);
+	sr->data = (char *) malloc((size_t) depth * transferSize);
+
+#if PYUSB_USBFS
+	sr->requests = (PyUSB_Request *) calloc(depth, sizeof(PyUSB_Request));
+	if (!sr->requests) goto nomem;
+#endif /* PYUSB_USBFS */
+
+	if (!sr->ring || !sr->data) goto nomem;
+
+	sr->running = 1;
+	ret = pthread_create(&sr->thread, NULL, streamThread, sr);
+
+	if (ret) {
+		sr->running = 0;
+		PyUSB_ErrnoError(-ret);
+		Py_DECREF((PyObject *) sr);
+		return NULL;
+	}
+
+	sr->started = 1;
+	return sr;
+
+nomem:
+	PyErr_NoMemory();
+	Py_DECREF((PyObject *) sr);
+	return NULL;
+}
+
+#endif /* PYUSB_THREADS */
+
+PYUSB_STATIC PyMemberDef Py_usb_DeviceHandle_Members[] = {
+	{"poolHits",
+	 T_ULONG,
+	 offsetof(Py_usb_DeviceHandle, pool.hits),
+	 READONLY,
+	 "Number of transfer buffers reused from the buffer pool."},
+
+	{"poolMisses",
+	 T_ULONG,
+	 offsetof(Py_usb_DeviceHandle, pool.misses),
+	 READONLY,
+	 "Number of transfer buffers the buffer pool had to allocate."},
+
+	{"poolBytesHeld",
+	 T_ULONG,
+	 offsetof(Py_usb_DeviceHandle, pool.held),
+	 READONLY,
+	 "Number of bytes kept in the buffer pool for reuse."},
+
+	{"poolHighWater",
+	 T_ULONG,
+	 offsetof(Py_usb_DeviceHandle, pool.highWater),
+	 READONLY,
+	 "Maximum number of bytes kept in the buffer pool (see configurePool)."},
+
+	{"poolPageAligned",
+	 T_INT,
+	 offsetof(Py_usb_DeviceHandle, pool.pageAligned),
+	 READONLY,
+	 "True if the buffer pool allocates page aligned buffers."},
+
+	{NULL}
+};
+
+/*
+ * def controlMsg(requestType, request, buffer, value = 0, index = 0, timeout = 100)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_controlMsg(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	int requestType;
+	int request;
+	int value = 0;
+	int index = 0;
+	char *bytes;
+	PyObject *data;
+	Py_ssize_t size;
+	int timeout = DEFAULT_TIMEOUT;
+	int ret;
+	int as_read = 0;
+	PyUSB_Buffer buffer;
+
+	static char *kwlist[] = {
+		"requestType",
+		"request",
+		"buffer",
+		"value",
+		"index",
+		"timeout",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iiO|iii",
+									 kwlist,
+									 &requestType,
+									 &request,
+									 &data,
+									 &value,
+									 &index,
+									 &timeout)) {
+		return NULL;
+	}
+
+	/*
+	 * If is a number, should be a read operation...
+	 */
+	if (PyNumber_Check(data)) {
+		size = py_NumberAsInt(data);
+		if (PyErr_Occurred()) return NULL;
+		if (newReadBuffer(&_self->pool, _self->resultFormat, size, &buffer) < 0)
+			return NULL;
+		as_read = 1;
+	} else {
+		if (getBuffer(&_self->pool, data, &buffer) < 0) return NULL;
+		size = buffer.size;
+	}
+
+	bytes = buffer.data;
+
+
+#if DUMP_PARAMS
+
+	fprintf(stderr, "controlMsg params:\n"
+		   "\trequestType: %d\n"
+		   "\trequest: %d\n"
+		   "\tvalue: %d\n"
+		   "\tindex: %d\n"
+		   "\ttimeout: %d\n",
+		   requestType,
+		   request,
+		   value,
+		   index,
+		   timeout);
+
+	if (as_read) {
+		fprintf(stderr, "\tbuffer: %d\n", (int) size);
+	} else {
+		fprintf(stderr, "controlMsg buffer param:\n");
+		printBuffer(bytes, size);
+	}
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = controlTransfer(_self,
+						  requestType,
+						  request,
+						  value,
+						  index,
+						  bytes,
+						  size,
+						  timeout);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		releaseBuffer(&buffer);
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else if (as_read) {
+		return buildResult(_self->resultFormat, &buffer, ret);
+	} else {
+		releaseBuffer(&buffer);
+		return PyInt_FromLong(ret);
+	}
+}
+
+/*
+ * def setConfiguration(configuration)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_setConfiguration(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	int configuration;
+	int ret;
+
+	if (SUPPORT_NUMBER_PROTOCOL(args)) {
+		configuration = (int) PyInt_AS_LONG(args);
+	} else if (PyObject_TypeCheck(args, &Py_usb_Configuration_Type)) {
+		configuration = ((Py_usb_Configuration *) args)->value;
+	} else {
+		PyErr_BadArgument();
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+	
+	fprintf(stderr,
+			"setConfiguration params:\n\tconfiguration: %d\n",
+			configuration);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+	ret = usb_set_configuration(_self->deviceHandle, configuration);
+
+	if (ret >= 0) {
+		_self->claims.configuration = configuration;
+		claimsMap(_self);
+	}
+
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	cacheClear(_self->device);
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else {
+		Py_RETURN_NONE;
+	}
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_claimInterface(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int interfaceNumber;
+	int ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	if (SUPPORT_NUMBER_PROTOCOL(args)) {
+		interfaceNumber = py_NumberAsInt(args);
+		if (PyErr_Occurred()) return NULL;
+	} else if (PyObject_TypeCheck(args, &Py_usb_Interface_Type)) {
+		interfaceNumber = ((Py_usb_Interface *) args)->interfaceNumber;
+	} else {
+		PyErr_BadArgument();
+		return NULL;
+	}
+
+	if (interfaceNumber < 0 || interfaceNumber >= PYUSB_MAX_INTERFACES) {
+		PyErr_SetString(PyExc_ValueError, "invalid interface number");
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"claimInterface params:\n\tinterfaceNumber: %d\n",
+			interfaceNumber);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+	ret = usb_claim_interface(_self->deviceHandle, interfaceNumber);
+
+	if (!ret) {
+		claimsAdd(&_self->claims, interfaceNumber, 0);
+		claimsMap(_self);
+	}
+
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_detachKernelDriver(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int interfaceNumber;
+#ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
+	int ret;
+#endif
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	if (SUPPORT_NUMBER_PROTOCOL(args)) {
+		interfaceNumber = py_NumberAsInt(args);
+		if (PyErr_Occurred()) return NULL;
+	} else if (PyObject_TypeCheck(args, &Py_usb_Interface_Type)) {
+		interfaceNumber = ((Py_usb_Interface *) args)->interfaceNumber;
+	} else {
+		PyErr_BadArgument();
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"detachKernelDriver params:\n\tinterfaceNumber: %d\n",
+			interfaceNumber);
+
+#endif /* DUMP_PARAMS */
+	
+#ifdef LIBUSB_HAS_DETACH_KERNEL_DRIVER_NP
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+	ret = usb_detach_kernel_driver_np(_self->deviceHandle, interfaceNumber);
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} 
+#endif
+
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_releaseInterface(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyObject *interface = Py_None;
+	int interfaceNumber = -1;
+	int claimed;
+	int ret = 0;
+
+	if (!PyArg_ParseTuple(args, "|O", &interface)) return NULL;
+
+	if (interface == Py_None) {
+		/* all of them */
+	} else if (SUPPORT_NUMBER_PROTOCOL(interface)) {
+		interfaceNumber = py_NumberAsInt(interface);
+		if (PyErr_Occurred()) return NULL;
+	} else if (PyObject_TypeCheck(interface, &Py_usb_Interface_Type)) {
+		interfaceNumber = ((Py_usb_Interface *) interface)->interfaceNumber;
+	} else {
+		PyErr_BadArgument();
+		return NULL;
+	}
+
+	/* the claims are read with the lock held */
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+
+	if (-1 == interfaceNumber) {
+		claimed = _self->claims.count;
+		ret = releaseClaims(_self);
+	} else {
+		claimed = interfaceNumber >= 0 &&
+			interfaceNumber < PYUSB_MAX_INTERFACES &&
+			PYUSB_CLAIMED(&_self->claims, interfaceNumber);
+		if (claimed) ret = releaseClaim(_self, interfaceNumber);
+	}
+
+	claimsMap(_self);
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (!claimed) {
+		if (-1 == interfaceNumber) {
+			PyErr_SetString(PyExc_ValueError, "No interface claimed");
+		} else {
+			PyErr_Format(PyExc_ValueError, "Interface %d is not claimed",
+						 interfaceNumber);
+		}
+		return NULL;
+	} else if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_setAltInterface(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int altInterface, ret;
+	int interfaceNumber = -1;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyUSB_Claims *claims = &_self->claims;
+
+	if (SUPPORT_NUMBER_PROTOCOL(args)) {
+		altInterface = (int) py_NumberAsInt(args);
+		if (PyErr_Occurred()) return NULL;
+	} else if (PyObject_TypeCheck(args, &Py_usb_Interface_Type)) {
+		altInterface = ((Py_usb_Interface *) args)->alternateSetting;
+		interfaceNumber = ((Py_usb_Interface *) args)->interfaceNumber;
+	} else {
+		PyErr_BadArgument();
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"setAltInterface params:\n\taltInterface: %d\n",
+			altInterface);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+
+	/*
+	 * libusb sets the alternate setting of the interface claimed
+	 * last, claiming again an interface of the handle selects it
+	 */
+	ret = 0;
+	if (interfaceNumber >= 0 && interfaceNumber != claims->current &&
+		interfaceNumber < PYUSB_MAX_INTERFACES &&
+		PYUSB_CLAIMED(claims, interfaceNumber)) {
+		ret = usb_claim_interface(_self->deviceHandle, interfaceNumber);
+		if (!ret) claims->current = interfaceNumber;
+	}
+
+	if (ret >= 0)
+		ret = usb_set_altinterface(_self->deviceHandle, altInterface);
+
+	if (ret >= 0 && claims->current >= 0) {
+		claims->altSetting[claims->current] = altInterface;
+		claimsMap(_self);
+	}
+
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkWrite(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	int endpoint;
+	int timeout = DEFAULT_TIMEOUT;
+	int chunkSize = 0;
+	int depth = 4;
+	PyUSB_Buffer data;
+	PyObject *bytes;
+	int ret;
+	PyObject *retObj;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	static char *kwlist[] = {
+		"endpoint",
+		"buffer",
+		"timeout",
+		"chunkSize",
+		"depth",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iO|iii",
+									 kwlist,
+									 &endpoint,
+									 &bytes,
+									 &timeout,
+									 &chunkSize,
+									 &depth)) {
+		return NULL;
+	}
+
+	if (depth < 1) {
+		PyErr_SetString(PyExc_ValueError, "depth must be positive");
+		return NULL;
+	}
+
+	if (checkEndpoint(_self, endpoint & ~USB_ENDPOINT_IN) < 0) return NULL;
+
+	if (getBuffer(&_self->pool, bytes, &data) < 0) return NULL;
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"bulkWrite params:\n"
+			"\tendpoint: %d\n"
+			"\ttimeout: %d\n"
+			"\tchunkSize: %d\n"
+			"\tdepth: %d\n",
+			endpoint,
+			timeout,
+			chunkSize,
+			depth);
+
+	fprintf(stderr, "bulkWrite buffer param:\n");
+	printBuffer(data.data, data.size);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = chunkedTransfer(_self, endpoint & ~USB_ENDPOINT_IN, data.data,
+						  data.size, chunkSize, depth, timeout);
+	Py_END_ALLOW_THREADS
+
+	releaseBuffer(&data);
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else {
+		retObj = PyInt_FromLong(ret);
+	}
+
+	return retObj;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkRead(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	int endpoint;
+	int timeout = DEFAULT_TIMEOUT;
+	int chunkSize = 0;
+	int depth = 4;
+	PyUSB_Buffer buffer;
+	int size;
+	PyObject *ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	static char *kwlist[] = {
+		"endpoint",
+		"size",
+		"timeout",
+		"chunkSize",
+		"depth",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "ii|iii",
+									 kwlist,
+									 &endpoint,
+									 &size,
+									 &timeout,
+									 &chunkSize,
+									 &depth)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"bulkRead params:\n"
+			"\tendpoint: %d\n"
+			"\tsize: %d\n"
+			"\ttimeout: %d\n"
+			"\tchunkSize: %d\n"
+			"\tdepth: %d\n",
+			endpoint,
+			size,
+			timeout,
+			chunkSize,
+			depth);
+
+#endif /* DUMP_PARAMS */
+
+	if (depth < 1) {
+		PyErr_SetString(PyExc_ValueError, "depth must be positive");
+		return NULL;
+	}
+
+	if (checkEndpoint(_self, endpoint | USB_ENDPOINT_IN) < 0) return NULL;
+
+	if (newReadBuffer(&_self->pool, _self->resultFormat, size, &buffer) < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	size = chunkedTransfer(_self, endpoint | USB_ENDPOINT_IN, buffer.data,
+						   size, chunkSize, depth, timeout);
+	Py_END_ALLOW_THREADS
+
+	if (size < 0) {
+		releaseBuffer(&buffer);
+		PyUSB_ErrnoError(size);
+		return NULL;
+	} else {
+		ret = buildResult(_self->resultFormat, &buffer, size);
+	}
+
+	return ret;
+}
+
+/*
+ * Vectored transfers
+ */
+
+/*
+ * Copies the bytes of a packet crossing buffers: to the bounce
+ * buffer for writes (direction 1), or back from it for the first
+ * limit bytes of a read (direction -1). pos is the offset of data
+ * in the transfer.
+ */
+PYUSB_STATIC void copyFringe(
+	char *bounce,
+	char *data,
+	int size,
+	size_t pos,
+	int direction,
+	size_t limit
+	)
+{
+	if (direction > 0) {
+		memcpy(bounce, data, size);
+	} else if (direction < 0 && pos < limit) {
+		memcpy(data, bounce, limit - pos < (size_t) size ? limit - pos : size);
+	}
+}
+
+/*
+ * Lays the buffers of a vectored transfer out as segments whose
+ * boundaries fall on packet boundaries, so the device sees the same
+ * packets as for the concatenated data. The bytes of the packets
+ * crossing buffers are gathered in bounce, which must hold
+ * numBuffers * packetSize bytes; direction and limit are passed
+ * to copyFringe. segments may be NULL.
+ * Returns the number of segments, at most 2 * numBuffers + 1.
+ */
+PYUSB_STATIC int layoutVector(
+	PyUSB_Buffer *buffers,
+	int numBuffers,
+	int packetSize,
+	char *bounce,
+	PyUSB_Segment *segments,
+	int direction,
+	size_t limit
+	)
+{
+	char *packet = bounce;		/* packet being gathered */
+	size_t pos = 0;
+	int fill = 0;
+	int n = 0;
+	int i, k, len;
+	char *p;
+
+	for (i = 0; i < numBuffers; ++i) {
+		p = buffers[i].data;
+		len = (int) buffers[i].size;
+
+		if (fill) {
+			k = packetSize - fill < len ? packetSize - fill : len;
+			copyFringe(packet + fill, p, k, pos, direction, limit);
+			fill += k;
+			p += k;
+			len -= k;
+			pos += k;
+
+			if (fill == packetSize) {
+				if (segments) {
+					segments[n].data = packet;
+					segments[n].size = fill;
+				}
+
+				++n;
+				packet += packetSize;
+				fill = 0;
+			}
+		}
+
+		/* whole packets, and the short one at the end of the transfer */
+		k = i == numBuffers - 1 ? len : len - len % packetSize;
+
+		if (k) {
+			if (segments) {
+				segments[n].data = p;
+				segments[n].size = k;
+			}
+
+			++n;
+			p += k;
+			len -= k;
+			pos += k;
+		}
+
+		if (len) {
+			copyFringe(packet, p, len, pos, direction, limit);
+			fill = len;
+			pos += len;
+		}
+	}
+
+	if (fill) {
+		if (segments) {
+			segments[n].data = packet;
+			segments[n].size = fill;
+		}
+
+		++n;
+	}
+
+	return n;
+}
+
+/*
+ * Copies between the buffers and a contiguous block: gathers
+ * them into data (direction 1) or scatters the first size bytes
+ * of data to them (direction -1)
+ */
+PYUSB_STATIC void copyVector(
+	PyUSB_Buffer *buffers,
+	int numBuffers,
+	char *data,
+	int size,
+	int direction
+	)
+{
+	int i, k;
+
+	for (i = 0; i < numBuffers && size > 0; ++i) {
+		k = (int) buffers[i].size < size ? (int) buffers[i].size : size;
+
+		if (direction > 0) {
+			memcpy(data, buffers[i].data, k);
+		} else {
+			memcpy(buffers[i].data, data, k);
+		}
+
+		data += k;
+		size -= k;
+	}
+}
+
+/*
+ * Common code of bulkWritev and bulkReadv
+ */
+PYUSB_STATIC PyObject *bulkVector(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds,
+	const char *name,
+	int isRead
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	int endpoint;
+	int timeout = DEFAULT_TIMEOUT;
+	PyObject *list;
+	PyObject *seq;
+	PyObject *result = NULL;
+	PyUSB_Buffer *buffers = NULL;
+	PyUSB_Buffer scratch;
+	PyUSB_Segment *segments = NULL;
+	int numBuffers = 0;
+	int packetSize = 0;
+	Py_ssize_t total = 0;
+	Py_ssize_t n;
+	int i, ret;
+	static char *kwlist[] = {
+		"endpoint",
+		"buffers",
+		"timeout",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iO|i",
+									 kwlist,
+									 &endpoint,
+									 &list,
+									 &timeout)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"%s params:\n"
+			"\tendpoint: %d\n"
+			"\ttimeout: %d\n",
+			name,
+			endpoint,
+			timeout);
+
+#endif /* DUMP_PARAMS */
+
+	if (isRead) {
+		endpoint |= USB_ENDPOINT_IN;
+	} else {
+		endpoint &= ~USB_ENDPOINT_IN;
+	}
+
+	if (checkEndpoint(_self, endpoint) < 0) return NULL;
+
+	memset(&scratch, 0, sizeof(scratch));
+
+	seq = PySequence_Fast(list, "buffers must be a sequence");
+	if (!seq) return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+
+	if (n > INT_MAX / 2 - 1) {
+		PyErr_SetString(PyExc_ValueError, "Too many buffers");
+		goto done;
+	}
+
+	buffers = (PyUSB_Buffer *) PyMem_Malloc((n ? n : 1) * sizeof(PyUSB_Buffer));
+
+	if (!buffers) {
+		PyErr_NoMemory();
+		goto done;
+	}
+
+	for (; numBuffers < n; ++numBuffers) {
+		PyObject *item = PySequence_Fast_GET_ITEM(seq, numBuffers);
+
+		if (isRead) {
+			ret = getWritableBuffer(item, 0, buffers + numBuffers);
+		} else {
+			ret = getBuffer(&_self->pool, item, buffers + numBuffers);
+		}
+
+		if (ret < 0) goto done;
+
+		total += buffers[numBuffers].size;
+
+		if (total > INT_MAX) {
+			++numBuffers;
+			PyErr_SetString(PyExc_ValueError, "Transfer too big");
+			goto done;
+		}
+	}
+
+#if PYUSB_USBFS
+	if (_self->engine.fd >= 0)
+		packetSize = endpointPacketSize(_self, endpoint);
+#endif /* PYUSB_USBFS */
+
+	if (packetSize > 0) {
+		/* the buffers are transferred in place */
+		if (newScratchBuffer(&_self->pool, (Py_ssize_t) numBuffers * packetSize, &scratch) < 0)
+			goto done;
+
+		segments = (PyUSB_Segment *) PyMem_Malloc((2 * numBuffers + 1) * sizeof(PyUSB_Segment));
+
+		if (!segments) {
+			PyErr_NoMemory();
+			goto done;
+		}
+	} else {
+		/* no way to queue several pieces, the data is copied */
+		if (newScratchBuffer(&_self->pool, total, &scratch) < 0)
+			goto done;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+
+#if PYUSB_USBFS
+	if (segments) {
+		PyUSB_Request request;
+
+		memset(&request, 0, sizeof(request));
+
+		i = layoutVector(buffers, numBuffers, packetSize, scratch.data,
+						 segments, !isRead, 0);
+
+		if (!i) {
+			/* zero length packet */
+			segments[0].data = scratch.data;
+			segments[0].size = 0;
+			i = 1;
+		}
+
+		ret = requestSetupSegments(&request, PYUSB_TRANSFER_BULK, endpoint, segments, i);
+
+		if (!ret) {
+			endpointLock(_self, endpoint);
+			ret = engineRun(&_self->engine, &request, timeout);
+			endpointUnlock(_self, endpoint);
+		}
+
+		if (isRead && ret > 0)
+			layoutVector(buffers, numBuffers, packetSize, scratch.data,
+						 NULL, -1, (size_t) ret);
+	} else
+#endif /* PYUSB_USBFS */
+	{
+		if (!isRead) copyVector(buffers, numBuffers, scratch.data, (int) total, 1);
+
+		ret = syncTransfer(_self, PYUSB_TRANSFER_BULK, endpoint,
+						   scratch.data, (int) total, timeout);
+
+		if (isRead && ret > 0) copyVector(buffers, numBuffers, scratch.data, ret, -1);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+	} else {
+		result = PyInt_FromLong(ret);
+	}
+
+done:
+	for (i = 0; i < numBuffers; ++i) releaseBuffer(buffers + i);
+	releaseBuffer(&scratch);
+	PyMem_Free(segments);
+	PyMem_Free(buffers);
+	Py_DECREF(seq);
+
+	return result;
+}
+
+/*
+ * def bulkWritev(endpoint, buffers, timeout = 100)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkWritev(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	return bulkVector(self, args, kwds, "bulkWritev", 0);
+}
+
+/*
+ * def bulkReadv(endpoint, buffers, timeout = 100)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkReadv(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	return bulkVector(self, args, kwds, "bulkReadv", 1);
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptWrite(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint;
+	int timeout = DEFAULT_TIMEOUT;
+	PyUSB_Buffer data;
+	PyObject *bytes;
+	int ret;
+	PyObject *retObj;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	if (!PyArg_ParseTuple(args,
+						  "iO|i",
+						  &endpoint,
+						  &bytes,
+						  &timeout)) {
+		return NULL;
+	}
+
+	if (checkEndpoint(_self, endpoint & ~USB_ENDPOINT_IN) < 0) return NULL;
+
+	if (getBuffer(&_self->pool, bytes, &data) < 0) return NULL;
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"interruptWrite params:\n"
+			"\tendpoint: %d\n"
+			"\ttimeout: %d\n",
+			endpoint,
+			timeout);
+
+	fprintf(stderr, "interruptWrite buffer param:\n");
+	printBuffer(data.data, data.size);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = syncTransfer(_self, PYUSB_TRANSFER_INTERRUPT, endpoint & ~USB_ENDPOINT_IN,
+					   data.data, data.size, timeout);
+	Py_END_ALLOW_THREADS
+
+	releaseBuffer(&data);
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else {
+		retObj = PyInt_FromLong(ret);
+	}
+
+	return retObj;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptRead(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint;
+	int timeout = DEFAULT_TIMEOUT;
+	PyUSB_Buffer buffer;
+	int size;
+	PyObject *ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	if (!PyArg_ParseTuple(args,
+						 "ii|i",
+						 &endpoint,
+						 &size,
+						 &timeout)) {
+		return NULL;
+	}
+	
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"interruptRead params:\n"
+			"\tendpoint: %d\n"
+			"\tsize: %d\n"
+			"\ttimeout: %d\n",
+			endpoint,
+			size,
+			timeout);
+
+#endif /* DUMP_PARAMS */
+
+	if (checkEndpoint(_self, endpoint | USB_ENDPOINT_IN) < 0) return NULL;
+
+	if (newReadBuffer(&_self->pool, _self->resultFormat, size, &buffer) < 0)
+		return NULL;
+
+	Py_BEGIN_ALLOW_THREADS
+	size = syncTransfer(_self, PYUSB_TRANSFER_INTERRUPT, endpoint | USB_ENDPOINT_IN,
+						buffer.data, size, timeout);
+	Py_END_ALLOW_THREADS
+
+	if (size < 0) {
+		releaseBuffer(&buffer);
+		PyUSB_ErrnoError(size);
+		return NULL;
+	} else {
+		ret = buildResult(_self->resultFormat, &buffer, size);
+	}
+
+	return ret;
+}
+
+/*
+ * Common code of bulkReadInto and interruptReadInto
+ */
+PYUSB_STATIC PyObject *readInto(
+	Py_usb_DeviceHandle *self,
+	PyObject *args,
+	PyObject *kwds,
+	const char *name,
+	int type
+	)
+{
+	int endpoint;
+	int timeout = DEFAULT_TIMEOUT;
+	Py_ssize_t offset = 0;
+	int chunkSize = 0;
+	int depth = 4;
+	PyObject *obj;
+	PyUSB_Buffer buffer;
+	const char *format;
+	int ret;
+
+	static char *kwlist[] = {
+		"endpoint",
+		"buffer",
+		"timeout",
+		"offset",
+		NULL
+	};
+
+	/* bulk reads take chunkSize and depth too */
+	static char *bulkKwlist[] = {
+		"endpoint",
+		"buffer",
+		"timeout",
+		"offset",
+		"chunkSize",
+		"depth",
+		NULL
+	};
+
+#if (PY_VERSION_HEX >= 0x02050000)
+	format = type == PYUSB_TRANSFER_BULK ? "iO|inii" : "iO|in";
+#else
+	format = type == PYUSB_TRANSFER_BULK ? "iO|iiii" : "iO|ii";
+#endif /* PY_VERSION_HEX */
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 format,
+									 type == PYUSB_TRANSFER_BULK ? bulkKwlist : kwlist,
+									 &endpoint,
+									 &obj,
+									 &timeout,
+									 &offset,
+									 &chunkSize,
+									 &depth)) {
+		return NULL;
+	}
+
+	if (depth < 1) {
+		PyErr_SetString(PyExc_ValueError, "depth must be positive");
+		return NULL;
+	}
+
+	if (checkEndpoint(self, endpoint | USB_ENDPOINT_IN) < 0) return NULL;
+
+	if (getWritableBuffer(obj, offset, &buffer) < 0) return NULL;
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"%s params:\n"
+			"\tendpoint: %d\n"
+			"\tsize: %d\n"
+			"\ttimeout: %d\n",
+			name,
+			endpoint,
+			(int) buffer.size,
+			timeout);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+
+	if (type == PYUSB_TRANSFER_BULK) {
+		ret = chunkedTransfer(self, endpoint | USB_ENDPOINT_IN, buffer.data,
+							  (int) buffer.size, chunkSize, depth, timeout);
+	} else {
+		ret = syncTransfer(self, type, endpoint | USB_ENDPOINT_IN,
+						   buffer.data, (int) buffer.size, timeout);
+	}
+
+	Py_END_ALLOW_THREADS
+
+	releaseBuffer(&buffer);
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	return PyInt_FromLong(ret);
+}
+
+/*
+ * def bulkReadInto(endpoint, buffer, timeout = 100, offset = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkReadInto(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	return readInto((Py_usb_DeviceHandle *) self,
+					args,
+					kwds,
+					"bulkReadInto",
+					PYUSB_TRANSFER_BULK);
+}
+
+/*
+ * def interruptReadInto(endpoint, buffer, timeout = 100, offset = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptReadInto(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	return readInto((Py_usb_DeviceHandle *) self,
+					args,
+					kwds,
+					"interruptReadInto",
+					PYUSB_TRANSFER_INTERRUPT);
+}
+
+/*
+ * def controlReadInto(requestType, request, buffer, value = 0, index = 0, timeout = 100, offset = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_controlReadInto(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	int requestType;
+	int request;
+	int value = 0;
+	int index = 0;
+	int timeout = DEFAULT_TIMEOUT;
+	Py_ssize_t offset = 0;
+	PyObject *obj;
+	PyUSB_Buffer buffer;
+	int ret;
+
+	static char *kwlist[] = {
+		"requestType",
+		"request",
+		"buffer",
+		"value",
+		"index",
+		"timeout",
+		"offset",
+		NULL
+	};
+
+#if (PY_VERSION_HEX >= 0x02050000)
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iiO|iiin",
+									 kwlist,
+									 &requestType,
+									 &request,
+									 &obj,
+									 &value,
+									 &index,
+									 &timeout,
+									 &offset)) {
+		return NULL;
+	}
+#else
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iiO|iiii",
+									 kwlist,
+									 &requestType,
+									 &request,
+									 &obj,
+									 &value,
+									 &index,
+									 &timeout,
+									 &offset)) {
+		return NULL;
+	}
+#endif /* PY_VERSION_HEX */
+
+	if (getWritableBuffer(obj, offset, &buffer) < 0) return NULL;
+
+	/* wLength is 16 bits wide */
+	if (buffer.size > 0xffff) buffer.size = 0xffff;
+
+#if DUMP_PARAMS
+
+	fprintf(stderr, "controlReadInto params:\n"
+		   "\trequestType: %d\n"
+		   "\trequest: %d\n"
+		   "\tvalue: %d\n"
+		   "\tindex: %d\n"
+		   "\ttimeout: %d\n"
+		   "\tsize: %d\n",
+		   requestType,
+		   request,
+		   value,
+		   index,
+		   timeout,
+		   (int) buffer.size);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	ret = controlTransfer(_self,
+						  requestType | USB_ENDPOINT_IN,
+						  request,
+						  value,
+						  index,
+						  buffer.data,
+						  (int) buffer.size,
+						  timeout);
+	Py_END_ALLOW_THREADS
+
+	releaseBuffer(&buffer);
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	return PyInt_FromLong(ret);
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_resetEndpoint(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint, ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	endpoint = py_NumberAsInt(args);
+	if (PyErr_Occurred()) return NULL;
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"resetEndpoint params:\n"
+			"\tendpoint: %d\n",
+			endpoint);
+
+#endif /* DUMP_PARAMS */
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+	ret = usb_resetep(_self->deviceHandle, endpoint);
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else {
+		Py_RETURN_NONE;
+	}
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_reset(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int ret;
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock((Py_usb_DeviceHandle *) self, 0);
+	ret = usb_reset(((Py_usb_DeviceHandle *) self)->deviceHandle);
+	endpointUnlock((Py_usb_DeviceHandle *) self, 0);
+	Py_END_ALLOW_THREADS
+
+	/* the device may come back with a different firmware */
+	cacheClear(((Py_usb_DeviceHandle *) self)->device);
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else {
+		Py_RETURN_NONE;
+	}
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_clearHalt(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint, ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	endpoint = py_NumberAsInt(args);
+	if (PyErr_Occurred()) return NULL;
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"clearHalt params:\n"
+			"\tendpoint: %d\n",
+			endpoint);
+
+#endif /* DUMP_PARAMS */
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+	ret = usb_clear_halt(_self->deviceHandle, endpoint);
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	} else {
+		Py_RETURN_NONE;
+	}
+}
+
+/*
+ * def configurePool(highWater = -1, pageAligned = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_configurePool(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	long highWater = -1;
+	int pageAligned = -1;
+	PyUSB_Pool *pool = &((Py_usb_DeviceHandle *) self)->pool;
+
+	static char *kwlist[] = {
+		"highWater",
+		"pageAligned",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "|li",
+									 kwlist,
+									 &highWater,
+									 &pageAligned)) {
+		return NULL;
+	}
+
+	if (-1 != pageAligned && !pageAligned != !pool->pageAligned) {
+		/* the cached blocks have the wrong alignment */
+		poolTrim(pool, 0);
+		pool->pageAligned = pageAligned != 0;
+	}
+
+	if (highWater >= 0) {
+		pool->highWater = (unsigned long) highWater;
+		poolTrim(pool, pool->highWater);
+	}
+
+	Py_RETURN_NONE;
+}
+
+/*
+ * def lockStats()
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_lockStats(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	PyObject *stats = PyDict_New();
+#if PYUSB_THREADS
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyUSB_EndpointLock *lock;
+	PyObject *key, *value;
+	int endpoint;
+	int i;
+
+	if (!stats) return NULL;
+
+	for (i = 0; i < PYUSB_ENDPOINTS; ++i) {
+		lock = &_self->locks[i];
+
+		/* a snapshot, the counters may be changing */
+		if (!lock->acquired) continue;
+
+		endpoint = i & 0x0f;
+		if (i & 0x10) endpoint |= USB_ENDPOINT_IN;
+
+		key = PyInt_FromLong(endpoint);
+		value = Py_BuildValue("(kk)", lock->acquired, lock->contended);
+
+		if (!key || !value || PyDict_SetItem(stats, key, value) < 0) {
+			Py_XDECREF(key);
+			Py_XDECREF(value);
+			Py_DECREF(stats);
+			return NULL;
+		}
+
+		Py_DECREF(key);
+		Py_DECREF(value);
+	}
+#endif /* PYUSB_THREADS */
+
+	return stats;
+}
+
+/*
+ * def getString(index, len, langid = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_getString(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int langid=-1, index;
+	unsigned long len;
+	PyObject *retStr;
+	PyObject *key = NULL;
+	PyObject *cached;
+	PyUSB_Buffer buffer;
+	int ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	Py_usb_Device *device = _self->device;
+
+	if (!PyArg_ParseTuple(args,
+						 "ik|i",
+						 &index,
+						 &len,
+						 &langid)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"getString params:\n"
+			"\tindex: %d\n"
+			"\tlen: %lu\n"
+			"\tlangid: %d\n",
+			index,
+			len,
+			langid);
+
+#endif /* DUMP_PARAMS */
+
+	if (device->cache) {
+		key = Py_BuildValue("(sii)", "string", index, langid);
+		if (!key) return NULL;
+
+		cached = cacheLookup(device, key, (long) len);
+
+		if (cached) {
+			Py_DECREF(key);
+			return PyString_FromStringAndSize(PyString_AS_STRING(cached),
+					PyString_GET_SIZE(cached) < (Py_ssize_t) len ?
+					PyString_GET_SIZE(cached) : (Py_ssize_t) len);
+		}
+	}
+
+	++len;	/* for NULL termination */
+	if (newScratchBuffer(&_self->pool, len, &buffer) < 0) {
+		Py_XDECREF(key);
+		return NULL;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+
+	if (-1 == langid) {
+		ret = usb_get_string_simple(_self->deviceHandle, index, buffer.data, len);
+	} else {
+		ret = usb_get_string(_self->deviceHandle, index, langid, buffer.data, len);
+	}
+
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		Py_XDECREF(key);
+		releaseBuffer(&buffer);
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	cacheStore(device, key, (long) len - 1, buffer.data, ret);
+	Py_XDECREF(key);
+
+	retStr = PyString_FromStringAndSize(buffer.data, ret);
+	releaseBuffer(&buffer);
+	return retStr;
+}
+
+/*
+ * def getDescriptor(type, index, len, endpoint = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_getDescriptor(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint=-1, type, index;
+	int len;
+	PyObject *key = NULL;
+	PyObject *cached = NULL;
+	PyUSB_Buffer buffer;
+	int ret;
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	Py_usb_Device *device = _self->device;
+
+	if (!PyArg_ParseTuple(args,
+						 "iii|i",
+						 &type,
+						 &index,
+						 &len,
+						 &endpoint)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"getDescriptor params:\n"
+			"ttype: %d\n"
+			"\tindex: %d\n"
+			"\tlen: %d\n"
+			"\tendpoint: %d\n",
+			type,
+			index,
+			len,
+			endpoint);
+
+#endif /* DUMP_PARAMS */
+
+	if (device->cache && -1 == endpoint && cacheableDescriptor(type)) {
+		key = Py_BuildValue("(sii)", "descriptor", type, index);
+		if (!key) return NULL;
+
+		cached = cacheLookup(device, key, len);
+	}
+
+	if (newReadBuffer(&_self->pool, _self->resultFormat, len, &buffer) < 0) {
+		Py_XDECREF(key);
+		return NULL;
+	}
+
+	if (cached) {
+		ret = PyString_GET_SIZE(cached) < len ? PyString_GET_SIZE(cached) : len;
+		memcpy(buffer.data, PyString_AS_STRING(cached), ret);
+		Py_DECREF(key);
+		return buildResult(_self->resultFormat, &buffer, ret);
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	endpointLock(_self, 0);
+
+	if (-1 == endpoint) {
+		ret = usb_get_descriptor(_self->deviceHandle, type, index, buffer.data, len);
+	} else {
+		ret = usb_get_descriptor_by_endpoint(_self->deviceHandle, endpoint, type, index, buffer.data, len);
+	}
+
+	endpointUnlock(_self, 0);
+	Py_END_ALLOW_THREADS
+
+	if (ret < 0) {
+		Py_XDECREF(key);
+		releaseBuffer(&buffer);
+		PyUSB_ErrnoError(ret);
+		return NULL;
+	}
+
+	cacheStore(device, key, len, buffer.data, ret);
+	Py_XDECREF(key);
+
+	return buildResult(_self->resultFormat, &buffer, ret);
+}
+
+/*
+ * Batch execution
+ */
+
+#ifndef ECANCELED
+#define ECANCELED 125
+#endif /* ECANCELED */
+
+/*
+ * Fills op from a tuple of execute, taking its buffer.
+ * Returns 0 or -1 with an exception set.
+ */
+PYUSB_STATIC int parseOp(
+	Py_usb_DeviceHandle *self,
+	PyObject *item,
+	PyUSB_Op *op
+	)
+{
+	PyObject *tuple;
+	PyObject *data;
+	int type;
+	int ret = -1;
+
+	memset(op, 0, sizeof(*op));
+	op->timeout = DEFAULT_TIMEOUT;
+
+	tuple = PySequence_Tuple(item);
+	if (!tuple) return -1;
+
+	if (!PyTuple_GET_SIZE(tuple)) {
+		PyErr_SetString(PyExc_ValueError, "Empty operation");
+		goto done;
+	}
+
+	type = py_NumberAsInt(PyTuple_GET_ITEM(tuple, 0));
+	if (PyErr_Occurred()) goto done;
+
+	switch (type) {
+	case USB_ENDPOINT_TYPE_CONTROL:
+		op->type = PYUSB_TRANSFER_CONTROL;
+		if (!PyArg_ParseTuple(tuple, "iiiiiO|i:execute", &type, &op->requestType,
+							  &op->request, &op->value, &op->index,
+							  &data, &op->timeout)) {
+			goto done;
+		}
+		break;
+
+	case USB_ENDPOINT_TYPE_BULK:
+	case USB_ENDPOINT_TYPE_INTERRUPT:
+		op->type = type == USB_ENDPOINT_TYPE_BULK ?
+				   PYUSB_TRANSFER_BULK : PYUSB_TRANSFER_INTERRUPT;
+		if (!PyArg_ParseTuple(tuple, "iiO|i:execute", &type, &op->endpoint,
+							  &data, &op->timeout)) {
+			goto done;
+		}
+		break;
+
+	default:
+		PyErr_SetString(PyExc_ValueError, "Unsupported operation type");
+		goto done;
+	}
+
+	if (op->type != PYUSB_TRANSFER_CONTROL &&
+		checkEndpoint(self, PyNumber_Check(data) ?
+					  op->endpoint | USB_ENDPOINT_IN :
+					  op->endpoint & ~USB_ENDPOINT_IN) < 0) {
+		goto done;
+	}
+
+	/* as in controlMsg, a number is the size of a read */
+	if (PyNumber_Check(data)) {
+		int size = py_NumberAsInt(data);
+		if (PyErr_Occurred()) goto done;
+		if (newReadBuffer(&self->pool, self->resultFormat, size, &op->buffer) < 0)
+			goto done;
+		op->isRead = 1;
+		op->endpoint |= USB_ENDPOINT_IN;
+	} else {
+		if (getBuffer(&self->pool, data, &op->buffer) < 0) goto done;
+		op->endpoint &= ~USB_ENDPOINT_IN;
+	}
+
+	/* wLength is 16 bits wide */
+	if (op->type == PYUSB_TRANSFER_CONTROL && op->buffer.size > 0xffff) {
+		releaseBuffer(&op->buffer);
+		PyErr_SetString(PyExc_ValueError, "Control transfer too big");
+		goto done;
+	}
+
+	ret = 0;
+
+done:
+	Py_DECREF(tuple);
+	return ret;
+}
+
+/*
+ * Runs the operations in order. Must be called without the GIL.
+ */
+PYUSB_STATIC void runOps(
+	Py_usb_DeviceHandle *self,
+	PyUSB_Op *ops,
+	int numOps,
+	int stopOnError
+	)
+{
+	int failed = 0;
+	int i;
+
+	for (i = 0; i < numOps; ++i) {
+		PyUSB_Op *op = ops + i;
+
+		if (failed && stopOnError) {
+			op->status = -ECANCELED;
+			continue;
+		}
+
+		if (op->type == PYUSB_TRANSFER_CONTROL) {
+			op->status = controlTransfer(self,
+										 op->requestType,
+										 op->request,
+										 op->value,
+										 op->index,
+										 op->buffer.data,
+										 (int) op->buffer.size,
+										 op->timeout);
+		} else {
+			op->status = syncTransfer(self,
+									  op->type,
+									  op->endpoint,
+									  op->buffer.data,
+									  (int) op->buffer.size,
+									  op->timeout);
+		}
+
+		if (op->status < 0) failed = 1;
+	}
+}
+
+/*
+ * def execute(ops, stopOnError = True)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_execute(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	PyObject *list;
+	PyObject *seq;
+	PyObject *status = NULL;
+	PyObject *data = NULL;
+	PyObject *result = NULL;
+	PyUSB_Op *ops = NULL;
+	int stopOnError = 1;
+	int numOps = 0;
+	int *st;
+	Py_ssize_t n;
+	int i;
+	static char *kwlist[] = {
+		"ops",
+		"stopOnError",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "O|i",
+									 kwlist,
+									 &list,
+									 &stopOnError)) {
+		return NULL;
+	}
+
+	seq = PySequence_Fast(list, "ops must be a sequence");
+	if (!seq) return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+
+	if (n > INT_MAX / (Py_ssize_t) sizeof(PyUSB_Op)) {
+		PyErr_SetString(PyExc_ValueError, "Too many operations");
+		goto done;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"execute params:\n"
+			"\tops: %d\n"
+			"\tstopOnError: %d\n",
+			(int) n,
+			stopOnError);
+
+#endif /* DUMP_PARAMS */
+
+	ops = (PyUSB_Op *) PyMem_Malloc((n ? n : 1) * sizeof(PyUSB_Op));
+
+	if (!ops) {
+		PyErr_NoMemory();
+		goto done;
+	}
+
+	for (; numOps < n; ++numOps) {
+		if (parseOp(_self, PySequence_Fast_GET_ITEM(seq, numOps), ops + numOps) < 0)
+			goto done;
+	}
+
+	Py_BEGIN_ALLOW_THREADS
+	runOps(_self, ops, numOps, stopOnError);
+	Py_END_ALLOW_THREADS
+
+	status = newArray(&intArrayTemplate, "i", numOps, (void **) &st);
+	if (!status) goto done;
+
+	data = PyTuple_New(numOps);
+	if (!data) goto done;
+
+	for (i = 0; i < numOps; ++i) {
+		PyObject *item = Py_None;
+
+		st[i] = ops[i].status;
+
+		if (ops[i].isRead && ops[i].status >= 0) {
+			item = buildResult(_self->resultFormat, &ops[i].buffer, ops[i].status);
+			memset(&ops[i].buffer, 0, sizeof(ops[i].buffer));
+			if (!item) goto done;
+		} else {
+			Py_INCREF(item);
+		}
+
+		PyTuple_SET_ITEM(data, i, item);
+	}
+
+	result = Py_BuildValue("(OO)", status, data);
+
+done:
+	for (i = 0; i < numOps; ++i) releaseBuffer(&ops[i].buffer);
+	PyMem_Free(ops);
+	Py_XDECREF(status);
+	Py_XDECREF(data);
+	Py_DECREF(seq);
+
+	return result;
+}
+
+/*
+ * def fileno()
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_fileno(
+	PyObject *self,
+	PyObject *args
+	)
+{
+#if PYUSB_USBFS
+	int fd = ((Py_usb_DeviceHandle *) self)->engine.fd;
+
+	if (fd >= 0) return PyInt_FromLong(fd);
+#endif /* PYUSB_USBFS */
+
+	PyErr_SetString(PyExc_USBError, "No pollable descriptor for this device");
+	return NULL;
+}
+
+/*
+ * def reap()
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_reap(
+	PyObject *self,
+	PyObject *args
+	)
+{
+#if PYUSB_USBFS
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+
+	if (_self->engine.fd >= 0) {
+		Py_BEGIN_ALLOW_THREADS
+		engineWait(&_self->engine, NULL, 0);
+		Py_END_ALLOW_THREADS
+
+		return PyInt_FromLong(engineSweep(&_self->engine));
+	}
+#endif /* PYUSB_USBFS */
+
+	return PyInt_FromLong(0);
+}
+
+/*
+ * def submitBulkRead(endpoint, size|buffer, timeout = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitBulkRead(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint;
+	int timeout = 0;
+	PyObject *data;
+
+	if (!PyArg_ParseTuple(args, "iO|i", &endpoint, &data, &timeout)) return NULL;
+
+	return submitTransfer((Py_usb_DeviceHandle *) self, PYUSB_TRANSFER_BULK,
+						  endpoint | USB_ENDPOINT_IN, data, 0, 0, 0, 0, timeout);
+}
+
+/*
+ * def submitBulkWrite(endpoint, buffer, timeout = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitBulkWrite(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint;
+	int timeout = 0;
+	PyObject *data;
+
+	if (!PyArg_ParseTuple(args, "iO|i", &endpoint, &data, &timeout)) return NULL;
+
+	return submitTransfer((Py_usb_DeviceHandle *) self, PYUSB_TRANSFER_BULK,
+						  endpoint & ~USB_ENDPOINT_IN, data, 0, 0, 0, 0, timeout);
+}
+
+/*
+ * def submitInterruptRead(endpoint, size|buffer, timeout = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitInterruptRead(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint;
+	int timeout = 0;
+	PyObject *data;
+
+	if (!PyArg_ParseTuple(args, "iO|i", &endpoint, &data, &timeout)) return NULL;
+
+	return submitTransfer((Py_usb_DeviceHandle *) self, PYUSB_TRANSFER_INTERRUPT,
+						  endpoint | USB_ENDPOINT_IN, data, 0, 0, 0, 0, timeout);
+}
+
+/*
+ * def submitInterruptWrite(endpoint, buffer, timeout = 0)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitInterruptWrite(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int endpoint;
+	int timeout = 0;
+	PyObject *data;
+
+	if (!PyArg_ParseTuple(args, "iO|i", &endpoint, &data, &timeout)) return NULL;
+
+	return submitTransfer((Py_usb_DeviceHandle *) self, PYUSB_TRANSFER_INTERRUPT,
+						  endpoint & ~USB_ENDPOINT_IN, data, 0, 0, 0, 0, timeout);
+}
+
+/*
+ * def submitControlMsg(requestType, request, buffer, value = 0, index = 0, timeout = 100)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitControlMsg(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	int requestType;
+	int request;
+	int value = 0;
+	int index = 0;
+	int timeout = DEFAULT_TIMEOUT;
+	PyObject *data;
+	static char *kwlist[] = {
+		"requestType",
+		"request",
+		"buffer",
+		"value",
+		"index",
+		"timeout",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iiO|iii",
+									 kwlist,
+									 &requestType,
+									 &request,
+									 &data,
+									 &value,
+									 &index,
+									 &timeout)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"submitControlMsg params:\n"
+			"\trequestType: %d\n"
+			"\trequest: %d\n"
+			"\tvalue: %d\n"
+			"\tindex: %d\n"
+			"\ttimeout: %d\n",
+			requestType,
+			request,
+			value,
+			index,
+			timeout);
+
+#endif /* DUMP_PARAMS */
+
+	return submitTransfer((Py_usb_DeviceHandle *) self, PYUSB_TRANSFER_CONTROL,
+						  0, data, requestType, request, value, index, timeout);
+}
+
+/*
+ * def submitIsoRead(endpoint, packets, packetSize = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitIsoRead(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	int endpoint;
+	int packets;
+	int packetSize = -1;
+	static char *kwlist[] = {
+		"endpoint",
+		"packets",
+		"packetSize",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "ii|i",
+									 kwlist,
+									 &endpoint,
+									 &packets,
+									 &packetSize)) {
+		return NULL;
+	}
+
+	endpoint |= USB_ENDPOINT_IN;
+
+	if (packetSize < 0)
+		packetSize = endpointPacketSize((Py_usb_DeviceHandle *) self, endpoint);
+
+	if (packets <= 0 || (packetSize > 0 && packets > INT_MAX / packetSize)) {
+		PyErr_SetString(PyExc_ValueError, "Invalid number of packets");
+		return NULL;
+	}
+
+	return submitIsoTransfer((Py_usb_DeviceHandle *) self, endpoint, NULL,
+							 packets * packetSize, packetSize);
+}
+
+/*
+ * def submitIsoWrite(endpoint, buffer, packetSize = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitIsoWrite(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	int endpoint;
+	int packetSize = -1;
+	PyObject *data;
+	static char *kwlist[] = {
+		"endpoint",
+		"buffer",
+		"packetSize",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "iO|i",
+									 kwlist,
+									 &endpoint,
+									 &data,
+									 &packetSize)) {
+		return NULL;
+	}
+
+	return submitIsoTransfer((Py_usb_DeviceHandle *) self, endpoint & ~USB_ENDPOINT_IN,
+							 data, 0, packetSize);
+}
+
+#if PYUSB_THREADS
+/*
+ * def streamReader(endpoint, transferSize = 16384, depth = 4, bufferSize = 1048576)
+ */
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_streamReader(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	int endpoint;
+	int transferSize = PYUSB_URB_SIZE;
+	int depth = 4;
+	long bufferSize = 1024 * 1024;
+	static char *kwlist[] = {
+		"endpoint",
+		"transferSize",
+		"depth",
+		"bufferSize",
+		NULL
+	};
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "i|iil",
+									 kwlist,
+									 &endpoint,
+									 &transferSize,
+									 &depth,
+									 &bufferSize)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"streamReader params:\n"
+			"\tendpoint: %d\n"
+			"\ttransferSize: %d\n"
+			"\tdepth: %d\n"
+			"\tbufferSize: %ld\n",
+			endpoint,
+			transferSize,
+			depth,
+			bufferSize);
+
+#endif /* DUMP_PARAMS */
+
+	if (transferSize <= 0 || depth <= 0 || depth > INT_MAX / transferSize) {
+		PyErr_SetString(PyExc_ValueError, "Invalid transferSize or depth");
+		return NULL;
+	}
+
+	if (bufferSize < transferSize || bufferSize > LONG_MAX / 2) {
+		PyErr_SetString(PyExc_ValueError, "Invalid bufferSize");
+		return NULL;
+	}
+
+	if (checkEndpoint((Py_usb_DeviceHandle *) self, endpoint | USB_ENDPOINT_IN) < 0)
+		return NULL;
+
+	return (PyObject *) new_StreamReader((Py_usb_DeviceHandle *) self,
+										 endpoint | USB_ENDPOINT_IN,
+										 transferSize,
+										 depth,
+										 (size_t) bufferSize);
+}
+#endif /* PYUSB_THREADS */
+
 PYUSB_STATIC PyMethodDef Py_usb_DeviceHandle_Methods[] = {
 	{"controlMsg",
 	 (PyCFunction) Py_usb_DeviceHandle_controlMsg,
 	 METH_VARARGS | METH_KEYWORDS,
-	 "controlMsg(requestType, request, buffer, value=0, index=0, timeout=100) -> bytesWritten|buffer\n\n"
-	 "Performs a control request to the default control pipe on a device.\n"
+	 "controlMsg(requestType, request, buffer, value=0, index=0, timeout=100) -> bytesWritten|buffer\n\n"
+	 "Performs a control request to the default control pipe on a device.\n"
+	 "Arguments:\n"
+	 "\trequestType: specifies the direction of data flow, the type\n"
+	 "\t             of request, and the recipient.\n"
+	 "\trequest: specifies the request.\n"
+	 "\tbuffer: if the transfer is a write transfer, buffer is a sequence \n"
+	 "\t        with the transfer data, otherwise, buffer is the number of\n"
+	 "\t        bytes to read.\n"
+	 "\tvalue: specific information to pass to the device. (default: 0)\n"
+	 "\tindex: specific information to pass to the device. (default: 0)\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "Returns the number of bytes written, or the data read, by default\n"
+	 "as a tuple (see resultFormat)."},
+
+	{"controlReadInto",
+	 (PyCFunction) Py_usb_DeviceHandle_controlReadInto,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "controlReadInto(requestType, request, buffer, value=0, index=0, timeout=100, offset=0) -> bytesRead\n\n"
+	 "Performs a control read request to the default control pipe on a\n"
+	 "device, storing the data directly in buffer.\n"
+	 "Arguments:\n"
+	 "\trequestType: specifies the type of request and the recipient.\n"
+	 "\t             The ENDPOINT_IN direction bit is always set.\n"
+	 "\trequest: specifies the request.\n"
+	 "\tbuffer: a writable object supporting the buffer protocol. The\n"
+	 "\t        read size is the buffer length minus offset.\n"
+	 "\tvalue: specific information to pass to the device. (default: 0)\n"
+	 "\tindex: specific information to pass to the device. (default: 0)\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "\toffset: position in buffer where the data is stored. (default: 0)\n"
+	 "Returns the number of bytes read."},
+
+	{"setConfiguration",
+	 Py_usb_DeviceHandle_setConfiguration,
+ 	 METH_O,
+	 "setConfiguration(configuration) -> None\n\n"
+	 "Sets the active configuration of a device.\n"
+	 "Arguments:\n"
+	 "\tconfiguration: a configuration value or a Configuration object."},	 
+
+	{"claimInterface",
+	 Py_usb_DeviceHandle_claimInterface,
+	 METH_O,
+	 "claimInterface(interface) -> None\n\n"
+	 "Claims the interface with the Operating System. Several\n"
+	 "interfaces can be claimed through the same handle; once the\n"
+	 "endpoints of the claimed interfaces are known, bulk, interrupt\n"
+	 "and isochronous transfers on other endpoints raise ValueError.\n"
+	 "Arguments:\n"
+	 "\tinterface: interface number or an Interface object."},
+	
+	{"detachKernelDriver",
+	 Py_usb_DeviceHandle_detachKernelDriver,
+	 METH_O,
+	 "detachKernelDriver(interface) -> None\n\n"
+	 "Detaches a kernel driver from the interface (if one is attached,\n"
+	 "we have permission and the operation is supported by the OS)\n"
+	 "Arguments:\n"
+	 "\tinterface: interface number or an Interface object."},
+
+	{"releaseInterface",
+	 Py_usb_DeviceHandle_releaseInterface,
+	 METH_VARARGS,
+	 "releaseInterface(interface=None) -> None\n\n"
+	 "Releases an interface previously claimed with claimInterface.\n"
+	 "Arguments:\n"
+	 "\tinterface: interface number or an Interface object. If None,\n"
+	 "\t           all the claimed interfaces are released.\n"
+	 "The interfaces still claimed are released when the handle is\n"
+	 "destroyed."},
+	
+	{"setAltInterface",
+	 Py_usb_DeviceHandle_setAltInterface,
+	 METH_O,
+	 "setAltInterface(alternate) -> None\n\n"
+	 "Sets the active alternate setting of the current interface, the\n"
+	 "one claimed last.\n"
+	 "Arguments:\n"
+	 "\talternate: an alternate setting number or an Interface object.\n"
+	 "\t           An Interface object selects its claimed interface."},
+
+	{"bulkWrite",
+	 (PyCFunction) Py_usb_DeviceHandle_bulkWrite,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "bulkWrite(endpoint, buffer, timeout=100, chunkSize=0, depth=4) -> bytesWritten\n\n"
+	 "Performs a bulk write request to the endpoint specified.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: sequence data buffer to write.\n"
+	 "\t      This parameter can be any sequence type. Objects\n"
+	 "\t      supporting the buffer protocol (str, bytearray,\n"
+	 "\t      array('B'), mmap...) are written without any copy.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "\tchunkSize: if positive, the transfer is split in chunks of\n"
+	 "\t           this size, rounded down to whole packets. With\n"
+	 "\t           asynchronous support, depth chunks are queued at\n"
+	 "\t           once, and timeout applies to the whole transfer.\n"
+	 "\t           (default: 0, a single transfer)\n"
+	 "\tdepth: number of chunks queued at once. (default: 4)\n"
+	 "Returns the number of bytes written."},
+
+	{"bulkRead",
+	 (PyCFunction) Py_usb_DeviceHandle_bulkRead,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "bulkRead(endpoint, size, timeout=100, chunkSize=0, depth=4) -> buffer\n\n"
+	 "Performs a bulk read request to the endpoint specified.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tsize: number of bytes to read.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "\tchunkSize: if positive, the transfer is split in chunks of\n"
+	 "\t           this size, rounded down to whole packets. With\n"
+	 "\t           asynchronous support, depth chunks are queued at\n"
+	 "\t           once, and timeout applies to the whole transfer.\n"
+	 "\t           (default: 0, a single transfer)\n"
+	 "\tdepth: number of chunks queued at once. (default: 4)\n"
+	 "Returns the data read, by default as a tuple (see resultFormat)."},
+
+	{"bulkReadInto",
+	 (PyCFunction) Py_usb_DeviceHandle_bulkReadInto,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "bulkReadInto(endpoint, buffer, timeout=100, offset=0, chunkSize=0, depth=4) -> bytesRead\n\n"
+	 "Performs a bulk read request to the endpoint specified, storing\n"
+	 "the data directly in buffer, without any intermediate copy.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: a writable object supporting the buffer protocol\n"
+	 "\t        (bytearray, array, mmap, memoryview...). The read size\n"
+	 "\t        is the buffer length minus offset.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "\toffset: position in buffer where the data is stored. (default: 0)\n"
+	 "\tchunkSize: if positive, the transfer is split in chunks of\n"
+	 "\t           this size, rounded down to whole packets. With\n"
+	 "\t           asynchronous support, depth chunks are queued at\n"
+	 "\t           once, and timeout applies to the whole transfer.\n"
+	 "\t           (default: 0, a single transfer)\n"
+	 "\tdepth: number of chunks queued at once. (default: 4)\n"
+	 "Returns the number of bytes read."},
+
+	{"bulkWritev",
+	 (PyCFunction) Py_usb_DeviceHandle_bulkWritev,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "bulkWritev(endpoint, buffers, timeout=100) -> bytesWritten\n\n"
+	 "Writes a list of buffers to the endpoint specified as a single\n"
+	 "bulk transfer, as if they were concatenated. With asynchronous\n"
+	 "support, the buffers are queued in place and only the bytes\n"
+	 "of packets crossing two buffers are copied.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffers: sequence of data buffers, as accepted by bulkWrite.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "Returns the number of bytes written."},
+
+	{"bulkReadv",
+	 (PyCFunction) Py_usb_DeviceHandle_bulkReadv,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "bulkReadv(endpoint, buffers, timeout=100) -> bytesRead\n\n"
+	 "Performs a single bulk read from the endpoint specified,\n"
+	 "filling the buffers one after the other.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffers: sequence of writable objects supporting the buffer\n"
+	 "\t         protocol (bytearray, array, mmap, memoryview...).\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "Returns the total number of bytes read."},
+
+	{"interruptWrite",
+	 Py_usb_DeviceHandle_interruptWrite,
+	 METH_VARARGS,
+	 "interruptWrite(endpoint, buffer, timeout=100) -> bytesWritten\n\n"
+	 "Performs a interrupt write request to the endpoint specified.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: sequence data buffer to write.\n"
+	 "\t      This parameter can be any sequence type. Objects\n"
+	 "\t      supporting the buffer protocol (str, bytearray,\n"
+	 "\t      array('B'), mmap...) are written without any copy.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "Returns the number of bytes written."},
+
+	{"interruptRead",
+	 Py_usb_DeviceHandle_interruptRead,
+	 METH_VARARGS,
+	 "interruptRead(endpoint, size, timeout=100) -> buffer\n\n"
+	 "Performs a interrupt read request to the endpoint specified.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tsize: number of bytes to read.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "Returns the data read, by default as a tuple (see resultFormat)."},
+
+	{"interruptReadInto",
+	 (PyCFunction) Py_usb_DeviceHandle_interruptReadInto,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "interruptReadInto(endpoint, buffer, timeout=100, offset=0) -> bytesRead\n\n"
+	 "Performs a interrupt read request to the endpoint specified, storing\n"
+	 "the data directly in buffer, without any intermediate copy.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: a writable object supporting the buffer protocol\n"
+	 "\t        (bytearray, array, mmap, memoryview...). The read size\n"
+	 "\t        is the buffer length minus offset.\n"
+	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
+	 "\toffset: position in buffer where the data is stored. (default: 0)\n"
+	 "Returns the number of bytes read."},
+
+	{"resetEndpoint",
+	 Py_usb_DeviceHandle_resetEndpoint,
+	 METH_O,
+	 "resetEndpoint(endpoint) -> None\n\n"
+	 "Resets all state (like toggles) for the specified endpoint.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"},
+
+	{"reset",
+	 Py_usb_DeviceHandle_reset,
+	 METH_NOARGS,
+	 "reset() -> None\n\n"
+	 "Resets the specified device by sending a RESET\n"
+	 "down the port it is connected to.\n"},
+
+	{"clearHalt",
+	 Py_usb_DeviceHandle_clearHalt,
+	 METH_O,
+	 "clearHalt(endpoint) -> None\n\n"
+	 "Clears any halt status on the specified endpoint.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"},
+
+	{"configurePool",
+	 (PyCFunction) Py_usb_DeviceHandle_configurePool,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "configurePool(highWater=-1, pageAligned=-1) -> None\n\n"
+	 "Configures the pool of transfer buffers of the handle. Buffers\n"
+	 "freed after a transfer are kept in the pool and reused by the\n"
+	 "following transfers, so no memory is allocated in steady state.\n"
+	 "Arguments:\n"
+	 "\thighWater: maximum number of bytes kept in the pool. Zero\n"
+	 "\t           disables the pool. (default: unchanged, initially 1 MB)\n"
+	 "\tpageAligned: if true, buffers are aligned to page boundaries.\n"
+	 "\t             (default: unchanged, initially False)\n"
+	 "The poolHits, poolMisses and poolBytesHeld attributes show how\n"
+	 "the pool is performing."},
+
+	{"lockStats",
+	 Py_usb_DeviceHandle_lockStats,
+	 METH_NOARGS,
+	 "lockStats() -> dict\n\n"
+	 "Synchronous transfers on the same endpoint are serialized, while\n"
+	 "different endpoints of the handle can transfer at the same time.\n"
+	 "Control transfers and requests changing the state of the handle\n"
+	 "share the lock of endpoint 0. Returns a dictionary mapping the\n"
+	 "address of each endpoint used so far to a tuple\n"
+	 "(acquisitions, contended), contended being the number of times\n"
+	 "a thread had to wait for the endpoint. Empty if the module was\n"
+	 "built without native threads."},
+
+	{"getString",
+	 Py_usb_DeviceHandle_getString,
+	 METH_VARARGS,
+	 "getString(index, len, langid = -1) -> string\n\n"
+	 "Retrieves the string descriptor specified by index\n"
+	 "and langid from a device.\n"
+	 "Arguments:\n"
+	 "\tindex: index of descriptor in the device.\n"
+	 "\tlen: number of bytes of the string\n"
+	 "\tlangid: Language ID. If it is omittedi, will be\n"
+	 "\t        used the first language.\n"},
+
+	{"getDescriptor",
+	 Py_usb_DeviceHandle_getDescriptor,
+	 METH_VARARGS,
+	 "getDescriptor(type, index, len, endpoint = -1) -> descriptor\n\n"
+	 "Retrieves a descriptor from the device identified by the type\n"
+	 "and index of the descriptor.\n"
+	 "Arguments:\n"
+	 "\ttype: descriptor type.\n"
+	 "\tindex: index of the descriptor.\n"
+	 "\tlen: descriptor length.\n"
+	 "\tendpoint: endpoint number from descriptor is read. If it is\n"
+	 "\t          omitted, the descriptor is read from default control pipe.\n"
+	 "Returns the descriptor data, by default as a tuple (see resultFormat).\n"},
+
+	{"execute",
+	 (PyCFunction) Py_usb_DeviceHandle_execute,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "execute(ops, stopOnError=True) -> (status, data)\n\n"
+	 "Runs a sequence of transfers in a single call, releasing the\n"
+	 "GIL once for all of them.\n"
+	 "Arguments:\n"
+	 "\tops: sequence of operations, each one a tuple:\n"
+	 "\t     (ENDPOINT_TYPE_CONTROL, requestType, request, value,\n"
+	 "\t      index, buffer[, timeout])\n"
+	 "\t     (ENDPOINT_TYPE_BULK, endpoint, buffer[, timeout])\n"
+	 "\t     (ENDPOINT_TYPE_INTERRUPT, endpoint, buffer[, timeout])\n"
+	 "\t     As in controlMsg, buffer is the number of bytes to read\n"
+	 "\t     for reads, or the data to write. The timeout defaults\n"
+	 "\t     to 100 miliseconds.\n"
+	 "\tstopOnError: if True, the operations after a failed one are\n"
+	 "\t             not run. (default: True)\n"
+	 "Returns status, an array('i') with the number of bytes\n"
+	 "transferred or a negative errno for every operation (-ECANCELED\n"
+	 "for the ones not run), and data, a tuple with the data read by\n"
+	 "every successful read (see resultFormat) and None elsewhere.\n"
+	 "Transfer errors do not raise exceptions."},
+
+	{"fileno",
+	 Py_usb_DeviceHandle_fileno,
+	 METH_NOARGS,
+	 "fileno() -> fd\n\n"
+	 "Returns the usbfs file descriptor of the handle. It polls as\n"
+	 "writable when submitted transfers have completed; they are\n"
+	 "then reaped by usb.poll or the Transfer methods. Raises\n"
+	 "USBError if the platform has no such descriptor."},
+
+	{"reap",
+	 Py_usb_DeviceHandle_reap,
+	 METH_NOARGS,
+	 "reap() -> count\n\n"
+	 "Collects the completed transfers without waiting and runs\n"
+	 "their done callbacks. Meant to be called when fileno() polls\n"
+	 "as writable. Returns the number of transfers completed.\n"},
+
+	{"submitBulkRead",
+	 Py_usb_DeviceHandle_submitBulkRead,
+	 METH_VARARGS,
+	 "submitBulkRead(endpoint, size|buffer, timeout=0) -> Transfer\n\n"
+	 "Starts an asynchronous bulk read and returns at once.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tsize: number of bytes to read, or a writable buffer to read\n"
+	 "\t      into, which must not be resized until the transfer ends.\n"
+	 "\ttimeout: operation timeout in miliseconds. The transfer is\n"
+	 "\t         cancelled when it expires, and result() raises\n"
+	 "\t         USBTimeoutError.\n"
+	 "\t         (default: 0, no timeout)\n"
+	 "Returns a Transfer object; its result() is the data read."},
+
+	{"submitBulkWrite",
+	 Py_usb_DeviceHandle_submitBulkWrite,
+	 METH_VARARGS,
+	 "submitBulkWrite(endpoint, buffer, timeout=0) -> Transfer\n\n"
+	 "Starts an asynchronous bulk write and returns at once.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: sequence data buffer to write.\n"
+	 "\ttimeout: operation timeout in miliseconds. The transfer is\n"
+	 "\t         cancelled when it expires, and result() raises\n"
+	 "\t         USBTimeoutError.\n"
+	 "\t         (default: 0, no timeout)\n"
+	 "Returns a Transfer object; its result() is the number of\n"
+	 "bytes written."},
+
+	{"submitInterruptRead",
+	 Py_usb_DeviceHandle_submitInterruptRead,
+	 METH_VARARGS,
+	 "submitInterruptRead(endpoint, size|buffer, timeout=0) -> Transfer\n\n"
+	 "Starts an asynchronous interrupt read and returns at once.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tsize: number of bytes to read, or a writable buffer to read\n"
+	 "\t      into, which must not be resized until the transfer ends.\n"
+	 "\ttimeout: operation timeout in miliseconds. The transfer is\n"
+	 "\t         cancelled when it expires, and result() raises\n"
+	 "\t         USBTimeoutError.\n"
+	 "\t         (default: 0, no timeout)\n"
+	 "Returns a Transfer object; its result() is the data read."},
+
+	{"submitInterruptWrite",
+	 Py_usb_DeviceHandle_submitInterruptWrite,
+	 METH_VARARGS,
+	 "submitInterruptWrite(endpoint, buffer, timeout=0) -> Transfer\n\n"
+	 "Starts an asynchronous interrupt write and returns at once.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: sequence data buffer to write.\n"
+	 "\ttimeout: operation timeout in miliseconds. The transfer is\n"
+	 "\t         cancelled when it expires, and result() raises\n"
+	 "\t         USBTimeoutError.\n"
+	 "\t         (default: 0, no timeout)\n"
+	 "Returns a Transfer object; its result() is the number of\n"
+	 "bytes written."},
+
+	{"submitControlMsg",
+	 (PyCFunction) Py_usb_DeviceHandle_submitControlMsg,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "submitControlMsg(requestType, request, buffer, value=0, index=0, timeout=100) -> Transfer\n\n"
+	 "Starts an asynchronous control request on the default control\n"
+	 "pipe and returns at once.\n"
+	 "Arguments:\n"
+	 "\trequestType: specifies the direction of data flow, the type\n"
+	 "\t             of request, and the recipient.\n"
+	 "\trequest: specifies the request.\n"
+	 "\tbuffer: for output requests, the data to write. For input\n"
+	 "\t        requests, the number of bytes to read or a writable\n"
+	 "\t        buffer to read into.\n"
+	 "\tvalue: specific information to pass to the device. (default: 0)\n"
+	 "\tindex: specific information to pass to the device. (default: 0)\n"
+	 "\ttimeout: operation timeout in miliseconds. The transfer is\n"
+	 "\t         cancelled when it expires, and result() raises\n"
+	 "\t         USBTimeoutError.\n"
+	 "\t         (default: 100)\n"
+	 "Returns a Transfer object.\n"
+	 "Without asynchronous support in the platform, the transfer\n"
+	 "is performed before the method returns."},
+
+	{"submitIsoRead",
+	 (PyCFunction) Py_usb_DeviceHandle_submitIsoRead,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "submitIsoRead(endpoint, packets, packetSize=-1) -> Transfer\n\n"
+	 "Starts an asynchronous isochronous read and returns at once.\n"
+	 "Submit several transfers ahead to keep the reserved bandwidth\n"
+	 "in use.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tpackets: number of packets to read.\n"
+	 "\tpacketSize: size of each packet. By default, the maximum\n"
+	 "\t            packet size of the endpoint.\n"
+	 "Returns a Transfer object. Its result() is the whole buffer,\n"
+	 "packet i at offset i * packetSize; isoPackets() tells the bytes\n"
+	 "actually received in each packet."},
+
+	{"submitIsoWrite",
+	 (PyCFunction) Py_usb_DeviceHandle_submitIsoWrite,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "submitIsoWrite(endpoint, buffer, packetSize=-1) -> Transfer\n\n"
+	 "Starts an asynchronous isochronous write and returns at once.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\tbuffer: sequence data buffer to write, sent in packets of\n"
+	 "\t        packetSize bytes; the last one may be shorter.\n"
+	 "\tpacketSize: size of each packet. By default, the maximum\n"
+	 "\t            packet size of the endpoint.\n"
+	 "Returns a Transfer object; its result() is the number of\n"
+	 "bytes written."},
+
+#if PYUSB_THREADS
+	{"streamReader",
+	 (PyCFunction) Py_usb_DeviceHandle_streamReader,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "streamReader(endpoint, transferSize=16384, depth=4, bufferSize=1048576) -> StreamReader\n\n"
+	 "Starts reading the bulk endpoint continuously from a native\n"
+	 "thread, keeping depth transfers queued regardless of what the\n"
+	 "interpreter is doing. The data is stored in a ring buffer and\n"
+	 "taken with the read and readinto methods of the StreamReader;\n"
+	 "when the ring buffer is full, new data is dropped and counted\n"
+	 "in its overruns attribute.\n"
+	 "Arguments:\n"
+	 "\tendpoint: endpoint number.\n"
+	 "\ttransferSize: size of each bulk read. (default: 16384)\n"
+	 "\tdepth: number of reads kept in flight. Without asynchronous\n"
+	 "\t       support in the platform, one read is done at a time.\n"
+	 "\t       (default: 4)\n"
+	 "\tbufferSize: ring buffer size, rounded up to a power of two.\n"
+	 "\t            (default: 1048576)\n"},
+#endif /* PYUSB_THREADS */
+
+	{NULL, NULL}
+};
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_getResultFormat(
+	PyObject *self,
+	void *closure
+	)
+{
+	return PyInt_FromLong(((Py_usb_DeviceHandle *) self)->resultFormat);
+}
+
+PYUSB_STATIC int Py_usb_DeviceHandle_setResultFormat(
+	PyObject *self,
+	PyObject *value,
+	void *closure
+	)
+{
+	int format;
+
+	if (!value) {
+		PyErr_SetString(PyExc_TypeError, "Cannot delete resultFormat");
+		return -1;
+	}
+
+	format = py_NumberAsInt(value);
+	if (PyErr_Occurred() || checkResultFormat(format) < 0) return -1;
+
+	((Py_usb_DeviceHandle *) self)->resultFormat = format;
+	return 0;
+}
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_getClaimedInterfaces(
+	PyObject *self,
+	void *closure
+	)
+{
+	PyUSB_Claims *claims = &((Py_usb_DeviceHandle *) self)->claims;
+	PyObject *dict = PyDict_New();
+	PyObject *key, *value;
+	int i;
+
+	if (!dict) return NULL;
+
+	for (i = 0; i < PYUSB_MAX_INTERFACES; ++i) {
+		if (!PYUSB_CLAIMED(claims, i)) continue;
+
+		key = PyInt_FromLong(i);
+		value = PyInt_FromLong(claims->altSetting[i]);
+
+		if (!key || !value || PyDict_SetItem(dict, key, value) < 0) {
+			Py_XDECREF(key);
+			Py_XDECREF(value);
+			Py_DECREF(dict);
+			return NULL;
+		}
+
+		Py_DECREF(key);
+		Py_DECREF(value);
+	}
+
+	return dict;
+}
+
+PYUSB_STATIC PyGetSetDef Py_usb_DeviceHandle_GetSet[] = {
+	{"resultFormat",
+	 Py_usb_DeviceHandle_getResultFormat,
+	 Py_usb_DeviceHandle_setResultFormat,
+	 "Type of the data returned by bulkRead, interruptRead,\n"
+	 "controlMsg and getDescriptor. One of:\n"
+	 "\tFORMAT_TUPLE: tuple of ints (default)\n"
+	 "\tFORMAT_BYTES: string\n"
+	 "\tFORMAT_BYTEARRAY: bytearray\n"
+	 "\tFORMAT_ARRAY: array.array('B')\n"
+	 "Initialized from the module default (see setResultFormat)."},
+
+	{"claimedInterfaces",
+	 Py_usb_DeviceHandle_getClaimedInterfaces,
+	 NULL,
+	 "Dictionary mapping the numbers of the interfaces claimed\n"
+	 "through the handle to their alternate setting."},
+
+	{NULL}
+};
+
+PYUSB_STATIC void Py_usb_DeviceHandle_del(
+	PyObject *self
+	)
+{
+	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
+	struct usb_dev_handle *h = _self->deviceHandle;
+
+	poolTrim(&_self->pool, 0);
+
+#if PYUSB_USBFS
+	engineDestroy(&_self->engine);
+#endif /* PYUSB_USBFS */
+
+	locksDestroy(_self);
+
+	if (h) {
+		releaseClaims(_self);
+		usb_close(_self->deviceHandle);
+	}
+
+	Py_XDECREF(_self->device);
+	PyObject_Del(self);
+}
+
+PYUSB_STATIC PyTypeObject Py_usb_DeviceHandle_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "usb.DeviceHandle",   	   /*tp_name*/
+    sizeof(Py_usb_DeviceHandle), /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    Py_usb_DeviceHandle_del,   /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+	0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,        /*tp_flags*/
+    "DeviceHandle object",     /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Py_usb_DeviceHandle_Methods, /* tp_methods */
+    Py_usb_DeviceHandle_Members, /* tp_members */
+    Py_usb_DeviceHandle_GetSet, /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,					       /* tp_init */
+    0,                         /* tp_alloc */
+    PyType_GenericNew,         /* tp_new */
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0						/* destructor */
+};
+
+/*
+ * Opens a device and sets it up, without the GIL and with the
+ * enumeration lock held by the caller
+ */
+PYUSB_STATIC void openDevice(
+	PyUSB_Open *op
+	)
+{
+#if PYUSB_USBFS
+	int fds[PYUSB_MAX_FDS];
+	int numFds;
+#endif /* PYUSB_USBFS */
+
+	op->handle = NULL;
+	op->fd = -1;
+	op->failed = "open the device";
+	op->ret = -ENODEV;
+
+	/* removed */
+	if (!op->dev) return;
+
+#if PYUSB_USBFS
+	numFds = usbfsListFds(op->dev, fds, PYUSB_MAX_FDS);
+#endif /* PYUSB_USBFS */
+
+	errno = 0;
+	op->handle = usb_open(op->dev);
+
+	if (!op->handle) {
+		if (errno) op->ret = -errno;
+		return;
+	}
+
+#if PYUSB_USBFS
+	/* libusb does not expose its file descriptor */
+	op->fd = usbfsFindFd(op->dev, fds, numFds);
+#endif /* PYUSB_USBFS */
+
+	op->ret = 0;
+
+	if (op->configuration >= 0 &&
+		(op->ret = usb_set_configuration(op->handle, op->configuration)) < 0) {
+		op->failed = "set the configuration";
+	} else if (op->interface >= 0 &&
+			   (op->ret = usb_claim_interface(op->handle, op->interface)) < 0) {
+		op->failed = "claim the interface";
+	} else if (op->altsetting >= 0 &&
+			   (op->ret = usb_set_altinterface(op->handle, op->altsetting)) < 0) {
+		op->failed = "set the alternate setting";
+		usb_release_interface(op->handle, op->interface);
+	} else {
+		op->failed = NULL;
+		return;
+	}
+
+	usb_close(op->handle);
+	op->handle = NULL;
+}
+
+/*
+ * Builds the DeviceHandle object of a device opened by openDevice
+ */
+PYUSB_STATIC Py_usb_DeviceHandle *wrapHandle(
+	Py_usb_Device *device,
+	PyUSB_Open *op
+	)
+{
+	Py_usb_DeviceHandle *dh;
+
+	dh = PyObject_NEW(Py_usb_DeviceHandle, &Py_usb_DeviceHandle_Type);
+
+	if (!dh) {
+		if (op->interface >= 0) usb_release_interface(op->handle, op->interface);
+		usb_close(op->handle);
+		return NULL;
+	}
+
+	dh->deviceHandle = op->handle;
+	Py_INCREF(device);
+	dh->device = device;
+	claimsInit(&dh->claims, op->configuration);
+	if (op->interface >= 0)
+		claimsAdd(&dh->claims, op->interface, op->altsetting >= 0 ? op->altsetting : 0);
+	dh->resultFormat = resultFormat;
+	poolInit(&dh->pool);
+	locksInit(dh);
+	claimsMap(dh);
+
+#if PYUSB_USBFS
+	engineInit(&dh->engine);
+	dh->engine.fd = op->fd;
+#endif /* PYUSB_USBFS */
+
+	if (op->configuration >= 0) cacheClear(device);
+
+	return dh;
+}
+
+PYUSB_STATIC Py_usb_DeviceHandle *new_DeviceHandle(
+	Py_usb_Device *device
+	)
+{
+	PyUSB_Open op;
+
+	op.dev = device->dev;
+	op.configuration = -1;
+	op.interface = -1;
+	op.altsetting = -1;
+
+	PYUSB_ENUM_BEGIN_ALLOW_THREADS
+	openDevice(&op);
+	PYUSB_ENUM_END_ALLOW_THREADS
+
+	if (!op.handle) {
+		PyUSB_ErrnoError(op.ret);
+		return NULL;
+	}
+
+	return wrapHandle(device, &op);
+}
+
+#if PYUSB_THREADS
+PYUSB_STATIC void *openWorker(
+	void *arg
+	)
+{
+	PyUSB_OpenBatch *batch = (PyUSB_OpenBatch *) arg;
+	int i;
+
+	for (;;) {
+		pthread_mutex_lock(&batch->lock);
+		i = batch->next++;
+		pthread_mutex_unlock(&batch->lock);
+
+		if (i >= batch->count) return NULL;
+
+		openDevice(batch->ops + i);
+	}
+}
+#endif /* PYUSB_THREADS */
+
+/*
+ * Runs openDevice for each of ops, on up to PYUSB_OPEN_THREADS
+ * native threads
+ */
+PYUSB_STATIC void openBatch(
+	PyUSB_Open *ops,
+	int count
+	)
+{
+#if PYUSB_THREADS
+	pthread_t threads[PYUSB_OPEN_THREADS];
+	PyUSB_OpenBatch batch;
+	int numThreads = 0;
+	int i;
+
+	batch.ops = ops;
+	batch.count = count;
+	batch.next = 0;
+	pthread_mutex_init(&batch.lock, NULL);
+
+	/* the calling thread works too, and alone if none can be started */
+	while (numThreads < count - 1 && numThreads < PYUSB_OPEN_THREADS &&
+		   !pthread_create(threads + numThreads, NULL, openWorker, &batch))
+		++numThreads;
+
+	openWorker(&batch);
+
+	for (i = 0; i < numThreads; ++i)
+		pthread_join(threads[i], NULL);
+
+	pthread_mutex_destroy(&batch.lock);
+#else
+	int i;
+
+	for (i = 0; i < count; ++i)
+		openDevice(ops + i);
+#endif /* PYUSB_THREADS */
+}
+
+/*
+ * Tells whether a and b are the same device node. Called with the
+ * enumeration lock held.
+ */
+PYUSB_STATIC int sameNode(
+	struct usb_device *a,
+	struct usb_device *b
+	)
+{
+	if (!a || !b) return 0;
+	if (a == b) return 1;
+
+	return a->bus && b->bus &&
+		!strcmp(a->filename, b->filename) &&
+		!strcmp(a->bus->dirname, b->bus->dirname);
+}
+
+/*
+ * USBError instance describing the failure of openDevice
+ */
+PYUSB_STATIC PyObject *openError(
+	PyUSB_Open *op
+	)
+{
+	PyObject *args;
+	PyObject *error;
+
+	args = Py_BuildValue("(iN)", -op->ret,
+						 PyString_FromFormat("could not %s: %s",
+											 op->failed, strerror(-op->ret)));
+	if (!args) return NULL;
+
+	error = PyObject_Call(errnoClass(-op->ret), args, NULL);
+	Py_DECREF(args);
+
+	return error;
+}
+
+#if PYUSB_USBFS
+
+/*
+ * Tells whether a kernel uevent reports a USB device
+ * (not one of its interfaces) coming or going
+ */
+PYUSB_STATIC int ueventIsDevice(
+	const char *msg,
+	size_t size
+	)
+{
+	const char *end = msg + size;
+	int subsystem = 0, devtype = 0;
+
+	/* "action@devpath", then NUL separated KEY=value pairs */
+	for (msg += strlen(msg) + 1; msg < end; msg += strlen(msg) + 1) {
+		if (!strcmp(msg, "SUBSYSTEM=usb"))
+			subsystem = 1;
+		else if (!strcmp(msg, "DEVTYPE=usb_device"))
+			devtype = 1;
+	}
+
+	return subsystem && devtype;
+}
+
+/*
+ * Reads the pending uevents without blocking.
+ * Returns 1 if the devices must be rescanned.
+ */
+PYUSB_STATIC int monitorDrain(
+	int fd
+	)
+{
+	char msg[PYUSB_UEVENT_SIZE];
+	struct sockaddr_nl addr;
+	socklen_t addrLen;
+	ssize_t n;
+	int rescan = 0;
+
+	for (;;) {
+		addrLen = sizeof(addr);
+		n = recvfrom(fd, msg, sizeof(msg) - 1, MSG_DONTWAIT,
+					 (struct sockaddr *) &addr, &addrLen);
+
+		if (n < 0) {
+			if (errno == EINTR) continue;
+			/* the socket overflowed, events were lost */
+			if (errno == ENOBUFS) {
+				rescan = 1;
+				continue;
+			}
+			break;
+		}
+
+		/* only trust the kernel */
+		if (addr.nl_pid) continue;
+
+		msg[n] = '\0';
+		rescan |= ueventIsDevice(msg, (size_t) n);
+	}
+
+	return rescan;
+}
+
+/*
+ * Opens a socket on the kernel uevents, -1 if not available
+ */
+PYUSB_STATIC int monitorOpen(
+	void
+	)
+{
+	struct sockaddr_nl addr;
+	int fd;
+
+	fd = socket(PF_NETLINK, SOCK_DGRAM, NETLINK_KOBJECT_UEVENT);
+	if (fd < 0) return -1;
+
+	memset(&addr, 0, sizeof(addr));
+	addr.nl_family = AF_NETLINK;
+	addr.nl_groups = 1;
+
+	if (bind(fd, (struct sockaddr *) &addr, sizeof(addr)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	fcntl(fd, F_SETFD, FD_CLOEXEC);
+
+	return fd;
+}
+
+#endif /* PYUSB_USBFS */
+
+/*
+ * Appends the (action, device) tuples of a list of devices to events
+ */
+PYUSB_STATIC int monitorEvents(
+	PyObject *events,
+	const char *action,
+	PyObject *devices
+	)
+{
+	PyObject *event;
+	Py_ssize_t i;
+	int ret;
+
+	for (i = 0; i < PyList_GET_SIZE(devices); ++i) {
+		event = Py_BuildValue("(sO)", action, PyList_GET_ITEM(devices, i));
+		if (!event) return -1;
+
+		ret = PyList_Append(events, event);
+		Py_DECREF(event);
+		if (ret < 0) return -1;
+	}
+
+	return 0;
+}
+
+/*
+ * Rescans the devices and appends the changes to events
+ */
+PYUSB_STATIC int monitorScan(
+	Py_usb_Monitor *self,
+	PyObject *events
+	)
+{
+	PyObject *added, *removed;
+	int ret = -1;
+
+	added = PyList_New(0);
+	removed = PyList_New(0);
+
+	if (added && removed) {
+		enumLock();
+		ret = syncDevices(self->devices, added, removed);
+		enumUnlock();
+	}
+
+	if (!ret && (monitorEvents(events, "remove", removed) < 0 ||
+				 monitorEvents(events, "add", added) < 0))
+		ret = -1;
+
+	Py_XDECREF(added);
+	Py_XDECREF(removed);
+
+	return ret;
+}
+
+/*
+ * def receive(timeout = -1)
+ */
+PYUSB_STATIC PyObject *Py_usb_Monitor_receive(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	Py_usb_Monitor *_self = (Py_usb_Monitor *) self;
+	static char *kwlist[] = {"timeout", NULL};
+	PyObject *events;
+	int timeout = -1;
+	int wait, ret;
+#if PYUSB_THREADS
+	struct timespec deadline;
+	struct timespec pause;
+#endif /* PYUSB_THREADS */
+#if PYUSB_USBFS
+	struct pollfd pfd;
+	int err;
+#endif /* PYUSB_USBFS */
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i", kwlist, &timeout))
+		return NULL;
+
+	if (!_self->devices) {
+		PyErr_SetString(PyExc_ValueError, "monitor is closed");
+		return NULL;
+	}
+
+	events = PyList_New(0);
+	if (!events) return NULL;
+
+#if PYUSB_THREADS
+	if (timeout > 0) setDeadline(&deadline, timeout);
+#endif /* PYUSB_THREADS */
+
+	for (;;) {
+		wait = timeout;
+
+#if PYUSB_THREADS
+		if (timeout > 0) wait = msLeft(&deadline);
+#endif /* PYUSB_THREADS */
+
+#if PYUSB_USBFS
+		if (_self->fd >= 0) {
+			pfd.fd = _self->fd;
+			pfd.events = POLLIN;
+
+			Py_BEGIN_ALLOW_THREADS
+			ret = poll(&pfd, 1, wait);
+			err = errno;
+			Py_END_ALLOW_THREADS
+
+			if (ret < 0) {
+				if (err != EINTR) {
+					errno = err;
+					PyErr_SetFromErrno(PyExc_OSError);
+					goto error;
+				}
+
+				if (PyErr_CheckSignals() < 0) goto error;
+				continue;
+			}
+
+			if (!ret) break;
+
+			if (pfd.revents & POLLNVAL) {
+				errno = EBADF;
+				PyErr_SetFromErrno(PyExc_OSError);
+				goto error;
+			}
+
+			if (monitorDrain(_self->fd) && monitorScan(_self, events) < 0)
+				goto error;
+
+			if (PyList_GET_SIZE(events) || !timeout) break;
+			continue;
+		}
+#endif /* PYUSB_USBFS */
+
+		if (monitorScan(_self, events) < 0) goto error;
+		if (PyList_GET_SIZE(events) || !wait) break;
+
+#if PYUSB_THREADS
+		if (wait < 0 || wait > _self->interval) wait = _self->interval;
+
+		pause.tv_sec = wait / 1000;
+		pause.tv_nsec = (wait % 1000) * 1000000;
+
+		Py_BEGIN_ALLOW_THREADS
+		ret = nanosleep(&pause, NULL);
+		Py_END_ALLOW_THREADS
+
+		if (PyErr_CheckSignals() < 0) goto error;
+#else
+		/* no way to wait, a single rescan per call */
+		break;
+#endif /* PYUSB_THREADS */
+	}
+
+	return events;
+
+error:
+	Py_DECREF(events);
+	return NULL;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_fileno(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	return PyInt_FromLong(((Py_usb_Monitor *) self)->fd);
+}
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_close(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	Py_usb_Monitor *_self = (Py_usb_Monitor *) self;
+
+	if (_self->fd >= 0) {
+		close(_self->fd);
+		_self->fd = -1;
+	}
+
+	Py_CLEAR(_self->devices);
+
+	Py_RETURN_NONE;
+}
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_getDevices(
+	PyObject *self,
+	void *closure
+	)
+{
+	Py_usb_Monitor *_self = (Py_usb_Monitor *) self;
+	PyObject *values, *tuple;
+
+	if (!_self->devices) return PyTuple_New(0);
+
+	values = PyDict_Values(_self->devices);
+	if (!values) return NULL;
+
+	tuple = PyList_AsTuple(values);
+	Py_DECREF(values);
+
+	return tuple;
+}
+
+PYUSB_STATIC PyMemberDef Py_usb_Monitor_Members[] = {
+	{"interval",
+	 T_INT,
+	 offsetof(Py_usb_Monitor, interval),
+	 0,
+	 "Period of the rescans in miliseconds when kernel uevents\n"
+	 "are not available."},
+
+	{NULL}
+};
+
+PYUSB_STATIC PyGetSetDef Py_usb_Monitor_GetSet[] = {
+	{"devices",
+	 Py_usb_Monitor_getDevices,
+	 NULL,
+	 "Tuple with the devices currently attached, as of the last\n"
+	 "scan. Does not rescan.",
+	 NULL},
+
+	{NULL}
+};
+
+PYUSB_STATIC PyMethodDef Py_usb_Monitor_Methods[] = {
+	{"receive",
+	 (PyCFunction) Py_usb_Monitor_receive,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "receive(timeout=-1) -> list\n\n"
+	 "Waits for devices to be attached or detached.\n"
 	 "Arguments:\n"
-	 "\trequestType: specifies the direction of data flow, the type\n"
-	 "\t             of request, and the recipient.\n"
-	 "\trequest: specifies the request.\n"
-	 "\tbuffer: if the transfer is a write transfer, buffer is a sequence \n"
-	 "\t        with the transfer data, otherwise, buffer is the number of\n"
-	 "\t        bytes to read.\n"
-	 "\tvalue: specific information to pass to the device. (default: 0)\n"
-	 "\tindex: specific information to pass to the device. (default: 0)\n"
-	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
-	 "Returns the number of bytes written."},
+	 "\ttimeout: maximum time to wait in miliseconds, -1 waits\n"
+	 "\t         forever and 0 does not wait. (default: -1)\n"
+	 "Returns a list of (action, device) tuples, where action is\n"
+	 "'add' or 'remove' and device is a Device object. A removed\n"
+	 "device can no longer be opened. The list is empty if the\n"
+	 "timeout expired."},
+
+	{"fileno",
+	 Py_usb_Monitor_fileno,
+	 METH_NOARGS,
+	 "fileno() -> int\n\n"
+	 "Returns the descriptor of the kernel uevent socket, readable\n"
+	 "when receive() has something to report, so that the monitor\n"
+	 "can be registered with select, poll or an event loop. Returns\n"
+	 "-1 if uevents are not available on this system; receive()\n"
+	 "then rescans the busses every interval miliseconds."},
+
+	{"close",
+	 Py_usb_Monitor_close,
+	 METH_NOARGS,
+	 "close() -> None\n\n"
+	 "Closes the uevent socket."},
+
+	{NULL, NULL}
+};
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_new(
+	PyTypeObject *type,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	static char *kwlist[] = {"interval", NULL};
+	Py_usb_Monitor *self;
+	int interval = 1000;
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|i", kwlist, &interval))
+		return NULL;
+
+	if (interval <= 0) {
+		PyErr_SetString(PyExc_ValueError, "interval must be positive");
+		return NULL;
+	}
+
+	self = (Py_usb_Monitor *) type->tp_alloc(type, 0);
+	if (!self) return NULL;
+
+	self->interval = interval;
+	self->fd = -1;
+	self->devices = NULL;
+
+#if PYUSB_USBFS
+	/* listen first, not to miss the devices attached while scanning */
+	self->fd = monitorOpen();
+#endif /* PYUSB_USBFS */
+
+	enumLock();
+
+	if (!scanDevices())
+		self->devices = PyDict_Copy(knownDevices);
+
+	enumUnlock();
+
+	if (!self->devices) {
+		Py_DECREF((PyObject *) self);
+		return NULL;
+	}
+
+	return (PyObject *) self;
+}
+
+PYUSB_STATIC void Py_usb_Monitor_del(
+	PyObject *self
+	)
+{
+	Py_usb_Monitor *_self = (Py_usb_Monitor *) self;
+
+	if (_self->fd >= 0) close(_self->fd);
+	Py_XDECREF(_self->devices);
+	self->ob_type->tp_free(self);
+}
+
+PYUSB_STATIC PyTypeObject Py_usb_Monitor_Type = {
+    PyObject_HEAD_INIT(NULL)
+    0,                         /*ob_size*/
+    "usb.Monitor",   	   	   /*tp_name*/
+    sizeof(Py_usb_Monitor),    /*tp_basicsize*/
+    0,                         /*tp_itemsize*/
+    Py_usb_Monitor_del,        /*tp_dealloc*/
+    0,                         /*tp_print*/
+    0,                         /*tp_getattr*/
+    0,                         /*tp_setattr*/
+    0,                         /*tp_compare*/
+    0,                         /*tp_repr*/
+    0,                         /*tp_as_number*/
+    0,                         /*tp_as_sequence*/
+    0,                         /*tp_as_mapping*/
+    0,                         /*tp_hash */
+    0,                         /*tp_call*/
+	0,                         /*tp_str*/
+    0,                         /*tp_getattro*/
+    0,                         /*tp_setattro*/
+    0,                         /*tp_as_buffer*/
+    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,        /*tp_flags*/
+    "Monitor(interval=1000) -> Monitor\n\n"
+    "Reports the devices attached and detached, from the kernel\n"
+    "uevents when available, so that the busses need not be\n"
+    "rescanned periodically. The devices present when the monitor\n"
+    "is created are in its devices attribute, not reported as events.", /* tp_doc */
+    0,                         /* tp_traverse */
+    0,                         /* tp_clear */
+    0,                         /* tp_richcompare */
+    0,                         /* tp_weaklistoffset */
+    0,                         /* tp_iter */
+    0,                         /* tp_iternext */
+    Py_usb_Monitor_Methods,    /* tp_methods */
+    Py_usb_Monitor_Members,	   /* tp_members */
+    Py_usb_Monitor_GetSet,     /* tp_getset */
+    0,                         /* tp_base */
+    0,                         /* tp_dict */
+    0,                         /* tp_descr_get */
+    0,                         /* tp_descr_set */
+    0,                         /* tp_dictoffset */
+    0,					       /* tp_init */
+    0,                         /* tp_alloc */
+    Py_usb_Monitor_new,        /* tp_new */
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0,
+	0							/* destructor */
+};
+
+/*
+ * Global functions
+ */
+
+PYUSB_STATIC PyObject *bussesTuple(
+	void
+	)
+{
+	PyObject *tuple;
+	PyObject *busCache;
+	Py_usb_Bus *cached;
+	struct usb_bus *bus, *b;
+	u_int32_t i;
+
+	if (scanDevices() < 0) return NULL;
+
+	bus = enumBusses();
+
+	if (!bus && usingLibusb()) {
+		PyUSB_Error();
+		return NULL;
+	}
+
+	for(i=0,b=bus;b;b=b->next) ++i;
+	tuple = PyTuple_New(i);
+	if (!tuple) return NULL;
+
+	busCache = PyDict_New();
+
+	if (!busCache) {
+		Py_DECREF(tuple);
+		return NULL;
+	}
+
+	for(b=bus,i=0;b;++i,b=b->next) {
+		cached = (Py_usb_Bus *) PyDict_GetItemString(knownBusses, b->dirname);
+
+		/* the same devices on the same bus, reuse the Bus object */
+		if (cached && busUnchanged(cached, b)) {
+			Py_INCREF((PyObject *) cached);
+		} else {
+			cached = new_Bus(b);
+			if (!cached) break;
+		}
+
+		PyTuple_SET_ITEM(tuple, i, (PyObject *) cached);
+
+		if (PyDict_SetItemString(busCache, b->dirname, (PyObject *) cached) < 0)
+			break;
+	}
+
+	if (PyErr_Occurred()) {
+		Py_DECREF(busCache);
+		Py_DECREF(tuple);
+		return NULL;
+	}
+
+	Py_DECREF(knownBusses);
+	knownBusses = busCache;
+
+	return tuple;
+}
+
+PYUSB_STATIC PyObject *busses(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	PyObject *tuple;
+
+	enumLock();
+	tuple = bussesTuple();
+	enumUnlock();
+
+	return tuple;
+}
+
+/*
+ * def refresh()
+ */
+PYUSB_STATIC PyObject *refresh(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	PyObject *added, *removed;
+	int ret = -1;
+
+	added = PyList_New(0);
+	removed = PyList_New(0);
+
+	if (added && removed) {
+		enumLock();
+		ret = syncDevices(refreshed, added, removed);
+		enumUnlock();
+	}
+
+	if (ret < 0) {
+		Py_XDECREF(added);
+		Py_XDECREF(removed);
+		return NULL;
+	}
+
+	return Py_BuildValue("(NN)", added, removed);
+}
+
+/*
+ * Tells whether one of the alternate settings of a device
+ * matches the interface criteria
+ */
+PYUSB_STATIC int matchInterface(
+	struct usb_device *dev,
+	PyUSB_Match *match
+	)
+{
+	struct usb_interface_descriptor *alt;
+	int c, i, a;
+
+	if (match->interfaceClass < 0 && match->interfaceSubClass < 0 &&
+		match->interfaceProtocol < 0)
+		return 1;
+
+	if (!dev->config) return 0;
+
+	for (c = 0; c < dev->descriptor.bNumConfigurations; ++c) {
+		for (i = 0; i < dev->config[c].bNumInterfaces; ++i) {
+			for (a = 0; a < dev->config[c].interface[i].num_altsetting; ++a) {
+				alt = dev->config[c].interface[i].altsetting + a;
+
+				if ((match->interfaceClass < 0 ||
+					 alt->bInterfaceClass == match->interfaceClass) &&
+					(match->interfaceSubClass < 0 ||
+					 alt->bInterfaceSubClass == match->interfaceSubClass) &&
+					(match->interfaceProtocol < 0 ||
+					 alt->bInterfaceProtocol == match->interfaceProtocol))
+					return 1;
+			}
+		}
+	}
 
-	{"setConfiguration",
-	 Py_usb_DeviceHandle_setConfiguration,
- 	 METH_O,
-	 "setConfiguration(configuration) -> None\n\n"
-	 "Sets the active configuration of a device.\n"
-	 "Arguments:\n"
-	 "\tconfiguration: a configuration value or a Configuration object."},	 
+	return 0;
+}
 
-	{"claimInterface",
-	 Py_usb_DeviceHandle_claimInterface,
-	 METH_O,
-	 "claimInterface(interface) -> None\n\n"
-	 "Claims the interface with the Operating System.\n"
-	 "Arguments:\n"
-	 "\tinterface: interface number or an Interface object."},
-	
-	{"detachKernelDriver",
-	 Py_usb_DeviceHandle_detachKernelDriver,
-	 METH_O,
-	 "detachKernelDriver(interface) -> None\n\n"
-	 "Detaches a kernel driver from the interface (if one is attached,\n"
-	 "we have permission and the operation is supported by the OS)\n"
-	 "Arguments:\n"
-	 "\tinterface: interface number or an Interface object."},
+PYUSB_STATIC int matchString(
+	usb_dev_handle *handle,
+	int index,
+	const char *expected
+	)
+{
+	char buffer[STRING_ARRAY_SIZE];
+	int n;
 
-	{"releaseInterface",
-	 Py_usb_DeviceHandle_releaseInterface,
-	 METH_NOARGS,
-	 "releaseInterface() -> None\n\n"
-	 "Releases an interface previously claimed with claimInterface."},
-	
-	{"setAltInterface",
-	 Py_usb_DeviceHandle_setAltInterface,
-	 METH_O,
-	 "setAltInterface(alternate) -> None\n\n"
-	 "Sets the active alternate setting of the current interface.\n"
-	 "Arguments:\n"
-	 "\talternate: an alternate setting number or an Interface object."},
+	if (!expected) return 1;
+	if (!index) return 0;
 
-	{"bulkWrite",
-	 Py_usb_DeviceHandle_bulkWrite,
-	 METH_VARARGS,
-	 "bulkWrite(endpoint, buffer, timeout=100) -> bytesWritten\n\n"
-	 "Performs a bulk write request to the endpoint specified.\n"
-	 "Arguments:\n"
-	 "\tendpoint: endpoint number.\n"
-	 "\tbuffer: sequence data buffer to write.\n"
-	 "\t      This parameter can be any sequence type\n"
-	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
-	 "Returns the number of bytes written."},
+	n = usb_get_string_simple(handle, index, buffer, sizeof(buffer));
+
+	return n >= 0 && (size_t) n == strlen(expected) && !memcmp(buffer, expected, n);
+}
+
+/*
+ * Tells whether a device matches the criteria. The string
+ * descriptors are only read once everything else matched.
+ */
+PYUSB_STATIC int matchDevice(
+	struct usb_device *dev,
+	PyUSB_Match *match
+	)
+{
+	struct usb_device_descriptor *desc = &dev->descriptor;
+	usb_dev_handle *handle;
+	int ret;
+
+	if ((match->idVendor >= 0 && desc->idVendor != match->idVendor) ||
+		(match->idProduct >= 0 && desc->idProduct != match->idProduct) ||
+		(match->deviceClass >= 0 && desc->bDeviceClass != match->deviceClass) ||
+		(match->deviceSubClass >= 0 && desc->bDeviceSubClass != match->deviceSubClass) ||
+		(match->deviceProtocol >= 0 && desc->bDeviceProtocol != match->deviceProtocol) ||
+		!matchInterface(dev, match))
+		return 0;
+
+	if (!match->manufacturer && !match->product && !match->serial)
+		return 1;
+
+	/* a device we cannot open does not match */
+	handle = usb_open(dev);
+	if (!handle) return 0;
+
+	ret = matchString(handle, desc->iManufacturer, match->manufacturer) &&
+		  matchString(handle, desc->iProduct, match->product) &&
+		  matchString(handle, desc->iSerialNumber, match->serial);
+
+	usb_close(handle);
+
+	return ret;
+}
+
+/*
+ * Common part of find and findAll. Returns the first matching
+ * Device object or None, or the list of all of them.
+ * Called with the enumeration lock held.
+ */
+PYUSB_STATIC PyObject *findDevices(
+	PyObject *args,
+	PyObject *kwds,
+	int all
+	)
+{
+	static char *kwlist[] = {
+		"idVendor", "idProduct", "deviceClass", "deviceSubClass",
+		"deviceProtocol", "interfaceClass", "interfaceSubClass",
+		"interfaceProtocol", "bus", "manufacturer", "product", "serial",
+		NULL
+	};
+	PyUSB_Match match = {-1, -1, -1, -1, -1, -1, -1, -1, NULL, NULL, NULL, NULL};
+	PyObject *result = NULL;
+	PyObject *device;
+	struct usb_bus *bus;
+	struct usb_device *dev;
+	int matched;
+
+	if (PyTuple_GET_SIZE(args)) {
+		PyErr_SetString(PyExc_TypeError, "find takes keyword arguments only");
+		return NULL;
+	}
+
+	if (!PyArg_ParseTupleAndKeywords(args, kwds, "|iiiiiiiizzzz", kwlist,
+									 &match.idVendor, &match.idProduct,
+									 &match.deviceClass, &match.deviceSubClass,
+									 &match.deviceProtocol, &match.interfaceClass,
+									 &match.interfaceSubClass, &match.interfaceProtocol,
+									 &match.bus, &match.manufacturer,
+									 &match.product, &match.serial))
+		return NULL;
+
+#if DUMP_PARAMS
+	fprintf(stderr, "findDevices params:\n"
+			"\tidVendor: %d\n"
+			"\tidProduct: %d\n"
+			"\tdeviceClass: %d\n"
+			"\tinterfaceClass: %d\n"
+			"\tall: %d\n",
+			match.idVendor, match.idProduct,
+			match.deviceClass, match.interfaceClass, all);
+#endif /* DUMP_PARAMS */
+
+	if (rescanDevices() < 0) return NULL;
+
+	if (all) {
+		result = PyList_New(0);
+		if (!result) return NULL;
+	}
+
+	for (bus = enumBusses(); bus; bus = bus->next) {
+		if (match.bus && strcmp(bus->dirname, match.bus)) continue;
+
+		for (dev = bus->devices; dev; dev = dev->next) {
+			/* may read string descriptors */
+			PYUSB_ENUM_BEGIN_ALLOW_THREADS
+			matched = matchDevice(dev, &match);
+			PYUSB_ENUM_END_ALLOW_THREADS
+
+			if (!matched) continue;
+
+			device = cachedDevice(bus, dev);
+
+			if (!all) return device;
+
+			if (!device || PyList_Append(result, device) < 0) {
+				Py_XDECREF(device);
+				Py_DECREF(result);
+				return NULL;
+			}
+
+			Py_DECREF(device);
+		}
+	}
+
+	if (!all) Py_RETURN_NONE;
+
+	return result;
+}
+
+/*
+ * def find(**criteria)
+ */
+PYUSB_STATIC PyObject *find(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	PyObject *device;
+
+	enumLock();
+	device = findDevices(args, kwds, 0);
+	enumUnlock();
+
+	return device;
+}
+
+/*
+ * def findAll(**criteria)
+ */
+PYUSB_STATIC PyObject *findAll(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	PyObject *devices;
+
+	enumLock();
+	devices = findDevices(args, kwds, 1);
+	enumUnlock();
+
+	return devices;
+}
+
+/*
+ * def openAll(devices, configuration = -1, interface = -1, altsetting = -1)
+ */
+PYUSB_STATIC PyObject *openAll(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	)
+{
+	static char *kwlist[] = {
+		"devices",
+		"configuration",
+		"interface",
+		"altsetting",
+		NULL
+	};
+	PyObject *devices;
+	PyObject *seq;
+	PyObject *item;
+	PyObject *result = NULL;
+	PyUSB_Open *ops;
+	int configuration = -1, interface = -1, altsetting = -1;
+	int duplicate = 0;
+	Py_ssize_t n, i, j;
+
+	if (!PyArg_ParseTupleAndKeywords(args,
+									 kwds,
+									 "O|iii",
+									 kwlist,
+									 &devices,
+									 &configuration,
+									 &interface,
+									 &altsetting)) {
+		return NULL;
+	}
+
+#if DUMP_PARAMS
+
+	fprintf(stderr,
+			"openAll params:\n"
+			"\tconfiguration: %d\n"
+			"\tinterface: %d\n"
+			"\taltsetting: %d\n",
+			configuration,
+			interface,
+			altsetting);
+
+#endif /* DUMP_PARAMS */
+
+	if (altsetting >= 0 && interface < 0) {
+		PyErr_SetString(PyExc_ValueError, "altsetting needs an interface");
+		return NULL;
+	}
+
+	if (interface >= PYUSB_MAX_INTERFACES) {
+		PyErr_SetString(PyExc_ValueError, "invalid interface number");
+		return NULL;
+	}
+
+	seq = PySequence_Fast(devices, "devices must be a sequence");
+	if (!seq) return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+
+	for (i = 0; i < n; ++i) {
+		item = PySequence_Fast_GET_ITEM(seq, i);
+
+		if (!PyObject_TypeCheck(item, &Py_usb_Device_Type)) {
+			PyErr_SetString(PyExc_TypeError, "devices must be Device objects");
+			goto done;
+		}
+	}
+
+	ops = PyMem_New(PyUSB_Open, n ? n : 1);
+
+	if (!ops) {
+		PyErr_NoMemory();
+		goto done;
+	}
+
+	enumLock();
+
+	for (i = 0; i < n; ++i) {
+		ops[i].dev = ((Py_usb_Device *) PySequence_Fast_GET_ITEM(seq, i))->dev;
+		ops[i].configuration = configuration;
+		ops[i].interface = interface;
+		ops[i].altsetting = altsetting;
+	}
+
+	/*
+	 * the usbfs descriptors of two handles of a node could not be
+	 * told apart, whatever Device objects they come from
+	 */
+	for (i = 0; i < n && !duplicate; ++i) {
+		for (j = 0; j < i; ++j) {
+			if (PySequence_Fast_GET_ITEM(seq, j) == PySequence_Fast_GET_ITEM(seq, i) ||
+				sameNode(ops[j].dev, ops[i].dev)) {
+				duplicate = 1;
+				break;
+			}
+		}
+	}
+
+	if (!duplicate) {
+		PYUSB_ENUM_BEGIN_ALLOW_THREADS
+		openBatch(ops, (int) n);
+		PYUSB_ENUM_END_ALLOW_THREADS
+	}
+
+	enumUnlock();
+
+	if (duplicate) {
+		PyErr_SetString(PyExc_ValueError, "a device is listed twice");
+		PyMem_Free(ops);
+		goto done;
+	}
+
+	result = PyList_New(n);
+
+	for (i = 0; i < n; ++i) {
+		if (!result) {
+			item = NULL;
+		} else if (ops[i].handle) {
+			item = (PyObject *) wrapHandle(
+					(Py_usb_Device *) PySequence_Fast_GET_ITEM(seq, i), ops + i);
+			/* taken over, or closed on error */
+			ops[i].handle = NULL;
+		} else {
+			item = openError(ops + i);
+		}
+
+		if (item) {
+			PyList_SET_ITEM(result, i, item);
+		} else {
+			Py_CLEAR(result);
+
+			/* do not leak the next handles */
+			if (ops[i].handle) {
+				if (interface >= 0) usb_release_interface(ops[i].handle, interface);
+				usb_close(ops[i].handle);
+			}
+		}
+	}
+
+	PyMem_Free(ops);
+
+done:
+	Py_DECREF(seq);
+	return result;
+}
+
+/*
+ * Drops all the Device and Bus objects, when changing backend
+ */
+PYUSB_STATIC void forgetDevices(
+	void
+	)
+{
+	PyObject *key;
+	PyObject *value;
+	Py_ssize_t pos = 0;
+
+	while (PyDict_Next(knownDevices, &pos, &key, &value))
+		((Py_usb_Device *) value)->dev = NULL;
+
+	PyDict_Clear(knownDevices);
+	PyDict_Clear(knownBusses);
+}
+
+#if PYUSB_SYSFS
+/*
+ * Writes the devices of the current enumeration to a snapshot.
+ * Called with the enumeration lock held.
+ */
+PYUSB_STATIC int snapshotSave(
+	const char *path
+	)
+{
+	static const char padding[4];
+	char tmp[PATH_MAX];
+	PyUSB_SnapshotHeader header;
+	PyUSB_SnapshotRecord record;
+	struct usb_bus *bus;
+	struct usb_device *dev;
+	unsigned char *raw;
+	size_t size, used;
+	int failed;
+	FILE *f;
+
+	if (rescanDevices() < 0) return -1;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, PYUSB_SNAPSHOT_MAGIC, sizeof(header.magic));
+	header.version = PYUSB_SNAPSHOT_VERSION;
+
+	for (bus = enumBusses(); bus; bus = bus->next)
+		for (dev = bus->devices; dev; dev = dev->next)
+			++header.count;
+
+	/* replaced at once, for the processes loading it */
+	if (snprintf(tmp, sizeof(tmp), "%s.%ld", path, (long) getpid()) >= (int) sizeof(tmp)) {
+		errno = ENAMETOOLONG;
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+		return -1;
+	}
+
+	f = fopen(tmp, "wb");
+
+	if (!f) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, tmp);
+		return -1;
+	}
+
+	failed = fwrite(&header, sizeof(header), 1, f) != 1;
+
+	for (bus = enumBusses(); bus && !failed; bus = bus->next) {
+		for (dev = bus->devices; dev && !failed; dev = dev->next) {
+			size = snapshotDescriptors(dev, NULL);
+			raw = (unsigned char *) malloc(size);
+
+			if (!raw) {
+				fclose(f);
+				unlink(tmp);
+				PyErr_NoMemory();
+				return -1;
+			}
+
+			snapshotDescriptors(dev, raw);
+
+			memset(&record, 0, sizeof(record));
+			record.location = bus->location;
+			record.rawSize = (u_int32_t) size;
+			record.dirnameSize = (u_int16_t) strlen(bus->dirname);
+			record.filenameSize = (u_int16_t) strlen(dev->filename);
+			record.devnum = dev->devnum;
+
+			used = sizeof(record) + record.dirnameSize + record.filenameSize + size;
+			record.size = (u_int32_t) PYUSB_SNAPSHOT_ALIGN(used);
+
+			failed = fwrite(&record, sizeof(record), 1, f) != 1 ||
+					 fwrite(bus->dirname, 1, record.dirnameSize, f) != record.dirnameSize ||
+					 fwrite(dev->filename, 1, record.filenameSize, f) != record.filenameSize ||
+					 fwrite(raw, 1, size, f) != size ||
+					 fwrite(padding, 1, record.size - used, f) != record.size - used;
+
+			free(raw);
+		}
+	}
+
+	if (fclose(f)) failed = 1;
+
+	if (failed || rename(tmp, path) < 0) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, (char *) path);
+		unlink(tmp);
+		return -1;
+	}
+
+	return 0;
+}
+#endif /* PYUSB_SYSFS */
+
+/*
+ * def saveSnapshot(path)
+ */
+PYUSB_STATIC PyObject *saveSnapshot(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	char *path;
+#if PYUSB_SYSFS
+	int ret;
+#endif /* PYUSB_SYSFS */
+
+	if (!PyArg_ParseTuple(args, "s", &path)) return NULL;
+
+#if PYUSB_SYSFS
+	enumLock();
+	ret = snapshotSave(path);
+	enumUnlock();
+
+	if (ret < 0) return NULL;
+#endif /* PYUSB_SYSFS */
+
+	Py_RETURN_NONE;
+}
+
+/*
+ * def loadSnapshot(path)
+ */
+PYUSB_STATIC PyObject *loadSnapshot(
+	PyObject *self,
+	PyObject *args
+	)
+{
+#if PYUSB_SYSFS
+	struct usb_bus *busses, *bus;
+	struct usb_device *dev;
+	struct stat st;
+	unsigned char *map;
+	char *path;
+	long count = 0;
+	int fd;
+#endif /* PYUSB_SYSFS */
+
+	if (args != Py_None && !PyString_Check(args)) {
+		PyErr_SetString(PyExc_TypeError, "path must be a string or None");
+		return NULL;
+	}
+
+#if PYUSB_SYSFS
+	if (args == Py_None) {
+		enumLock();
+
+		if (snapshotMap) {
+			forgetDevices();
+			snapshotClose();
+		}
+
+		enumUnlock();
+
+		return PyInt_FromLong(0);
+	}
+
+	path = PyString_AS_STRING(args);
+
+	fd = open(path, O_RDONLY);
+
+	if (fd < 0 || fstat(fd, &st) < 0) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+		if (fd >= 0) close(fd);
+		return NULL;
+	}
 
-	{"bulkRead",
-	 Py_usb_DeviceHandle_bulkRead,
-	 METH_VARARGS,
-	 "bulkRead(endpoint, size, timeout=100) -> buffer\n\n"
-	 "Performs a bulk read request to the endpoint specified.\n"
-	 "Arguments:\n"
-	 "\tendpoint: endpoint number.\n"
-	 "\tsize: number of bytes to read.\n"
-	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
-	 "Returns a tuple with the data read."},
+	if (!st.st_size) {
+		close(fd);
+		goto invalid;
+	}
 
-	{"interruptWrite",
-	 Py_usb_DeviceHandle_interruptWrite,
-	 METH_VARARGS,
-	 "interruptWrite(endpoint, buffer, timeout=100) -> bytesWritten\n\n"
-	 "Performs a interrupt write request to the endpoint specified.\n"
-	 "Arguments:\n"
-	 "\tendpoint: endpoint number.\n"
-	 "\tbuffer: sequence data buffer to write.\n"
-	 "\t      This parameter can be any sequence type\n"
-	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
-	 "Returns the number of bytes written."},
+	map = (unsigned char *) mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
 
-	{"interruptRead",
-	 Py_usb_DeviceHandle_interruptRead,
-	 METH_VARARGS,
-	 "interruptRead(endpoint, size, timeout=100) -> buffer\n\n"
-	 "Performs a interrupt read request to the endpoint specified.\n"
-	 "Arguments:\n"
-	 "\tendpoint: endpoint number.\n"
-	 "\tsize: number of bytes to read.\n"
-	 "\ttimeout: operation timeout in miliseconds. (default: 100)\n"
-	 "Returns a tuple with the data read."},
+	if (map == (unsigned char *) MAP_FAILED) {
+		PyErr_SetFromErrnoWithFilename(PyExc_IOError, path);
+		return NULL;
+	}
 
-	{"resetEndpoint",
-	 Py_usb_DeviceHandle_resetEndpoint,
-	 METH_O,
-	 "resetEndpoint(endpoint) -> None\n\n"
-	 "Resets all state (like toggles) for the specified endpoint.\n"
-	 "Arguments:\n"
-	 "\tendpoint: endpoint number.\n"},
+	if (snapshotParse(map, st.st_size, &busses) < 0) {
+		rawFreeBusses(busses);
+		munmap(map, st.st_size);
+		goto invalid;
+	}
 
-	{"reset",
-	 Py_usb_DeviceHandle_reset,
-	 METH_NOARGS,
-	 "reset() -> None\n\n"
-	 "Resets the specified device by sending a RESET\n"
-	 "down the port it is connected to.\n"},
+	enumLock();
 
-	{"clearHalt",
-	 Py_usb_DeviceHandle_clearHalt,
-	 METH_O,
-	 "clearHalt(endpoint) -> None\n\n"
-	 "Clears any halt status on the specified endpoint.\n"
-	 "Arguments:\n"
-	 "\tendpoint: endpoint number.\n"},
+	forgetDevices();
+	snapshotClose();
 
-	{"getString",
-	 Py_usb_DeviceHandle_getString,
-	 METH_VARARGS,
-	 "getString(index, len, langid = -1) -> string\n\n"
-	 "Retrieves the string descriptor specified by index\n"
-	 "and langid from a device.\n"
-	 "Arguments:\n"
-	 "\tindex: index of descriptor in the device.\n"
-	 "\tlen: number of bytes of the string\n"
-	 "\tlangid: Language ID. If it is omittedi, will be\n"
-	 "\t        used the first language.\n"},
+	snapshotMap = map;
+	snapshotSize = st.st_size;
+	snapshotBusses = busses;
 
-	{"getDescriptor",
-	 Py_usb_DeviceHandle_getDescriptor,
-	 METH_VARARGS,
-	 "getDescriptor(type, index, len, endpoint = -1) -> descriptor\n\n"
-	 "Retrieves a descriptor from the device identified by the type\n"
-	 "and index of the descriptor.\n"
-	 "Arguments:\n"
-	 "\ttype: descriptor type.\n"
-	 "\tindex: index of the descriptor.\n"
-	 "\tlen: descriptor length.\n"
-	 "\tendpoint: endpoint number from descriptor is read. If it is\n"
-	 "\t          omitted, the descriptor is read from default control pipe.\n"},
+	snapshotFindNodes();
+	snapshotValidate();
 
-	{NULL, NULL}
-};
+	for (bus = snapshotBusses; bus; bus = bus->next)
+		for (dev = bus->devices; dev; dev = dev->next)
+			++count;
 
-PYUSB_STATIC void Py_usb_DeviceHandle_del(
-	PyObject *self
+	enumUnlock();
+
+	return PyInt_FromLong(count);
+
+invalid:
+	PyErr_Format(PyExc_ValueError, "%s is not a valid snapshot", path);
+	return NULL;
+#else
+	return PyInt_FromLong(0);
+#endif /* PYUSB_SYSFS */
+}
+
+/*
+ * def setSysfsRoot(path)
+ */
+PYUSB_STATIC PyObject *setSysfsRoot(
+	PyObject *self,
+	PyObject *args
 	)
 {
-	Py_usb_DeviceHandle *_self = (Py_usb_DeviceHandle *) self;
-	struct usb_dev_handle *h = _self->deviceHandle;
+	if (args != Py_None && !PyString_Check(args)) {
+		PyErr_SetString(PyExc_TypeError, "path must be a string or None");
+		return NULL;
+	}
 
-	if (h) {
-		if (-1 != _self->interfaceClaimed) {
-			usb_release_interface(_self->deviceHandle, 
-								  _self->interfaceClaimed);
-		}
+#if PYUSB_SYSFS
+	enumLock();
 
-		usb_close(_self->deviceHandle);
+	forgetDevices();
+	snapshotClose();
+
+	rawFreeBusses(sysfsBusses);
+	sysfsBusses = NULL;
+
+	Py_CLEAR(sysfsRoot);
+
+	if (args != Py_None) {
+		Py_INCREF(args);
+		sysfsRoot = args;
 	}
 
-	PyObject_Del(self);
-}
+	enumUnlock();
+#endif /* PYUSB_SYSFS */
 
-PYUSB_STATIC PyTypeObject Py_usb_DeviceHandle_Type = {
-    PyObject_HEAD_INIT(NULL)
-    0,                         /*ob_size*/
-    "usb.DeviceHandle",   	   /*tp_name*/
-    sizeof(Py_usb_DeviceHandle), /*tp_basicsize*/
-    0,                         /*tp_itemsize*/
-    Py_usb_DeviceHandle_del,   /*tp_dealloc*/
-    0,                         /*tp_print*/
-    0,                         /*tp_getattr*/
-    0,                         /*tp_setattr*/
-    0,                         /*tp_compare*/
-    0,                         /*tp_repr*/
-    0,                         /*tp_as_number*/
-    0,                         /*tp_as_sequence*/
-    0,                         /*tp_as_mapping*/
-    0,                         /*tp_hash */
-    0,                         /*tp_call*/
-	0,                         /*tp_str*/
-    0,                         /*tp_getattro*/
-    0,                         /*tp_setattro*/
-    0,                         /*tp_as_buffer*/
-    Py_TPFLAGS_DEFAULT | Py_TPFLAGS_BASETYPE,        /*tp_flags*/
-    "DeviceHandle object",     /* tp_doc */
-    0,                         /* tp_traverse */
-    0,                         /* tp_clear */
-    0,                         /* tp_richcompare */
-    0,                         /* tp_weaklistoffset */
-    0,                         /* tp_iter */
-    0,                         /* tp_iternext */
-    Py_usb_DeviceHandle_Methods, /* tp_methods */
-    Py_usb_DeviceHandle_Members, /* tp_members */
-    0,                         /* tp_getset */
-    0,                         /* tp_base */
-    0,                         /* tp_dict */
-    0,                         /* tp_descr_get */
-    0,                         /* tp_descr_set */
-    0,                         /* tp_dictoffset */
-    0,					       /* tp_init */
-    0,                         /* tp_alloc */
-    PyType_GenericNew,         /* tp_new */
-	0,
-	0,
-	0,
-	0,
-	0,
-	0,
-	0,
-	0						/* destructor */
-};
+	Py_RETURN_NONE;
+}
 
-PYUSB_STATIC Py_usb_DeviceHandle *new_DeviceHandle(
-	Py_usb_Device *device
+PYUSB_STATIC PyObject *getSysfsRoot(
+	PyObject *self,
+	PyObject *args
 	)
 {
-	Py_usb_DeviceHandle *dh;
-	struct usb_dev_handle *h;
+#if PYUSB_SYSFS
+	if (sysfsRoot) {
+		Py_INCREF(sysfsRoot);
+		return sysfsRoot;
+	}
+#endif /* PYUSB_SYSFS */
 
-	dh = PyObject_NEW(Py_usb_DeviceHandle, &Py_usb_DeviceHandle_Type);
+	Py_RETURN_NONE;
+}
 
-	if (dh) {
-		h = usb_open(device->dev);
+PYUSB_STATIC PyObject *setResultFormat(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	int format;
 
-		if (!h) {
-			PyUSB_Error();
-			Py_DECREF((PyObject *) dh);
-			return NULL;
-		}
+	format = py_NumberAsInt(args);
+	if (PyErr_Occurred() || checkResultFormat(format) < 0) return NULL;
 
-		dh->deviceHandle = h;
-		dh->interfaceClaimed = -1;
-	}
+	resultFormat = format;
+	Py_RETURN_NONE;
+}
 
-	return dh;
+PYUSB_STATIC PyObject *getResultFormat(
+	PyObject *self,
+	PyObject *args
+	)
+{
+	return PyInt_FromLong(resultFormat);
 }
 
 /*
- * Global functions
+ * Handle of an object given to usb.poll
  */
+PYUSB_STATIC Py_usb_DeviceHandle *pollHandle(
+	PyObject *obj
+	)
+{
+	if (PyObject_TypeCheck(obj, &Py_usb_Transfer_Type))
+		return ((Py_usb_Transfer *) obj)->handle;
 
-PYUSB_STATIC PyObject *busses(
+	if (PyObject_TypeCheck(obj, &Py_usb_DeviceHandle_Type))
+		return (Py_usb_DeviceHandle *) obj;
+
+	PyErr_SetString(PyExc_TypeError, "poll takes DeviceHandle and Transfer objects");
+	return NULL;
+}
+
+/*
+ * def poll(objects, timeout = -1)
+ */
+PYUSB_STATIC PyObject *usbPoll(
 	PyObject *self,
 	PyObject *args
 	)
 {
-	PyObject *tuple;
-	struct usb_bus *bus, *b;
-	u_int32_t i;
+	PyObject *list;
+	PyObject *seq;
+	PyObject *result = NULL;
+	Py_usb_DeviceHandle **ready = NULL;
+	int numReady = 0;
+	int timeout = -1;
+	Py_ssize_t n, i;
+	int j;
+#if PYUSB_USBFS
+	struct epoll_event *events = NULL;
+	struct timespec deadline;
+	int epfd = -1;
+	int numFds = 0;
+	int remaining = -1;
+	int wait, next;
+	int err;
+#endif /* PYUSB_USBFS */
+
+	if (!PyArg_ParseTuple(args, "O|i", &list, &timeout)) return NULL;
+
+	seq = PySequence_Fast(list, "objects must be a sequence");
+	if (!seq) return NULL;
+
+	n = PySequence_Fast_GET_SIZE(seq);
+
+	for (i = 0; i < n; ++i)
+		if (!pollHandle(PySequence_Fast_GET_ITEM(seq, i))) goto done;
+
+	ready = (Py_usb_DeviceHandle **) PyMem_Malloc((n ? n : 1) * sizeof(*ready));
+
+	if (!ready) {
+		PyErr_NoMemory();
+		goto done;
+	}
 
-	if (usb_find_busses() < 0) {
-		PyUSB_Error();
-		return NULL;
+#if PYUSB_USBFS
+	events = (struct epoll_event *) PyMem_Malloc((n ? n : 1) * sizeof(*events));
+
+	if (!events) {
+		PyErr_NoMemory();
+		goto done;
 	}
 
-	if (usb_find_devices() < 0) {
-		PyUSB_Error();
-		return NULL;
+	epfd = epoll_create(n ? (int) n : 1);
+
+	if (epfd < 0) {
+		PyErr_SetFromErrno(PyExc_OSError);
+		goto done;
 	}
 
-	bus = usb_get_busses();
+	for (i = 0; i < n; ++i) {
+		Py_usb_DeviceHandle *handle = pollHandle(PySequence_Fast_GET_ITEM(seq, i));
+		struct epoll_event ev;
 
-	if (!bus) {
-		PyUSB_Error();
-		return NULL;
+		if (handle->engine.fd < 0) continue;
+
+		ev.events = EPOLLOUT;
+		ev.data.ptr = handle;
+
+		if (epoll_ctl(epfd, EPOLL_CTL_ADD, handle->engine.fd, &ev) < 0) {
+			if (errno == EEXIST) continue;
+			PyErr_SetFromErrno(PyExc_OSError);
+			goto done;
+		}
+
+		++numFds;
 	}
 
-	for(i=0,b=bus;b;b=b->next) ++i;
-	tuple = PyTuple_New(i);
-	if (!tuple) return NULL;
+	if (timeout > 0) setDeadline(&deadline, timeout);
+#endif /* PYUSB_USBFS */
 
-	for(b=bus,i=0;b;++i,b=b->next)
-		PyTuple_SET_ITEM(tuple, i, (PyObject *) new_Bus(b));
+	for (;;) {
+		result = PyList_New(0);
+		if (!result) goto done;
 
-	if (PyErr_Occurred()) {
-		Py_DECREF(tuple);
-		return NULL;
+		/* a handle is ready if completions were reaped, a transfer if done */
+		for (i = 0; i < n; ++i) {
+			PyObject *obj = PySequence_Fast_GET_ITEM(seq, i);
+			int isReady = 0;
+
+			if (PyObject_TypeCheck(obj, &Py_usb_Transfer_Type)) {
+				isReady = ((Py_usb_Transfer *) obj)->request.done;
+			} else {
+				for (j = 0; j < numReady && !isReady; ++j)
+					isReady = ready[j] == (Py_usb_DeviceHandle *) obj;
+			}
+
+			if (isReady && PyList_Append(result, obj) < 0) {
+				Py_CLEAR(result);
+				goto done;
+			}
+		}
+
+#if PYUSB_USBFS
+		if (PyList_GET_SIZE(result) || !numFds || !timeout) break;
+
+		if (timeout > 0) {
+			remaining = msLeft(&deadline);
+			if (!remaining) break;
+		}
+
+		Py_DECREF(result);
+		result = NULL;
+
+		/* expired transfers are discarded, wake up for the next one */
+		wait = remaining;
+
+		for (i = 0; i < n; ++i) {
+			Py_usb_DeviceHandle *handle = pollHandle(PySequence_Fast_GET_ITEM(seq, i));
+
+			if (handle->engine.fd < 0) continue;
+
+			next = engineDeadline(&handle->engine);
+			if (next >= 0 && (wait < 0 || next < wait)) wait = next;
+		}
+
+		Py_BEGIN_ALLOW_THREADS
+
+		numReady = epoll_wait(epfd, events, (int) n, wait);
+		err = errno;
+
+		for (j = 0; j < numReady; ++j) {
+			ready[j] = (Py_usb_DeviceHandle *) events[j].data.ptr;
+			engineWait(&ready[j]->engine, NULL, 0);
+		}
+
+		Py_END_ALLOW_THREADS
+
+		if (numReady < 0) {
+			numReady = 0;
+
+			if (err != EINTR) {
+				errno = err;
+				PyErr_SetFromErrno(PyExc_OSError);
+				goto done;
+			}
+
+			if (PyErr_CheckSignals() < 0) goto done;
+		}
+
+		for (j = 0; j < numReady; ++j)
+			engineSweep(&ready[j]->engine);
+#else
+		break;
+#endif /* PYUSB_USBFS */
 	}
 
-	return tuple;
+done:
+#if PYUSB_USBFS
+	if (epfd >= 0) close(epfd);
+	PyMem_Free(events);
+#endif /* PYUSB_USBFS */
+	PyMem_Free(ready);
+	Py_DECREF(seq);
+
+	return result;
 }
 
 PYUSB_STATIC PyMethodDef usb_Methods[] = {
 	{"busses", busses, METH_NOARGS, "Returns a tuple with the usb busses"},
+
+	{"find",
+	 (PyCFunction) find,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "find(**criteria) -> Device or None\n\n"
+	 "Rescans the busses and returns the first device matching all\n"
+	 "the criteria given as keyword arguments, or None. Only the\n"
+	 "matching device gets a Device object.\n"
+	 "Criteria:\n"
+	 "\tidVendor, idProduct, deviceClass, deviceSubClass,\n"
+	 "\tdeviceProtocol: device descriptor fields.\n"
+	 "\tinterfaceClass, interfaceSubClass, interfaceProtocol: fields\n"
+	 "\t    that one of the alternate settings must have.\n"
+	 "\tbus: dirname of the bus.\n"
+	 "\tmanufacturer, product, serial: string descriptors. The\n"
+	 "\t    device is opened to read them, devices that cannot be\n"
+	 "\t    opened do not match.\n"},
+
+	{"openAll",
+	 (PyCFunction) openAll,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "openAll(devices, configuration=-1, interface=-1, altsetting=-1)\n"
+	 "    -> list\n\n"
+	 "Opens all the Device objects of the sequence devices at once, on\n"
+	 "native threads, and sets each of them up like the DeviceHandle\n"
+	 "methods setConfiguration, claimInterface and setAltInterface\n"
+	 "would, in that order. The steps whose argument is -1 are skipped.\n"
+	 "Returns a list with, for each device, its DeviceHandle or the\n"
+	 "USBError that stopped its setup; the errno attribute of the\n"
+	 "error tells why. A device that failed is left closed. Only the\n"
+	 "argument errors are raised."},
+
+	{"findAll",
+	 (PyCFunction) findAll,
+	 METH_VARARGS | METH_KEYWORDS,
+	 "findAll(**criteria) -> list\n\n"
+	 "Returns the list of all the devices matching the criteria.\n"
+	 "See find.\n"},
+
+	{"refresh",
+	 refresh,
+	 METH_NOARGS,
+	 "refresh() -> (added, removed)\n\n"
+	 "Rescans the busses and returns the lists of the Device objects\n"
+	 "attached and detached since the previous call (all the devices\n"
+	 "on the first call). The Device objects of unchanged devices are\n"
+	 "kept, so busses() returns the same objects until they change.\n"},
+
+	{"poll",
+	 usbPoll,
+	 METH_VARARGS,
+	 "poll(objects, timeout=-1) -> list\n\n"
+	 "Waits for completions on several handles at once.\n"
+	 "Arguments:\n"
+	 "\tobjects: sequence of DeviceHandle and Transfer objects.\n"
+	 "\ttimeout: maximum time to wait in miliseconds, -1 waits\n"
+	 "\t         forever and 0 does not wait. (default: -1)\n"
+	 "Returns the list of the objects ready: transfers that are done,\n"
+	 "and handles for which completions were reaped during the call.\n"
+	 "The list is empty if the timeout expired, or if none of the\n"
+	 "handles has a pollable descriptor (see DeviceHandle.fileno).\n"},
+
+	{"setSysfsRoot",
+	 setSysfsRoot,
+	 METH_O,
+	 "setSysfsRoot(path) -> None\n\n"
+	 "Enumerates the devices from the sysfs directory path, normally\n"
+	 "'/sys/bus/usb/devices', instead of through libusb. The descriptors\n"
+	 "are read from the copies cached by the kernel, so enumerating does\n"
+	 "not open the device nodes nor resume suspended devices. None goes\n"
+	 "back to libusb. The Device objects enumerated before the call can\n"
+	 "no longer be opened. Ignored where sysfs is not supported, see\n"
+	 "getSysfsRoot."},
+
+	{"getSysfsRoot",
+	 getSysfsRoot,
+	 METH_NOARGS,
+	 "getSysfsRoot() -> path or None\n\n"
+	 "Returns the directory set by setSysfsRoot, None if devices are\n"
+	 "enumerated through libusb."},
+
+	{"saveSnapshot",
+	 saveSnapshot,
+	 METH_VARARGS,
+	 "saveSnapshot(path) -> None\n\n"
+	 "Rescans the busses and saves the descriptors of all the devices,\n"
+	 "extra descriptors included, to the file path, for loadSnapshot.\n"
+	 "The file is replaced at once. Does nothing where snapshots are\n"
+	 "not supported."},
+
+	{"loadSnapshot",
+	 loadSnapshot,
+	 METH_O,
+	 "loadSnapshot(path) -> count\n\n"
+	 "Maps a file written by saveSnapshot and enumerates the devices\n"
+	 "from it instead of scanning the busses or sysfs, until\n"
+	 "loadSnapshot(None) or setSysfsRoot is called. Rescans only drop\n"
+	 "the devices whose device node is gone; devices attached since\n"
+	 "the snapshot was saved are not seen. The Device objects\n"
+	 "enumerated before the call can no longer be opened. Returns the\n"
+	 "number of devices still present, 0 where snapshots are not\n"
+	 "supported. Raises ValueError if path is not a snapshot of this\n"
+	 "version."},
+
+	{"setResultFormat",
+	 setResultFormat,
+	 METH_O,
+	 "setResultFormat(format) -> None\n\n"
+	 "Sets the default type of the data returned by the read methods\n"
+	 "of DeviceHandle objects opened afterwards. format is one of\n"
+	 "FORMAT_TUPLE (default), FORMAT_BYTES, FORMAT_BYTEARRAY or FORMAT_ARRAY."},
+
+	{"getResultFormat",
+	 getResultFormat,
+	 METH_NOARGS,
+	 "getResultFormat() -> format\n\n"
+	 "Returns the default format set by setResultFormat."},
+
 	{NULL, NULL}
 };
 
@@ -2134,6 +10468,9 @@ PYUSB_STATIC PyMethodDef usb_Methods[] = {
 PyMODINIT_FUNC initusb(void)
 {
 	PyObject *module;
+#if PYUSB_THREADS
+	pthread_mutexattr_t attr;
+#endif /* PYUSB_THREADS */
 
 	module = Py_InitModule3("usb", usb_Methods,"USB access module");
 	if (!module) return;
@@ -2143,6 +10480,26 @@ PyMODINIT_FUNC initusb(void)
 	PyModule_AddObject(module, "USBError", PyExc_USBError);
 	Py_INCREF(PyExc_USBError);
 
+	PyExc_USBTimeoutError = PyErr_NewException("usb.USBTimeoutError", PyExc_USBError, NULL);
+	if (!PyExc_USBTimeoutError) return;
+	PyModule_AddObject(module, "USBTimeoutError", PyExc_USBTimeoutError);
+	Py_INCREF(PyExc_USBTimeoutError);
+
+	PyExc_USBPipeError = PyErr_NewException("usb.USBPipeError", PyExc_USBError, NULL);
+	if (!PyExc_USBPipeError) return;
+	PyModule_AddObject(module, "USBPipeError", PyExc_USBPipeError);
+	Py_INCREF(PyExc_USBPipeError);
+
+	PyExc_USBNoDeviceError = PyErr_NewException("usb.USBNoDeviceError", PyExc_USBError, NULL);
+	if (!PyExc_USBNoDeviceError) return;
+	PyModule_AddObject(module, "USBNoDeviceError", PyExc_USBNoDeviceError);
+	Py_INCREF(PyExc_USBNoDeviceError);
+
+	PyExc_USBOverflowError = PyErr_NewException("usb.USBOverflowError", PyExc_USBError, NULL);
+	if (!PyExc_USBOverflowError) return;
+	PyModule_AddObject(module, "USBOverflowError", PyExc_USBOverflowError);
+	Py_INCREF(PyExc_USBOverflowError);
+
 	if (PyType_Ready(&Py_usb_Endpoint_Type) < 0) return;
 	Py_INCREF(&Py_usb_Endpoint_Type);
 	PyModule_AddObject(module, "Endpoint", (PyObject *) &Py_usb_Endpoint_Type);
@@ -2167,6 +10524,33 @@ PyMODINIT_FUNC initusb(void)
 	Py_INCREF(&Py_usb_DeviceHandle_Type);
 	PyModule_AddObject(module, "DeviceHandle", (PyObject *) &Py_usb_DeviceHandle_Type);
 
+	if (PyType_Ready(&Py_usb_Transfer_Type) < 0) return;
+	Py_INCREF(&Py_usb_Transfer_Type);
+	PyModule_AddObject(module, "Transfer", (PyObject *) &Py_usb_Transfer_Type);
+
+	if (PyType_Ready(&Py_usb_Monitor_Type) < 0) return;
+	Py_INCREF(&Py_usb_Monitor_Type);
+	PyModule_AddObject(module, "Monitor", (PyObject *) &Py_usb_Monitor_Type);
+
+#if PYUSB_THREADS
+	if (PyType_Ready(&Py_usb_StreamReader_Type) < 0) return;
+	Py_INCREF(&Py_usb_StreamReader_Type);
+	PyModule_AddObject(module, "StreamReader", (PyObject *) &Py_usb_StreamReader_Type);
+#endif /* PYUSB_THREADS */
+
+#if PYUSB_THREADS
+	/* the lock is taken again by the objects built while holding it */
+	pthread_mutexattr_init(&attr);
+	pthread_mutexattr_settype(&attr, PTHREAD_MUTEX_RECURSIVE);
+	pthread_mutex_init(&enumMutex, &attr);
+	pthread_mutexattr_destroy(&attr);
+#endif /* PYUSB_THREADS */
+
+	knownDevices = PyDict_New();
+	knownBusses = PyDict_New();
+	refreshed = PyDict_New();
+	if (!knownDevices || !knownBusses || !refreshed) return;
+
 	installModuleConstants(module);
 
 	usb_init();
@@ -16,8 +16,83 @@
 #include <windows.h>
 #endif /* _WIN32 */
 
+/*
+ * Asynchronous transfers use the Linux usbfs URB interface on
+ * the file descriptor opened by libusb. Elsewhere, submitted
+ * transfers are performed synchronously.
+ */
+#ifndef PYUSB_USBFS
+#if defined(__linux__)
+#define PYUSB_USBFS 1
+#else
+#define PYUSB_USBFS 0
+#endif /* __linux__ */
+#endif /* PYUSB_USBFS */
+
+/*
+ * Native threads (StreamReader) use POSIX threads
+ */
+#ifndef PYUSB_THREADS
+#if PYUSB_USBFS || defined(__unix__) || defined(__APPLE__)
+#define PYUSB_THREADS 1
+#else
+#define PYUSB_THREADS 0
+#endif
+#endif /* PYUSB_THREADS */
+
+/*
+ * Enumeration from the Linux sysfs
+ */
+#ifndef PYUSB_SYSFS
+#if defined(__linux__)
+#define PYUSB_SYSFS 1
+#else
+#define PYUSB_SYSFS 0
+#endif /* __linux__ */
+#endif /* PYUSB_SYSFS */
+
+#if PYUSB_THREADS
+#include <errno.h>
+#include <time.h>
+#include <sys/time.h>
+#include <pthread.h>
+#endif /* PYUSB_THREADS */
+
+#if PYUSB_USBFS
+#include <dirent.h>
+#include <poll.h>
+#include <sys/ioctl.h>
+#include <sys/epoll.h>
+#include <linux/usbdevice_fs.h>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <linux/netlink.h>
+#endif /* PYUSB_USBFS */
+
+#if PYUSB_SYSFS
+#include <errno.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#endif /* PYUSB_SYSFS */
+
 #define STRING_ARRAY_SIZE 256
 
+#if (PY_VERSION_HEX < 0x02050000)
+typedef int Py_ssize_t;
+#define PY_SSIZE_T_MAX INT_MAX
+#endif
+
+/*
+ * The new buffer interface is available since python 2.6
+ */
+#if (PY_VERSION_HEX >= 0x02060000)
+#define PYUSB_HAS_NEW_BUFFER 1
+#else
+#define PYUSB_HAS_NEW_BUFFER 0
+#endif /* PY_VERSION_HEX */
+
 #define PYUSB_STATIC static
 
 #if defined _WIN32 && !defined unix
@@ -40,6 +115,209 @@ typedef unsigned long u_int32_t;
 
 #endif /* _WIN32 */
 
+/*
+ * Types of the object returned by the read methods
+ */
+#define PYUSB_FORMAT_TUPLE 0		/* tuple of ints, the default */
+#define PYUSB_FORMAT_BYTES 1		/* str */
+#define PYUSB_FORMAT_BYTEARRAY 2	/* bytearray, python 2.6 or later */
+#define PYUSB_FORMAT_ARRAY 3		/* array.array('B') */
+
+/*
+ * Transfer buffer pool. Size classes are powers of two
+ * from 64 bytes to 2 MB; bigger blocks are not pooled.
+ */
+#define PYUSB_POOL_CLASSES 16
+#define PYUSB_POOL_CLASS_SIZE(_Class) ((size_t) 64 << (_Class))
+#define PYUSB_POOL_HIGH_WATER (1024 * 1024)
+#define PYUSB_PAGE_SIZE 4096
+
+typedef struct _PyUSB_Pool {
+	void *freeList[PYUSB_POOL_CLASSES];
+	unsigned long highWater;	/* maximum bytes kept in the free lists */
+	unsigned long held;			/* bytes currently in the free lists */
+	unsigned long hits;
+	unsigned long misses;
+	int pageAligned;
+} PyUSB_Pool;
+
+/*
+ * A memory block borrowed from a Python object supporting
+ * the buffer protocol. The object is kept alive (and, with the
+ * new buffer interface, locked against resizing) until
+ * releaseBuffer is called. Generic sequences are converted to
+ * a temporary copy from the handle buffer pool instead.
+ */
+typedef struct _PyUSB_Buffer {
+	char *data;
+	Py_ssize_t size;
+	PyObject *obj;
+	PyUSB_Pool *pool;
+	size_t allocated;		/* size of data if it was taken from pool */
+#if PYUSB_HAS_NEW_BUFFER
+	Py_buffer view;
+	int hasView;
+#endif /* PYUSB_HAS_NEW_BUFFER */
+} PyUSB_Buffer;
+
+/*
+ * Transfer types, the same values as the usbfs URB types
+ */
+#define PYUSB_TRANSFER_ISOCHRONOUS 0
+#define PYUSB_TRANSFER_INTERRUPT 1
+#define PYUSB_TRANSFER_CONTROL 2
+#define PYUSB_TRANSFER_BULK 3
+
+/*
+ * Bulk transfers bigger than this are split in several URBs,
+ * older kernels do not accept bigger ones
+ */
+#define PYUSB_URB_SIZE 16384
+
+/*
+ * Isochronous transfers are split in URBs of at most
+ * this number of packets
+ */
+#define PYUSB_ISO_PACKETS 128
+
+/*
+ * Size of the control transfer setup packet
+ */
+#define PYUSB_SETUP_SIZE 8
+
+/*
+ * Little endian fields of the raw descriptors
+ */
+#define PYUSB_LE16(_Data) ((u_int16_t) ((_Data)[0] | ((_Data)[1] << 8)))
+#define PYUSB_PUT_LE16(_Data, _Value) \
+	((_Data)[0] = (_Value) & 0xff, (_Data)[1] = ((_Value) >> 8) & 0xff)
+
+/*
+ * Standard descriptor types that libusb-0.1 does not define
+ */
+#define PYUSB_DT_DEVICE_QUALIFIER 0x06
+#define PYUSB_DT_OTHER_SPEED_CONFIG 0x07
+#define PYUSB_DT_BOS 0x0f
+
+/*
+ * Maximum number of descriptors open for a single device node
+ * considered when looking for the one opened by usb_open
+ */
+#define PYUSB_MAX_FDS 64
+
+/*
+ * Maximum number of native threads opening devices for openAll,
+ * besides the calling thread
+ */
+#define PYUSB_OPEN_THREADS 31
+
+/*
+ * Endpoints of a DeviceHandle are indexed by address and direction,
+ * both directions of endpoint 0 sharing the index of the control
+ * pipe. Synchronous transfers are serialized per index.
+ */
+#define PYUSB_ENDPOINTS 32
+#define PYUSB_ENDPOINT_INDEX(_Endpoint) \
+	(((_Endpoint) & 0x0f) ? \
+	 ((_Endpoint) & 0x0f) | (((_Endpoint) & USB_ENDPOINT_IN) >> 3) : 0)
+
+/*
+ * Interface numbers that can be claimed through a DeviceHandle
+ */
+#define PYUSB_MAX_INTERFACES 256
+#define PYUSB_CLAIMED(_Claims, _Interface) \
+	((_Claims)->claimed[(_Interface) >> 5] & (1U << ((_Interface) & 31)))
+
+/*
+ * Interval, in miliseconds, at which a StreamReader thread
+ * blocked on the device checks if it was stopped
+ */
+#define PYUSB_STREAM_POLL 100
+
+/*
+ * Native work on the device lists, done with the enumeration lock
+ * held. Without native threads there is no such lock and the GIL
+ * protects the lists.
+ */
+#if PYUSB_THREADS
+#define PYUSB_ENUM_BEGIN_ALLOW_THREADS Py_BEGIN_ALLOW_THREADS
+#define PYUSB_ENUM_END_ALLOW_THREADS Py_END_ALLOW_THREADS
+#else
+#define PYUSB_ENUM_BEGIN_ALLOW_THREADS {
+#define PYUSB_ENUM_END_ALLOW_THREADS }
+#endif /* PYUSB_THREADS */
+
+/*
+ * A piece of a transfer made of several memory blocks
+ */
+typedef struct _PyUSB_Segment {
+	char *data;
+	int size;
+} PyUSB_Segment;
+
+/*
+ * An operation of DeviceHandle.execute
+ */
+typedef struct _PyUSB_Op {
+	int type;					/* PYUSB_TRANSFER_* */
+	int endpoint;
+	int requestType;
+	int request;
+	int value;
+	int index;
+	int timeout;
+	int isRead;
+	int status;					/* bytes transferred or a negative errno */
+	PyUSB_Buffer buffer;
+} PyUSB_Op;
+
+/*
+ * Native state of a submitted transfer
+ */
+typedef struct _PyUSB_Request PyUSB_Request;
+
+/*
+ * Called without the GIL, from the thread that reaped
+ * the last URB of the request
+ */
+typedef void (*PyUSB_Callback)(PyUSB_Request *);
+
+struct _PyUSB_Request {
+	PyUSB_Request *next;		/* links in the engine lists */
+	PyUSB_Request *prev;
+	int done;
+	int status;					/* 0 or a negative errno */
+	int actualLength;
+	PyUSB_Callback complete;
+	void *context;
+	PyObject *owner;			/* released by engineSweep when done */
+#if PYUSB_USBFS
+	int numUrbs;
+	int urbsPending;
+	int shortPacket;
+	int timeout;				/* miliseconds, 0 for none, see engineExpire */
+	int expired;
+	struct timespec deadline;
+	struct usbdevfs_urb *urbs;	/* &urb or an allocated array */
+	size_t urbStride;			/* distance between two URBs in urbs */
+	struct usbdevfs_urb urb;	/* must be the last member */
+#endif /* PYUSB_USBFS */
+};
+
+#if PYUSB_USBFS
+/*
+ * URB submission and reaping state of a DeviceHandle
+ */
+typedef struct _PyUSB_Engine {
+	int fd;						/* usbfs descriptor of the handle, -1 if unknown */
+	int reaping;				/* a thread is reaping completions */
+	PyUSB_Request *pending;		/* requests with URBs in flight */
+	PyUSB_Request *finished;	/* done requests whose owner must be released */
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+} PyUSB_Engine;
+#endif /* PYUSB_USBFS */
+
 /*
  * EndpointDescriptor object
  */
@@ -50,6 +328,7 @@ typedef struct _Py_usb_Endpoint {
 	u_int16_t maxPacketSize;
 	u_int8_t interval;
 	u_int8_t refresh;
+	PyObject *extra;			/* view of the configuration raw descriptor */
 } Py_usb_Endpoint;
 
 
@@ -64,7 +343,12 @@ typedef struct _Py_usb_Interface {
 	u_int8_t interfaceSubClass;
 	u_int8_t interfaceProtocol;
 	u_int8_t iInterface;
-	PyObject *endpoints;
+	PyObject *endpoints;		/* built on first access */
+	PyObject *device;			/* owner of the descriptor */
+	PyObject *raw;				/* of the configuration */
+	PyObject *extra;			/* view of raw */
+	struct usb_config_descriptor *config;
+	struct usb_interface_descriptor *descriptor;
 } Py_usb_Interface;
 
 /*
@@ -78,7 +362,11 @@ typedef struct _Py_usb_Configuration {
 	u_int8_t selfPowered;
 	u_int8_t remoteWakeup;
 	u_int16_t maxPower;
-	PyObject *interfaces;
+	PyObject *interfaces;		/* built on first access */
+	PyObject *device;			/* owner of the descriptor */
+	PyObject *raw;				/* raw descriptor, built on first access */
+	PyObject *extra;			/* view of raw */
+	struct usb_config_descriptor *descriptor;
 } Py_usb_Configuration;
 
 /*
@@ -99,10 +387,63 @@ typedef struct _Py_usb_Device {
 	u_int8_t iSerialNumber;
     u_int8_t devnum;
 	char filename[PATH_MAX + 1];
-	PyObject *configurations;
+	PyObject *configurations;	/* built on first access */
+	PyObject *cache;			/* descriptors read, NULL if not cached */
+	unsigned long cacheHits;
+	unsigned long cacheMisses;
 	struct usb_device *dev; // necessary for usb_open
 } Py_usb_Device;
 
+/*
+ * Opening of a device, done without the GIL by new_DeviceHandle
+ * and by the threads of openAll
+ */
+typedef struct _PyUSB_Open {
+	struct usb_device *dev;		/* NULL if the device was removed */
+	int configuration;			/* set if >= 0 */
+	int interface;				/* claimed if >= 0 */
+	int altsetting;				/* selected if >= 0 */
+	usb_dev_handle *handle;		/* NULL if a step failed */
+	int fd;						/* usbfs descriptor, -1 if unknown */
+	const char *failed;			/* step that failed */
+	int ret;					/* its negative errno */
+} PyUSB_Open;
+
+/*
+ * Interfaces claimed through a DeviceHandle, with the alternate
+ * setting selected for each, and the endpoints they use. Changed
+ * with the lock of endpoint 0 held.
+ */
+typedef struct _PyUSB_Claims {
+	int count;
+	int current;				/* interface libusb sets alternate settings for, or -1 */
+	int configuration;			/* set through the handle, or -1 */
+	u_int32_t claimed[PYUSB_MAX_INTERFACES / 32];
+	unsigned char altSetting[PYUSB_MAX_INTERFACES];
+	int mapped;					/* endpoints found in the descriptors */
+	short owner[PYUSB_ENDPOINTS];	/* claimed interface using the endpoint, or -1 */
+	int packetSize[PYUSB_ENDPOINTS];
+} PyUSB_Claims;
+
+#if PYUSB_THREADS
+/*
+ * Lock of an endpoint of a DeviceHandle, the counters are
+ * updated with the lock held
+ */
+typedef struct _PyUSB_EndpointLock {
+	pthread_mutex_t mutex;
+	unsigned long acquired;
+	unsigned long contended;	/* times a thread had to wait */
+} PyUSB_EndpointLock;
+
+typedef struct _PyUSB_OpenBatch {
+	PyUSB_Open *ops;
+	int count;
+	int next;					/* next op to run */
+	pthread_mutex_t lock;
+} PyUSB_OpenBatch;
+#endif /* PYUSB_THREADS */
+
 /*
  * Bus Object
  */
@@ -119,37 +460,208 @@ typedef struct _Py_usb_Bus {
 typedef struct _Py_usb_DeviceHandle {
 	PyObject_HEAD
 	usb_dev_handle *deviceHandle;
-	int interfaceClaimed;
+	Py_usb_Device *device;		/* holds the descriptor cache */
+	PyUSB_Claims claims;
+	int resultFormat;
+	PyUSB_Pool pool;
+#if PYUSB_USBFS
+	PyUSB_Engine engine;
+#endif /* PYUSB_USBFS */
+#if PYUSB_THREADS
+	PyUSB_EndpointLock locks[PYUSB_ENDPOINTS];
+#endif /* PYUSB_THREADS */
 } Py_usb_DeviceHandle;
 
+/*
+ * Transfer object, an asynchronous transfer submitted
+ * by a DeviceHandle
+ */
+typedef struct _Py_usb_Transfer {
+	PyObject_HEAD
+	Py_usb_DeviceHandle *handle;
+	int type;
+	int endpoint;
+	int isRead;
+	int readInto;				/* the data goes to a caller buffer */
+	int format;
+	int packetSize;				/* of isochronous transfers */
+	PyUSB_Buffer buffer;
+	PyUSB_Buffer control;		/* setup packet and data of control transfers */
+	PyObject *callbacks;		/* list of done callbacks, or NULL */
+	PyObject *result;
+	PyUSB_Request request;		/* must be the last member */
+} Py_usb_Transfer;
+
+#if PYUSB_THREADS
+/*
+ * StreamReader object, keeps bulk reads queued on an endpoint
+ * from a native thread and stores the data in a ring buffer
+ */
+typedef struct _Py_usb_StreamReader {
+	PyObject_HEAD
+	Py_usb_DeviceHandle *handle;
+	int endpoint;
+	int transferSize;
+	int depth;					/* transfers kept in flight */
+	int started;				/* the thread must be joined */
+	int running;				/* the thread has not exited */
+	int stop;					/* the thread was asked to exit */
+	int status;					/* 0 or the negative errno that stopped the thread */
+	char *ring;
+	size_t ringSize;
+	size_t head;				/* total bytes stored in the ring */
+	size_t tail;				/* total bytes read from the ring */
+	unsigned long overruns;		/* transfers not fully stored, ring full */
+	unsigned long bytesLost;
+	char *data;					/* depth * transferSize bytes */
+	pthread_t thread;
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+#if PYUSB_USBFS
+	PyUSB_Request *requests;
+#endif /* PYUSB_USBFS */
+} Py_usb_StreamReader;
+#endif /* PYUSB_THREADS */
+
+#if PYUSB_SYSFS
+/*
+ * Device built from its raw descriptors, from sysfs or a
+ * snapshot. The extra descriptors point into the raw descriptors.
+ */
+typedef struct _PyUSB_RawDevice {
+	struct usb_device dev;		/* first, a usb_device pointer is the node */
+	unsigned char *raw;			/* device then configuration descriptors */
+	size_t rawSize;
+	int owned;					/* raw was allocated with malloc */
+} PyUSB_RawDevice;
+
+
+/*
+ * Snapshot file: a header, then a record per device followed by
+ * the bus dirname, the device filename and the raw descriptors.
+ * Records are padded to 4 bytes. Fields are in host byte order,
+ * snapshots are meant to be loaded on the machine that saved them.
+ */
+#define PYUSB_SNAPSHOT_MAGIC "PYUSBSNP"
+#define PYUSB_SNAPSHOT_VERSION 1
+#define PYUSB_SNAPSHOT_ALIGN(_Size) (((_Size) + 3) & ~(size_t) 3)
+
+typedef struct _PyUSB_SnapshotHeader {
+	char magic[8];
+	u_int32_t version;
+	u_int32_t count;			/* number of records */
+} PyUSB_SnapshotHeader;
+
+typedef struct _PyUSB_SnapshotRecord {
+	u_int32_t size;				/* of the record, padding included */
+	u_int32_t location;			/* of the bus */
+	u_int32_t rawSize;
+	u_int16_t dirnameSize;
+	u_int16_t filenameSize;
+	u_int8_t devnum;
+	u_int8_t reserved[3];
+} PyUSB_SnapshotRecord;
+#endif /* PYUSB_SYSFS */
+
+/*
+ * Criteria of usb.find, -1 or NULL when not given
+ */
+typedef struct _PyUSB_Match {
+	int idVendor;
+	int idProduct;
+	int deviceClass;
+	int deviceSubClass;
+	int deviceProtocol;
+	int interfaceClass;
+	int interfaceSubClass;
+	int interfaceProtocol;
+	char *bus;					/* bus dirname */
+	char *manufacturer;
+	char *product;
+	char *serial;
+} PyUSB_Match;
+
+/*
+ * Monitor object
+ */
+#define PYUSB_UEVENT_SIZE 8192
+
+typedef struct _Py_usb_Monitor {
+	PyObject_HEAD
+	int fd;						/* kernel uevent socket, -1 when polling */
+	int interval;				/* rescan period in miliseconds when polling */
+	PyObject *devices;			/* devices as of the last receive */
+} Py_usb_Monitor;
+
 /*
  * Functions prototypes
  */
 
+PYUSB_STATIC void Py_usb_Transfer_finished(
+	PyObject *self
+	);
+
+PYUSB_STATIC size_t rawConfig(
+	struct usb_config_descriptor *config,
+	unsigned char *out,
+	const unsigned char *find,
+	size_t *found
+	);
+
+PYUSB_STATIC PyObject *extraView(
+	PyObject *raw,
+	struct usb_config_descriptor *config,
+	const unsigned char *extra,
+	int extralen
+	);
+
 PYUSB_STATIC void set_Endpoint_fields(
 	Py_usb_Endpoint *endpoint,
-	struct usb_endpoint_descriptor *ep
+	struct usb_endpoint_descriptor *ep,
+	PyObject *extra
 	);
 
 PYUSB_STATIC Py_usb_Endpoint *new_Endpoint(
-	struct usb_endpoint_descriptor *ep
+	struct usb_endpoint_descriptor *ep,
+	PyObject *extra
+	);
+
+PYUSB_STATIC void enumLock(
+	void
+	);
+
+PYUSB_STATIC void enumUnlock(
+	void
+	);
+
+PYUSB_STATIC int deviceAlive(
+	PyObject *device
 	);
 
 PYUSB_STATIC void set_Interface_fields(
 	Py_usb_Interface *interface,
-	struct usb_interface_descriptor *i
+	PyObject *device,
+	PyObject *raw,
+	struct usb_config_descriptor *config,
+	struct usb_interface_descriptor *i,
+	PyObject *extra
 	);
 
 PYUSB_STATIC Py_usb_Interface *new_Interface(
+	PyObject *device,
+	PyObject *raw,
+	struct usb_config_descriptor *config,
 	struct usb_interface_descriptor *i
 	);
 
 PYUSB_STATIC void set_Configuration_fields(
 	Py_usb_Configuration *configuration,
+	PyObject *device,
 	struct usb_config_descriptor *config
 	);
 
 PYUSB_STATIC Py_usb_Configuration *new_Configuration(
+	PyObject *device,
 	struct usb_config_descriptor *conf
 	);
 
@@ -167,6 +679,11 @@ PYUSB_STATIC Py_usb_Device *new_Device(
 	struct usb_device *dev
 	);
 
+PYUSB_STATIC int busUnchanged(
+	Py_usb_Bus *bus,
+	struct usb_bus *b
+	);
+
 PYUSB_STATIC Py_usb_Bus *new_Bus(
 	struct usb_bus *b
 	);
@@ -204,12 +721,32 @@ PYUSB_STATIC PyObject *Py_usb_DeviceHandle_setAltInterface(
 
 PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkWrite(
 	PyObject *self,
-	PyObject *args
+	PyObject *args,
+	PyObject *kwds
 	);
 
 PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkRead(
 	PyObject *self,
-	PyObject *args
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkWritev(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkReadv(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_bulkReadInto(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
 	);
 
 PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptWrite(
@@ -222,6 +759,24 @@ PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptRead(
 	PyObject *args
 	);
 
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_interruptReadInto(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_controlReadInto(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_configurePool(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
 PYUSB_STATIC PyObject *Py_usb_DeviceHandle_resetEndpoint(
 	PyObject *self,
 	PyObject *args
@@ -237,13 +792,162 @@ PYUSB_STATIC PyObject *Py_usb_DeviceHandle_clearHalt(
 	PyObject *args
 	);
 
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_execute(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_reap(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_fileno(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitBulkRead(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitBulkWrite(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitInterruptRead(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitInterruptWrite(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitControlMsg(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitIsoRead(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_submitIsoWrite(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+#if PYUSB_THREADS
+PYUSB_STATIC PyObject *Py_usb_DeviceHandle_streamReader(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+#endif /* PYUSB_THREADS */
+
 PYUSB_STATIC Py_usb_DeviceHandle *new_DeviceHandle(
 	Py_usb_Device *device
 	);
 
+PYUSB_STATIC int rescanDevices(
+	void
+	);
+
+PYUSB_STATIC PyObject *cachedDevice(
+	struct usb_bus *bus,
+	struct usb_device *dev
+	);
+
+PYUSB_STATIC int scanDevices(
+	void
+	);
+
+PYUSB_STATIC int syncDevices(
+	PyObject *snapshot,
+	PyObject *added,
+	PyObject *removed
+	);
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_receive(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_fileno(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *Py_usb_Monitor_close(
+	PyObject *self,
+	PyObject *args
+	);
+
 PYUSB_STATIC PyObject *busses(
 	PyObject *self,
 	PyObject *args
 	);
 
+PYUSB_STATIC PyObject *refresh(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *find(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *findAll(
+	PyObject *self,
+	PyObject *args,
+	PyObject *kwds
+	);
+
+PYUSB_STATIC PyObject *saveSnapshot(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *loadSnapshot(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *setSysfsRoot(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *getSysfsRoot(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *setResultFormat(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *getResultFormat(
+	PyObject *self,
+	PyObject *args
+	);
+
+PYUSB_STATIC PyObject *usbPoll(
+	PyObject *self,
+	PyObject *args
+	);
+
 #endif /* __pyusb_h__ */
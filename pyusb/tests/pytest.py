@@ -2,6 +2,13 @@
 
 import usb	# importa o nosso modulo
 import sys
+import array
+import errno
+import os
+import shutil
+import struct
+import tempfile
+import threading
 from time import sleep
 
 # Acha um dispositivo no sistema.
@@ -12,6 +19,60 @@ def find_device(busses, idProduct, idVendor):
 			if dev.idProduct == idProduct and dev.idVendor == idVendor:
 				return dev
 
+# Se ok for falso, imprime mensagem de
+# erro do teste e encerra script
+def check(ok, test):
+	if not ok:
+		print "Error in %s test!!!" % test
+		sys.exit(1)
+
+# Retorna True se func(*args, **kwds) levanta exc
+def raises(exc, func, *args, **kwds):
+	try:
+		func(*args, **kwds)
+	except exc:
+		return True
+	return False
+
+# Cria na arvore sysfs falsa root o diretorio de um dispositivo
+# com uma configuracao, uma interface de classe 0xff com um
+# descritor extra, e dois endpoints bulk
+def fake_device(root, name, busnum, devnum, idVendor, idProduct):
+	device = struct.pack("<BBHBBBBHHHBBBB", 18, 1, 0x200, 0, 0, 0, 64,
+		idVendor, idProduct, 0x100, 0, 0, 0, 1)
+	interface = struct.pack("<9B", 9, 4, 0, 0, 2, 0xff, 1, 2, 0)
+	extra = struct.pack("<5B", 5, 0x24, 1, 2, 3)
+	endpoints = struct.pack("<BBBBHB", 7, 5, 0x82, 2, 64, 0) + \
+		struct.pack("<BBBBHB", 7, 5, 0x02, 2, 64, 0)
+	total = 9 + len(interface) + len(extra) + len(endpoints)
+	config = struct.pack("<BBHBBBBB", 9, 2, total, 1, 1, 0, 0x80, 50)
+
+	path = os.path.join(root, name)
+	os.mkdir(path)
+	open(os.path.join(path, "busnum"), "w").write("%d\n" % busnum)
+	open(os.path.join(path, "devnum"), "w").write("%d\n" % devnum)
+	open(os.path.join(path, "descriptors"), "wb").write(
+		device + config + interface + extra + endpoints)
+
+# Cria uma arvore sysfs falsa com os dispositivos 0x1234:0x5678
+# em 091/002 e 0x1234:0x5679 em 092/005 e passa a usa-la.
+# Retorna None onde o backend sysfs nao eh suportado
+def fake_tree():
+	root = tempfile.mkdtemp()
+	fake_device(root, "91-1", 91, 2, 0x1234, 0x5678)
+	fake_device(root, "92-4", 92, 5, 0x1234, 0x5679)
+	os.mkdir(os.path.join(root, "92-4:1.0"))	# interface, ignorada
+	usb.setSysfsRoot(root)
+	if usb.getSysfsRoot() != root:
+		shutil.rmtree(root)
+		return None
+	return root
+
+# Volta para a enumeracao do sistema e apaga a arvore falsa
+def drop_tree(root):
+	usb.setSysfsRoot(None)
+	shutil.rmtree(root)
+
 # Escreve msg no endpoint bulk e depois
 # le, se o que foi lido for igual a msg,
 # teste ok, senao, imprime mensagem de
@@ -24,6 +85,15 @@ def test_bulk(handle, msg):
 		print "Error in bulk test!!!"
 		sys.exit(1)
 
+# mesmo que test_bulk, mas le diretamente em um bytearray
+def test_bulk_into(handle, msg):
+	handle.bulkWrite(0x2, msg, 1000)
+	data = bytearray(len(msg))
+	n = handle.bulkReadInto(0x82, data, 1000)
+	if str(data[:n]) != msg:
+		print "Error in bulk read into test!!!"
+		sys.exit(1)
+
 # mesmo que test_bulk mas para transferencias interrupt
 def test_interrupt(handle, msg):
 	handle.interruptWrite(0x1, msg, 1000)
@@ -33,6 +103,355 @@ def test_interrupt(handle, msg):
 		print "Error in interrupt test!!!"
 		sys.exit(1)
 
+# formato padrao dos resultados no modulo
+def test_result_format():
+	check(usb.getResultFormat() == usb.FORMAT_TUPLE, "result format")
+	usb.setResultFormat(usb.FORMAT_BYTES)
+	check(usb.getResultFormat() == usb.FORMAT_BYTES, "result format")
+	usb.setResultFormat(usb.FORMAT_TUPLE)
+	check(raises(ValueError, usb.setResultFormat, 99), "result format")
+
+# mesmo que test_bulk, mas le uma string
+def test_bulk_bytes(handle, msg):
+	handle.resultFormat = usb.FORMAT_BYTES
+	handle.bulkWrite(0x2, msg, 1000)
+	data = handle.bulkRead(0x82, 1000, 1000)
+	handle.resultFormat = usb.FORMAT_TUPLE
+	check(data == msg, "bulk result format")
+
+# escreve msg a partir de varios tipos de buffer
+def test_bulk_buffers(handle, msg):
+	for data in (bytearray(msg), array.array("B", msg), buffer(msg)):
+		handle.bulkWrite(0x2, data, 1000)
+		data = handle.bulkRead(0x82, 1000, 1000)
+		check("".join([chr(i) for i in data]) == msg, "bulk buffer write")
+
+# as transferencias seguintes reutilizam os buffers do pool
+def test_pool(handle, msg):
+	handle.configurePool(highWater=65536, pageAligned=True)
+	check(handle.poolPageAligned, "buffer pool")
+	hits = handle.poolHits
+	for x in range(4):
+		test_bulk(handle, msg)
+	check(handle.poolHits > hits, "buffer pool")
+	check(handle.poolBytesHeld <= 65536, "buffer pool")
+	handle.configurePool(highWater=0, pageAligned=False)
+	check(handle.poolBytesHeld == 0, "buffer pool")
+	handle.configurePool(highWater=1 << 20)
+
+# mesmo que test_bulk, com transferencias assincronas
+def test_submit(handle, msg):
+	t = handle.submitBulkWrite(0x2, msg, 1000)
+	check(t.type == usb.ENDPOINT_TYPE_BULK, "submit")
+	check(t.result(1000) == len(msg), "submit")
+	t = handle.submitBulkRead(0x82, 1000, 1000)
+	data = t.result(1000)
+	check(t.done() and t.endpoint == 0x82, "submit")
+	check("".join([chr(i) for i in data]) == msg, "submit")
+	t = handle.submitControlMsg(0x80, 0, 2, timeout=1000)
+	check(len(t.result(1000)) == 2, "submit")
+
+# le msg continuamente com um StreamReader
+def test_stream(handle, msg):
+	reader = handle.streamReader(0x82, transferSize=64, depth=2, bufferSize=4096)
+	handle.bulkWrite(0x2, msg, 1000)
+	data = ""
+	while len(data) < len(msg):
+		read = reader.read(-1, 1000)
+		if not read:
+			break
+		data += "".join([chr(i) for i in read])
+	reader.close()
+	check(data == msg and not reader.running, "stream reader")
+	check(raises(ValueError, handle.streamReader, 0x82, transferSize=0), "stream reader")
+
+# o dispositivo nao tem endpoints isocronos,
+# apenas os argumentos sao verificados
+def test_iso_args(handle):
+	check(raises(ValueError, handle.submitIsoRead, 0x82, 0, 64), "isochronous")
+
+# escreve e le as partes de uma mensagem em uma so transferencia
+def test_bulk_vector(handle, parts):
+	msg = "".join(parts)
+	check(handle.bulkWritev(0x2, parts, 1000) == len(msg), "bulk vector")
+	buffers = [bytearray(len(part)) for part in parts]
+	n = handle.bulkReadv(0x82, buffers, 1000)
+	check(n == len(msg), "bulk vector")
+	check("".join([str(b) for b in buffers]) == msg, "bulk vector")
+
+# escrita, leitura e GET_STATUS em uma so chamada
+def test_execute(handle, msg):
+	status, data = handle.execute([
+		(usb.ENDPOINT_TYPE_BULK, 0x2, msg, 1000),
+		(usb.ENDPOINT_TYPE_BULK, 0x82, 1000, 1000),
+		(usb.ENDPOINT_TYPE_CONTROL, 0x80, 0, 0, 0, 2, 1000)])
+	check(list(status) == [len(msg), len(msg), 2], "execute")
+	check(data[0] is None and len(data[2]) == 2, "execute")
+	check("".join([chr(i) for i in data[1]]) == msg, "execute")
+
+	for ops in ([()], [(99, 0x2, msg)], [(usb.ENDPOINT_TYPE_BULK, 0x2)],
+				[(usb.ENDPOINT_TYPE_CONTROL, 0x80, 0, 0, 0, 0x10000)]):
+		check(raises((TypeError, ValueError), handle.execute, ops), "execute")
+
+# mesmo que test_bulk, dividindo as transferencias em pedacos
+def test_bulk_chunks(handle, msg):
+	handle.bulkWrite(0x2, msg, 1000, chunkSize=64)
+	data = handle.bulkRead(0x82, len(msg), 1000, chunkSize=64, depth=2)
+	check("".join([chr(i) for i in data]) == msg, "chunked bulk")
+	check(raises(ValueError, handle.bulkRead, 0x82, 64, 1000, 64, 0), "chunked bulk")
+
+# argumentos de usb.poll
+def test_poll_args():
+	check(usb.poll([], 0) == [], "poll")
+	check(raises(TypeError, usb.poll, [1], 0), "poll")
+
+# espera pela escrita de msg com usb.poll
+def test_poll(handle, msg):
+	t = handle.submitBulkWrite(0x2, msg, 1000)
+	check(t in usb.poll([handle, t], 1000), "poll")
+	check(t.result(0) == len(msg), "poll")
+	data = handle.bulkRead(0x82, 1000, 1000)
+	check("".join([chr(i) for i in data]) == msg, "poll")
+
+# a callback roda uma vez quando a transferencia termina
+def test_done_callback(handle, msg):
+	done = []
+	t = handle.submitBulkWrite(0x2, msg, 1000)
+	t.addDoneCallback(done.append)
+	t.result(1000)
+	handle.reap()
+	check(done == [t], "done callback")
+	check(raises(TypeError, t.addDoneCallback, None), "done callback")
+	handle.bulkRead(0x82, 1000, 1000)
+
+# o monitor comeca com os dispositivos conectados
+def test_monitor():
+	check(raises(ValueError, usb.Monitor, interval=0), "monitor")
+	monitor = usb.Monitor(interval=10)
+	count = sum([len(bus.devices) for bus in usb.busses()])
+	check(len(monitor.devices) == count, "monitor")
+	check(monitor.receive(0) == [], "monitor")
+	monitor.close()
+	check(raises(ValueError, monitor.receive, 0), "monitor")
+
+# busses() devolve os mesmos objetos ate que os dispositivos mudem
+def test_refresh():
+	usb.refresh()
+	first = [dev for bus in usb.busses() for dev in bus.devices]
+	second = [dev for bus in usb.busses() for dev in bus.devices]
+	check(len(first) == len(second), "refresh")
+	for a, b in zip(first, second):
+		check(a is b, "refresh")
+	check(usb.refresh() == ([], []), "refresh")
+
+# as configuracoes, interfaces e endpoints sao criados uma so vez
+def test_lazy(dev):
+	check(dev.configurations is dev.configurations, "lazy descriptors")
+	config = dev.configurations[0]
+	check(config.value == 1, "lazy descriptors")
+	check(config.interfaces is config.interfaces, "lazy descriptors")
+	interface = config.interfaces[0][0]
+	check(interface.endpoints is interface.endpoints, "lazy descriptors")
+	addresses = [e.address for e in interface.endpoints]
+	check(0x02 in addresses and 0x82 in addresses, "lazy descriptors")
+
+# argumentos de usb.find
+def test_find_args():
+	check(raises(TypeError, usb.find, 0x555), "find")
+	check(raises(TypeError, usb.find, idVendor="x"), "find")
+	check(raises(TypeError, usb.findAll, unknown=1), "find")
+
+# procura o dispositivo de teste
+def test_find(dev):
+	found = usb.find(idVendor=0x555, idProduct=0xc)
+	check(found is not None and found.filename == dev.filename, "find")
+	check(usb.find(idVendor=0x555, idProduct=0xffff) is None, "find")
+	check(dev.filename in [d.filename for d in usb.findAll(idVendor=0x555)], "find")
+
+# barramentos e dispositivos de uma arvore sysfs falsa
+def test_sysfs():
+	check(raises(TypeError, usb.setSysfsRoot, 1), "sysfs")
+	root = fake_tree()
+	if root is None:
+		return
+	try:
+		names = [(b.dirname, [d.filename for d in b.devices]) for b in usb.busses()]
+		check(names == [("091", ["002"]), ("092", ["005"])], "sysfs")
+		usb.refresh()
+		fake_device(root, "91-3", 91, 4, 0x1234, 0x567b)
+		added, removed = usb.refresh()
+		check(len(added) == 1 and added[0].devnum == 4 and not removed, "sysfs")
+		shutil.rmtree(os.path.join(root, "91-3"))
+		added, removed = usb.refresh()
+		check(not added and len(removed) == 1 and removed[0].devnum == 4, "sysfs")
+	finally:
+		drop_tree(root)
+
+# salva uma arvore falsa e a recarrega; os nos dos dispositivos
+# sao procurados em USB_DEVFS_PATH
+def test_snapshot():
+	root = fake_tree()
+	if root is None:
+		return
+	path = os.path.join(root, "snapshot")
+	nodes = os.path.join(root, "dev")
+	for bus, dev in (("091", "002"), ("092", "005")):
+		os.makedirs(os.path.join(nodes, bus))
+		open(os.path.join(nodes, bus, dev), "w").close()
+	os.environ["USB_DEVFS_PATH"] = nodes
+	try:
+		usb.saveSnapshot(path)
+		check(usb.loadSnapshot(path) == 2, "snapshot")
+		config = [d for d in usb.busses()[1].devices][0].configurations[0]
+		check(config.interfaces[0][0].interfaceClass == 0xff, "snapshot")
+		os.remove(os.path.join(nodes, "092", "005"))
+		usb.refresh()
+		names = [(b.dirname, [d.filename for d in b.devices]) for b in usb.busses()]
+		check(names == [("091", ["002"]), ("092", [])], "snapshot")
+
+		open(path, "wb").write("not a snapshot")
+		check(raises(ValueError, usb.loadSnapshot, path), "snapshot")
+		check(raises(IOError, usb.loadSnapshot, path + ".missing"), "snapshot")
+	finally:
+		usb.loadSnapshot(None)
+		del os.environ["USB_DEVFS_PATH"]
+		drop_tree(root)
+
+# a segunda leitura de uma string vem do cache
+def test_cache(dev, handle):
+	dev.cacheDescriptors = True
+	dev.clearCache()
+	hits = dev.cacheHits
+	check(handle.getString(1, 100) == handle.getString(1, 100), "descriptor cache")
+	check(dev.cacheHits == hits + 1, "descriptor cache")
+	dev.cacheDescriptors = False
+
+# descritores extra e descritor de configuracao completo
+def test_extra():
+	root = fake_tree()
+	if root is None:
+		return
+	try:
+		config = usb.find(idProduct=0x5678).configurations[0]
+		interface = config.interfaces[0][0]
+		check(config.totalLength == 37, "extra descriptors")
+		check(len(config.raw) == config.totalLength, "extra descriptors")
+		check(str(interface.extra) == "\x05\x24\x01\x02\x03", "extra descriptors")
+		check(len(interface.endpoints[0].extra) == 0, "extra descriptors")
+	finally:
+		drop_tree(root)
+
+# uma thread varre os barramentos enquanto outra le os descritores
+# de forma preguicosa; um dispositivo eh conectado e desconectado
+def test_threads():
+	root = fake_tree()
+	if root is None:
+		return
+	expected = [(0x82, 2, 64), (0x02, 2, 64)]
+	errors = []
+
+	def scan():
+		try:
+			for x in range(50):
+				fake_device(root, "91-3", 91, 4, 0x1234, 0x567b)
+				usb.busses()
+				check(usb.find(idProduct=0x5678) is not None, "threads")
+				usb.refresh()
+				shutil.rmtree(os.path.join(root, "91-3"))
+				usb.refresh()
+		except Exception, e:
+			errors.append(e)
+
+	def read():
+		try:
+			for x in range(50):
+				for dev in usb.findAll(idVendor=0x1234):
+					try:
+						interface = dev.configurations[0].interfaces[0][0]
+						endpoints = [(e.address, e.type, e.maxPacketSize)
+									 for e in interface.endpoints]
+					except usb.USBError:
+						# so o dispositivo desconectado pode sumir
+						check(dev.idProduct == 0x567b, "threads")
+						continue
+					check(endpoints == expected, "threads")
+		except Exception, e:
+			errors.append(e)
+
+	try:
+		threads = [threading.Thread(target=scan), threading.Thread(target=read)]
+		for thread in threads:
+			thread.start()
+		for thread in threads:
+			thread.join(60)
+			check(not thread.isAlive(), "threads")
+		check(errors == [], "threads")
+		check(len(usb.findAll(idVendor=0x1234)) == 2, "threads")
+	finally:
+		drop_tree(root)
+
+# argumentos de usb.openAll
+def test_open_all_args():
+	check(usb.openAll([]) == [], "openAll")
+	check(raises(TypeError, usb.openAll, [1]), "openAll")
+	check(raises(ValueError, usb.openAll, [], altsetting=0), "openAll")
+
+# os dispositivos de uma arvore falsa nao podem ser abertos
+def test_open_all_errors():
+	root = fake_tree()
+	if root is None:
+		return
+	try:
+		dev = usb.find(idProduct=0x5678)
+		check(raises(ValueError, usb.openAll, [dev, dev]), "openAll")
+		result = usb.openAll([dev], 1, 0)
+		check(len(result) == 1 and isinstance(result[0], usb.USBError), "openAll")
+		check(result[0].errno > 0, "openAll")
+	finally:
+		drop_tree(root)
+
+# abre o dispositivo mais uma vez, sem mudar sua configuracao
+def test_open_all(dev):
+	result = usb.openAll([dev])
+	check(len(result) == 1 and isinstance(result[0], usb.DeviceHandle), "openAll")
+	check(len(result[0].getDescriptor(1, 0, 18)) == 18, "openAll")
+	del result
+
+# contadores dos locks dos endpoints usados
+def test_lock_stats(handle):
+	stats = handle.lockStats()
+	for acquired, contended in stats.values():
+		check(acquired >= contended, "lock stats")
+	if stats:
+		check(0x2 in stats and 0x82 in stats and 0 in stats, "lock stats")
+
+# hierarquia das excecoes
+def test_errors():
+	check(issubclass(usb.USBError, IOError), "errors")
+	for cls in (usb.USBTimeoutError, usb.USBPipeError,
+				usb.USBNoDeviceError, usb.USBOverflowError):
+		check(issubclass(cls, usb.USBError), "errors")
+
+# nada foi escrito, a leitura expira
+def test_timeout(handle):
+	try:
+		handle.bulkRead(0x82, 64, 100)
+	except usb.USBTimeoutError, e:
+		check(e.errno == errno.ETIMEDOUT, "timeout")
+	else:
+		check(False, "timeout")
+
+# interfaces apropriadas pelo handle
+def test_claims(handle):
+	check(handle.claimedInterfaces == {0: 0}, "claimed interfaces")
+	check(raises(ValueError, handle.claimInterface, 256), "claimed interfaces")
+	check(raises(ValueError, usb.openAll, [], interface=256), "claimed interfaces")
+	check(raises(ValueError, handle.bulkWrite, 0x5, "x", 1000), "claimed interfaces")
+	handle.releaseInterface()
+	check(handle.claimedInterfaces == {}, "claimed interfaces")
+	handle.claimInterface(0)
+	check(handle.claimedInterfaces == {0: 0}, "claimed interfaces")
+
 
 if __name__ == "__main__":		# modulo princial?
 	print "********************************"
@@ -40,6 +459,54 @@ if __name__ == "__main__":		# modulo princial?
 	print "********************************"
 	print ""
 
+	print "result format test..."
+	test_result_format()
+	print "result format test ok..."
+
+	print "poll arguments test..."
+	test_poll_args()
+	print "poll arguments test ok..."
+
+	print "monitor test..."
+	test_monitor()
+	print "monitor test ok..."
+
+	print "refresh test..."
+	test_refresh()
+	print "refresh test ok..."
+
+	print "find arguments test..."
+	test_find_args()
+	print "find arguments test ok..."
+
+	print "sysfs test..."
+	test_sysfs()
+	print "sysfs test ok..."
+
+	print "snapshot test..."
+	test_snapshot()
+	print "snapshot test ok..."
+
+	print "extra descriptors test..."
+	test_extra()
+	print "extra descriptors test ok..."
+
+	print "threads test..."
+	test_threads()
+	print "threads test ok..."
+
+	print "openAll arguments test..."
+	test_open_all_args()
+	print "openAll arguments test ok..."
+
+	print "openAll errors test..."
+	test_open_all_errors()
+	print "openAll errors test ok..."
+
+	print "errors test..."
+	test_errors()
+	print "errors test ok..."
+
 	busses = usb.busses()	# varre os barramentos
 
 	# teste de enumeracao. Tenta encontrar o nosso hardware
@@ -81,9 +548,82 @@ if __name__ == "__main__":		# modulo princial?
 		test_bulk(handle, "bulk test 1")
 		test_interrupt(handle, "interrupt test 2")
 		test_bulk(handle, "bulk test 2")
+		test_bulk_into(handle, "bulk test 3")
 
 	print "I/O test ok..."
 
+	print "result format I/O test..."
+	test_bulk_bytes(handle, "bulk test 4")
+	print "result format I/O test ok..."
+
+	print "buffer write test..."
+	test_bulk_buffers(handle, "bulk test 5")
+	print "buffer write test ok..."
+
+	print "buffer pool test..."
+	test_pool(handle, "bulk test 6")
+	print "buffer pool test ok..."
+
+	print "asynchronous transfer test..."
+	test_submit(handle, "bulk test 7")
+	print "asynchronous transfer test ok..."
+
+	print "stream reader test..."
+	test_stream(handle, "bulk test 8")
+	print "stream reader test ok..."
+
+	print "isochronous arguments test..."
+	test_iso_args(handle)
+	print "isochronous arguments test ok..."
+
+	print "vectored I/O test..."
+	test_bulk_vector(handle, ["bulk ", "test ", "9"])
+	print "vectored I/O test ok..."
+
+	print "execute test..."
+	test_execute(handle, "bulk test 10")
+	print "execute test ok..."
+
+	print "chunked bulk test..."
+	test_bulk_chunks(handle, "chunked bulk test " * 10)
+	print "chunked bulk test ok..."
+
+	print "poll test..."
+	test_poll(handle, "bulk test 11")
+	print "poll test ok..."
+
+	print "done callback test..."
+	test_done_callback(handle, "bulk test 12")
+	print "done callback test ok..."
+
+	print "lazy descriptors test..."
+	test_lazy(dev)
+	print "lazy descriptors test ok..."
+
+	print "find test..."
+	test_find(dev)
+	print "find test ok..."
+
+	print "descriptor cache test..."
+	test_cache(dev, handle)
+	print "descriptor cache test ok..."
+
+	print "openAll test..."
+	test_open_all(dev)
+	print "openAll test ok..."
+
+	print "lock stats test..."
+	test_lock_stats(handle)
+	print "lock stats test ok..."
+
+	print "timeout test..."
+	test_timeout(handle)
+	print "timeout test ok..."
+
+	print "claimed interfaces test..."
+	test_claims(handle)
+	print "claimed interfaces test ok..."
+
 	print "reset endpoint test..."
 	# Essa funcao esta com problemas no Windows.
 	# Sempre quando eh chamada levanta uma excessao dizendo